@@ -1,23 +1,408 @@
 #include "block.h"
+#include "keysearch.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
 
-Block::Block(size_t size) : blockSize(size) {}
+Block::Block(size_t size, PageLayout layout) : page(size, 0), blockSize(size) {
+    if (size < sizeof(PageHeader) || size > UINT16_MAX) {
+        throw std::invalid_argument("Block size must fit a page header and 16-bit offsets");
+    }
+    BlockEditor::format(page.data(), size, layout);
+}
+
+static size_t bitmapBytes(size_t rows) { return (rows + 63) / 64 * sizeof(uint64_t); }
+
+// the most rows whose bitmap and minipages fit behind the header; 2-byte
+// minipages come first so every one of them stays 2-byte aligned
+PaxGeometry paxGeometry(size_t blockSize) {
+    PaxGeometry g;
+    const size_t start = (sizeof(PageHeader) + 15) / 16 * 16;
+    if (blockSize <= start) return g;
+    // a row takes 16 bytes and a bit
+    size_t rows = (blockSize - start) * 8 / (8 * sizeof(PackedRecord) + 1) + 1;
+    while (rows > 0 && start + bitmapBytes(rows) + rows * sizeof(PackedRecord) > blockSize) --rows;
+    rows = std::min<size_t>(rows, NO_SLOT);
+    g.capacity = static_cast<uint16_t>(rows);
+    g.bitmap = static_cast<uint16_t>(start);
+    size_t at = start + bitmapBytes(rows);
+    for (size_t width : {2, 1}) {
+        for (size_t c = 0; c < COLUMN_COUNT; ++c) {
+            if (columnWidth(static_cast<Column>(c)) != width) continue;
+            g.column[c] = static_cast<uint16_t>(at);
+            at += width * rows;
+        }
+    }
+    return g;
+}
+
+static bool rowLive(const uint8_t *page, const PaxGeometry &pax, size_t slot) {
+    uint64_t word;
+    std::memcpy(&word, page + pax.bitmap + slot / 64 * sizeof(word), sizeof(word));
+    return (word >> (slot % 64)) & 1;
+}
+
+// PAX: row `slot` of every minipage
+static PackedRecord gatherRow(const uint8_t *page, const PaxGeometry &pax, size_t slot) {
+    PackedRecord p;
+    for (size_t c = 0; c < COLUMN_COUNT; ++c) {
+        const uint8_t *at = page + pax.column[c];
+        uint16_t code;
+        if (columnWidth(static_cast<Column>(c)) == 2) std::memcpy(&code, at + slot * 2, 2);
+        else code = at[slot];
+        setPackedField(p, static_cast<Column>(c), code);
+    }
+    return p;
+}
+
+Block::Block(size_t size, const uint8_t *src) : Block(size) {
+    std::memcpy(page.data(), src, size);
+}
+
+size_t BlockView::getFreeSpace() const {
+    const PageHeader &h = header();
+    if (isPax()) return (pax.capacity - h.live_count) * sizeof(PackedRecord);
+    return h.free_end - (sizeof(PageHeader) + h.num_slots * sizeof(SlotEntry)) + h.frag_bytes;
+}
+
+bool BlockView::isLive(size_t slot) const {
+    if (slot >= getNumSlots()) return false;
+    if (isPax()) return rowLive(page, pax, slot);
+    SlotEntry e;
+    std::memcpy(&e, page + sizeof(PageHeader) + slot * sizeof(SlotEntry), sizeof(e));
+    return e.length != 0;
+}
+
+PackedRecord BlockView::getPacked(size_t slot) const {
+    if (slot >= getNumSlots()) {
+        throw std::out_of_range("Slot out of range");
+    }
+    if (isPax()) {
+        if (!rowLive(page, pax, slot)) throw std::out_of_range("Slot holds a deleted record");
+        return gatherRow(page, pax, slot);
+    }
+    SlotEntry e;
+    std::memcpy(&e, page + sizeof(PageHeader) + slot * sizeof(SlotEntry), sizeof(e));
+    if (e.length == 0) {
+        throw std::out_of_range("Slot holds a deleted record");
+    }
+    PackedRecord p;
+    std::memcpy(&p, page + e.offset, sizeof(p));
+    return p;
+}
+
+RecordView BlockView::getRecordView(size_t slot) const {
+    const PackedRecord p = getPacked(slot);
+    return RecordView(reinterpret_cast<const uint8_t *>(&p), teams);
+}
+
+ColumnFilter::ColumnFilter(const std::vector<ColumnPredicate> &where, const TeamDictionary &teams) {
+    for (const ColumnPredicate &pred : where) {
+        Term t;
+        t.column = pred.column;
+        if (columnWidth(pred.column) == 2) {
+            none |= !predicateCodeRange(pred, t.lo, t.hi);
+        } else {
+            bool any = false;
+            for (size_t c = 0; c < 256; ++c) {
+                t.match[c] = predicateMatches(pred, columnValue(pred.column, static_cast<uint16_t>(c), teams));
+                any |= t.match[c];
+            }
+            none |= !any;
+        }
+        parts.push_back(t);
+    }
+}
 
-bool Block::addRecord(const Record &record) {
-    size_t currentSize = 0;
-    for (const auto &r : records) {
-        currentSize += r.size();
+bool ColumnFilter::mayMatch(const PageHeader &h) const {
+    if (none) return false;
+    for (const Term &t : parts) {
+        const size_t c = static_cast<size_t>(t.column);
+        const uint16_t lo = h.zone_min[c], hi = h.zone_max[c];
+        if (lo > hi) return false; // no records
+        if (columnWidth(t.column) == 2) {
+            if (hi < t.lo || lo > t.hi) return false;
+        } else if (std::find(t.match + lo, t.match + std::min<size_t>(hi, 255) + 1, true) == t.match + std::min<size_t>(hi, 255) + 1) {
+            return false;
+        }
     }
-    if (currentSize + record.size() <= blockSize) {
-        records.push_back(record);
+    return true;
+}
+
+bool ColumnFilter::matches(const RecordView &r) const {
+    for (const Term &t : parts) {
+        const uint16_t code = r.code(t.column);
+        if (columnWidth(t.column) == 2 ? code < t.lo || code > t.hi : !t.match[code]) return false;
+    }
+    return true;
+}
+
+size_t BlockView::select(const ColumnFilter &filter, std::vector<uint64_t> &bits) const {
+    const size_t n = getNumSlots();
+    const size_t words = (n + 63) / 64;
+    bits.assign(words, 0);
+    if (n == 0 || !mayMatch(filter)) return 0;
+
+    if (!isPax()) {
+        const bool all = filter.terms().empty();
+        for (size_t s = 0; s < n; ++s) {
+            if (isLive(s) && (all || filter.matches(getRecordView(s)))) bits[s / 64] |= uint64_t(1) << (s % 64);
+        }
+    } else {
+        std::memcpy(bits.data(), page + pax.bitmap, words * sizeof(uint64_t));
+        uint64_t more[(NO_SLOT + 63) / 64];
+        for (const ColumnFilter::Term &t : filter.terms()) {
+            const uint8_t *col = columnData(t.column);
+            if (columnWidth(t.column) == 2) {
+                columnSelect16(reinterpret_cast<const uint16_t *>(col), n, t.lo, t.hi, more);
+                for (size_t w = 0; w < words; ++w) bits[w] &= more[w];
+            } else {
+                for (size_t w = 0; w < words; ++w) {
+                    uint64_t word = 0;
+                    for (size_t s = w * 64; s < std::min(n, w * 64 + 64); ++s) word |= uint64_t(t.match[col[s]]) << (s % 64);
+                    bits[w] &= word;
+                }
+            }
+        }
+    }
+    size_t count = 0;
+    for (uint64_t w : bits) count += static_cast<size_t>(__builtin_popcountll(w));
+    return count;
+}
+
+size_t BlockView::select(const std::vector<ColumnPredicate> &where, std::vector<uint64_t> &bits) const {
+    static const TeamDictionary none;
+    return select(ColumnFilter(where, teams ? *teams : none), bits);
+}
+
+void BlockEditor::format(uint8_t *p, size_t size, PageLayout layout) {
+    PageHeader h{};
+    h.layout = static_cast<uint16_t>(layout);
+    h.num_slots = 0;
+    h.free_end = static_cast<uint16_t>(size);
+    h.live_count = 0;
+    h.frag_bytes = 0;
+    h.free_slot = NO_SLOT;
+    std::fill(h.zone_min, h.zone_min + COLUMN_COUNT, UINT16_MAX);
+    std::fill(h.zone_max, h.zone_max + COLUMN_COUNT, 0);
+    std::memcpy(p, &h, sizeof(h));
+}
+
+size_t BlockEditor::contiguousFree() {
+    const PageHeader &h = header();
+    return h.free_end - (sizeof(PageHeader) + h.num_slots * sizeof(SlotEntry));
+}
+
+// make room for len payload bytes (plus a directory entry when newSlot),
+// compacting only when the free bytes are there but fragmented
+bool BlockEditor::reserve(size_t len, bool newSlot) {
+    const size_t need = len + (newSlot ? sizeof(SlotEntry) : 0);
+    if (need <= contiguousFree()) return true;
+    if (need > contiguousFree() + header().frag_bytes) return false;
+    compact();
+    return need <= contiguousFree();
+}
+
+// PAX: write the record into row `slot` of every minipage
+void BlockEditor::writeRow(uint16_t slot, const Record &record, TeamDictionary &teams) {
+    PackedRecord p;
+    record.pack(reinterpret_cast<uint8_t *>(&p), teams);
+    for (size_t c = 0; c < COLUMN_COUNT; ++c) {
+        const uint16_t code = packedField(p, static_cast<Column>(c));
+        if (columnWidth(static_cast<Column>(c)) == 2) std::memcpy(page + pax.column[c] + slot * 2, &code, 2);
+        else page[pax.column[c] + slot] = static_cast<uint8_t>(code);
+    }
+    liveBits()[slot / 64] |= uint64_t(1) << (slot % 64);
+    widenZones(p);
+}
+
+PackedRecord BlockEditor::row(uint16_t slot) {
+    if (isPax()) return gatherRow(page, pax, slot);
+    PackedRecord p;
+    std::memcpy(&p, page + slots()[slot].offset, sizeof(p));
+    return p;
+}
+
+void BlockEditor::widenZones(const PackedRecord &p) {
+    PageHeader &h = header();
+    for (size_t c = 0; c < COLUMN_COUNT; ++c) {
+        const uint16_t code = packedField(p, static_cast<Column>(c));
+        h.zone_min[c] = std::min(h.zone_min[c], code);
+        h.zone_max[c] = std::max(h.zone_max[c], code);
+    }
+}
+
+// bounds stay valid when a record inside them leaves; only a record on a
+// bound makes the page look at its records again
+void BlockEditor::dropFromZones(const PackedRecord &p) {
+    const PageHeader &h = header();
+    for (size_t c = 0; c < COLUMN_COUNT; ++c) {
+        const uint16_t code = packedField(p, static_cast<Column>(c));
+        if (code == h.zone_min[c] || code == h.zone_max[c]) {
+            rebuildZoneMap();
+            return;
+        }
+    }
+}
+
+void BlockEditor::rebuildZoneMap() {
+    PageHeader &h = header();
+    std::fill(h.zone_min, h.zone_min + COLUMN_COUNT, UINT16_MAX);
+    std::fill(h.zone_max, h.zone_max + COLUMN_COUNT, 0);
+    const BlockView view(page, blockSize, nullptr);
+    for (uint16_t s = 0; s < h.num_slots; ++s) {
+        if (view.isLive(s)) widenZones(row(s));
+    }
+}
+
+void BlockEditor::nextFreeRow() {
+    PageHeader &h = header();
+    for (size_t w = h.free_slot / 64; w * 64 < h.num_slots; ++w) {
+        const uint64_t dead = ~liveBits()[w] & (w * 64 + 64 <= h.num_slots ? ~uint64_t(0) : (uint64_t(1) << (h.num_slots % 64)) - 1);
+        if (dead != 0) {
+            h.free_slot = static_cast<uint16_t>(w * 64 + static_cast<size_t>(__builtin_ctzll(dead)));
+            return;
+        }
+    }
+    h.free_slot = NO_SLOT;
+}
+
+bool BlockEditor::addRecord(const Record &record, TeamDictionary &teams, uint16_t *slotOut) {
+    if (isPax()) {
+        PageHeader &h = header();
+        uint16_t slot;
+        if (h.free_slot != NO_SLOT) {
+            slot = h.free_slot;
+        } else if (h.num_slots < pax.capacity) {
+            slot = h.num_slots++;
+        } else {
+            return false;
+        }
+        writeRow(slot, record, teams);
+        h.live_count++;
+        if (slot == h.free_slot) nextFreeRow();
+        if (slotOut) *slotOut = slot;
         return true;
     }
-    return false;
+    const size_t len = record.size();
+    const bool newSlot = header().free_slot == NO_SLOT;
+    if (!reserve(len, newSlot)) {
+        return false;
+    }
+
+    PageHeader &h = header();
+    uint16_t slot;
+    if (newSlot) {
+        slot = h.num_slots++;
+    } else {
+        slot = h.free_slot;
+        h.free_slot = slots()[slot].offset;
+    }
+
+    const uint16_t offset = static_cast<uint16_t>(h.free_end - len);
+    record.pack(page + offset, teams);
+    slots()[slot] = SlotEntry{offset, static_cast<uint16_t>(len)};
+    h.free_end = offset;
+    h.live_count++;
+    widenZones(row(slot));
+    if (slotOut) *slotOut = slot;
+    return true;
+}
+
+bool BlockEditor::restoreRecord(uint16_t slot, const Record &record, TeamDictionary &teams) {
+    PageHeader &h = header();
+    if (isPax()) {
+        if (slot >= h.num_slots || BlockView(page, blockSize, nullptr).isLive(slot)) return false;
+        writeRow(slot, record, teams);
+        h.live_count++;
+        if (slot == h.free_slot) nextFreeRow();
+        return true;
+    }
+    if (slot >= h.num_slots || slots()[slot].length != 0) {
+        return false;
+    }
+    const size_t len = record.size();
+    if (!reserve(len, false)) {
+        return false;
+    }
+
+    // unlink the slot from the free chain
+    uint16_t *link = &header().free_slot;
+    while (*link != slot) {
+        if (*link == NO_SLOT) return false;
+        link = &slots()[*link].offset;
+    }
+    *link = slots()[slot].offset;
+
+    const uint16_t offset = static_cast<uint16_t>(h.free_end - len);
+    record.pack(page + offset, teams);
+    slots()[slot] = SlotEntry{offset, static_cast<uint16_t>(len)};
+    h.free_end = offset;
+    h.live_count++;
+    widenZones(row(slot));
+    return true;
 }
 
-size_t Block::getNumRecords() const {
-    return records.size();
+bool BlockEditor::updateRecord(uint16_t slot, const Record &record, TeamDictionary &teams) {
+    if (!BlockView(page, blockSize, nullptr).isLive(slot)) return false;
+    const PackedRecord old = row(slot);
+    if (isPax()) {
+        writeRow(slot, record, teams);
+    } else {
+        // records are fixed width, so an update always fits where the old one was
+        record.pack(page + slots()[slot].offset, teams);
+        widenZones(row(slot));
+    }
+    dropFromZones(old);
+    return true;
+}
+
+bool BlockEditor::deleteRecord(uint16_t slot) {
+    PageHeader &h = header();
+    if (!BlockView(page, blockSize, nullptr).isLive(slot)) return false;
+    const PackedRecord old = row(slot);
+    if (isPax()) {
+        liveBits()[slot / 64] &= ~(uint64_t(1) << (slot % 64));
+        h.free_slot = std::min(h.free_slot, slot);
+        h.live_count--;
+        dropFromZones(old);
+        return true;
+    }
+    SlotEntry &e = slots()[slot];
+    if (e.offset == h.free_end) {
+        h.free_end = static_cast<uint16_t>(h.free_end + e.length); // lowest record, just give it back
+    } else {
+        h.frag_bytes = static_cast<uint16_t>(h.frag_bytes + e.length);
+    }
+    e = SlotEntry{h.free_slot, 0};
+    h.free_slot = slot;
+    h.live_count--;
+    dropFromZones(old);
+    return true;
 }
 
-size_t Block::getBlockSize() const {
-    return blockSize;
+// slide the live records up against the end of the page, highest offset
+// first so memmove never overwrites a record that has not moved yet; slot
+// ids and tombstones stay put
+void BlockEditor::compact() {
+    if (isPax()) return;
+    PageHeader &h = header();
+    std::vector<uint16_t> live;
+    live.reserve(h.live_count);
+    for (uint16_t s = 0; s < h.num_slots; ++s) {
+        if (slots()[s].length != 0) live.push_back(s);
+    }
+    std::sort(live.begin(), live.end(), [&](uint16_t a, uint16_t b) {
+        return slots()[a].offset > slots()[b].offset;
+    });
+
+    size_t end = blockSize;
+    for (uint16_t s : live) {
+        SlotEntry &e = slots()[s];
+        end -= e.length;
+        if (e.offset != end) std::memmove(page + end, page + e.offset, e.length);
+        e.offset = static_cast<uint16_t>(end);
+    }
+    h.free_end = static_cast<uint16_t>(end);
+    h.frag_bytes = 0;
 }
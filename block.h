@@ -2,19 +2,214 @@
 #define BLOCK_H
 
 #include "record.h"
+#include "bufferpool.h"
+#include <cstdint>
+#include <utility>
 #include <vector>
 
+// how a heap page stores its records; every page says which it uses
+enum class PageLayout : uint16_t {
+    Slotted = 0, // packed records behind a slot directory
+    PAX = 1      // one minipage per column, see PaxGeometry
+};
+
+#pragma pack(push, 1)
+// header at the start of every heap page
+struct PageHeader {
+    uint16_t num_slots;  // entries in the slot directory, live or tombstoned
+    uint16_t free_end;   // records occupy [free_end, blockSize)
+    uint16_t live_count; // slots holding a record
+    uint16_t frag_bytes; // bytes of deleted records left inside the record area
+    uint16_t free_slot;  // first tombstoned slot, or NO_SLOT
+    uint16_t layout;     // PageLayout
+    // zone map: the smallest and largest code of each column (Column order)
+    // among the live records, so a scan can rule the page out from its
+    // header; min > max on a page without records. Deletes and updates
+    // recompute a column only when they remove one of its bounds
+    uint16_t zone_min[COLUMN_COUNT];
+    uint16_t zone_max[COLUMN_COUNT];
+};
+
+// slot directory entry, the directory grows forward right after the header;
+// a tombstone has length 0 and its offset links to the next free slot
+struct SlotEntry {
+    uint16_t offset; // byte offset of the packed record inside the page
+    uint16_t length; // packed record length, 0 = tombstone
+};
+#pragma pack(pop)
+
+static const uint16_t NO_SLOT = UINT16_MAX;
+
+// RID - Record ID: block number, slot number inside the block
+// 4B + 4B = 8B
+struct RID {
+    uint32_t block; //4B
+    uint32_t slot; //4B
+    // define comparison operators
+    bool operator<(const RID& o) const {
+        return block < o.block || (block == o.block && slot < o.slot); // compare based on blocks, then slots
+    }
+    bool operator==(const RID& o) const {
+        return block == o.block && slot == o.slot; // 2 RID equal if the block number AND the slot number is the same
+    }
+};
+
+// PAX page: the records of a page stored column by column, so a filter on
+// one field reads only that field's bytes:
+// | PageHeader | pad to 16 | live bitmap | 2-byte columns | 1-byte columns |
+// each column is a minipage of `capacity` codes in Column order within its
+// width; slot s is row s of every minipage. A delete clears the slot's live
+// bit (free_slot is then the lowest dead slot), so slot ids never move and
+// there is nothing to compact; free_end and frag_bytes are unused
+struct PaxGeometry {
+    uint16_t capacity = 0; // rows per page
+    uint16_t bitmap = 0;   // offset of the live bitmap, one bit per row
+    uint16_t column[COLUMN_COUNT] = {};
+};
+PaxGeometry paxGeometry(size_t blockSize);
+
+// a conjunction of column predicates, turned once per scan into what the
+// page code tests: the code range of a 2-byte column, a per-code answer for
+// a 1-byte one (team codes follow the dictionary, not the team ids)
+class ColumnFilter {
+public:
+    struct Term {
+        Column column;
+        uint16_t lo = 0, hi = 0; // 2-byte columns
+        bool match[256] = {};    // 1-byte columns
+    };
+
+    ColumnFilter(const std::vector<ColumnPredicate> &where, const TeamDictionary &teams);
+    const std::vector<Term> &terms() const { return parts; }
+    bool never() const { return none; } // some predicate matches no code
+    bool matches(const RecordView &r) const;
+    // false when the page's zone map rules out every term's codes
+    bool mayMatch(const PageHeader &h) const;
+
+private:
+    std::vector<Term> parts;
+    bool none = false;
+};
+
+// read-only view of one heap page, wherever the page image lives
+// (inside a Block, straight in a memory-mapped heap file, or in a buffer
+// pool frame that stays pinned for as long as the view exists)
+class BlockView {
+private:
+    const uint8_t *page;
+    size_t blockSize;
+    const TeamDictionary *teams;
+    PageGuard pin;
+    PaxGeometry pax; // PAX pages only
+
+public:
+    BlockView(const uint8_t *p, size_t size, const TeamDictionary *dict)
+        : page(p), blockSize(size), teams(dict) {
+        if (isPax()) pax = paxGeometry(size);
+    }
+    BlockView(PageGuard guard, size_t size, const TeamDictionary *dict)
+        : BlockView(guard.data(), size, dict) {
+        pin = std::move(guard);
+    }
+    const PageHeader &header() const { return *reinterpret_cast<const PageHeader *>(page); }
+    PageLayout layout() const { return static_cast<PageLayout>(header().layout); }
+    bool isPax() const { return layout() == PageLayout::PAX; }
+    size_t getNumSlots() const { return header().num_slots; } // loop bound for slot ids
+    size_t getNumRecords() const { return header().live_count; }
+    size_t getBlockSize() const { return blockSize; }
+    size_t getFreeSpace() const; // including space compaction would reclaim
+    bool isLive(size_t slot) const;
+    RecordView getRecordView(size_t slot) const; // fields read in place, no copy
+    PackedRecord getPacked(size_t slot) const;   // as stored, gathered on PAX pages
+    Record getRecord(size_t slot) const { return getRecordView(slot).toRecord(); }
+
+    // false when the zone map shows no live record can match
+    bool mayMatch(const ColumnFilter &filter) const { return filter.mayMatch(header()); }
+    // live records matching every predicate: bit s % 64 of bits[s / 64] for
+    // slot s, over getNumSlots() slots; returns how many. A page the zone
+    // map rules out is not read past its header; a PAX page runs the SIMD
+    // column kernels over only the minipages the predicates name, a slotted
+    // page tests record by record
+    size_t select(const ColumnFilter &filter, std::vector<uint64_t> &bits) const;
+    size_t select(const std::vector<ColumnPredicate> &where, std::vector<uint64_t> &bits) const;
+    // PAX pages: the minipage of a column, 1 or 2 bytes per row
+    const uint8_t *columnData(Column column) const { return page + pax.column[static_cast<size_t>(column)]; }
+
+    const uint8_t *data() const { return page; }
+};
+
+// in-place edits of one slotted page; slot ids never move, so a RID
+// {block, slot} stays valid across deletes, updates and compaction
+class BlockEditor {
+private:
+    uint8_t *page;
+    size_t blockSize;
+
+    PaxGeometry pax; // PAX pages only
+
+    PageHeader &header() { return *reinterpret_cast<PageHeader *>(page); }
+    SlotEntry *slots() { return reinterpret_cast<SlotEntry *>(page + sizeof(PageHeader)); }
+    size_t contiguousFree();
+    bool reserve(size_t len, bool newSlot);
+    bool isPax() { return header().layout == static_cast<uint16_t>(PageLayout::PAX); }
+    uint64_t *liveBits() { return reinterpret_cast<uint64_t *>(page + pax.bitmap); }
+    void writeRow(uint16_t slot, const Record &record, TeamDictionary &teams); // PAX: scatter, mark live
+    void nextFreeRow(); // PAX: free_slot to the lowest dead slot
+    PackedRecord row(uint16_t slot); // the packed record in a live slot
+    void widenZones(const PackedRecord &p);
+    void dropFromZones(const PackedRecord &p); // p left the page
+
+public:
+    BlockEditor(uint8_t *p, size_t size) : page(p), blockSize(size) {
+        if (isPax()) pax = paxGeometry(size);
+    }
+    static void format(uint8_t *p, size_t size, PageLayout layout = PageLayout::Slotted); // empty page
+
+    bool addRecord(const Record &record, TeamDictionary &teams, uint16_t *slotOut = nullptr);
+    bool restoreRecord(uint16_t slot, const Record &record, TeamDictionary &teams); // refill a tombstone
+    bool updateRecord(uint16_t slot, const Record &record, TeamDictionary &teams);
+    bool deleteRecord(uint16_t slot); // false if the slot holds no record
+    void compact();
+    void rebuildZoneMap(); // from the live records
+};
+
+// a block is one blockSize page image, slotted:
+// | PageHeader | slot 0 | slot 1 | ... free space ... | record 1 | record 0 |
+// or PAX (see PaxGeometry)
 class Block {
 private:
-    std::vector<Record> records;
+    std::vector<uint8_t> page;
     size_t blockSize; // max size in bytes
 
 public:
-    Block(size_t size);
-    bool addRecord(const Record &record);
-    size_t getNumRecords() const;
-    size_t getBlockSize() const;
-    const Record& getRecord(size_t idx) const { return records.at(idx); }
+    explicit Block(size_t size, PageLayout layout = PageLayout::Slotted);
+    Block(size_t size, const uint8_t *src); // copy an existing page image
+    bool addRecord(const Record &record, TeamDictionary &teams, uint16_t *slotOut = nullptr) {
+        return edit().addRecord(record, teams, slotOut);
+    }
+    bool restoreRecord(uint16_t slot, const Record &record, TeamDictionary &teams) {
+        return edit().restoreRecord(slot, record, teams);
+    }
+    bool updateRecord(uint16_t slot, const Record &record, TeamDictionary &teams) {
+        return edit().updateRecord(slot, record, teams);
+    }
+    bool deleteRecord(uint16_t slot) { return edit().deleteRecord(slot); }
+    void compact() { edit().compact(); }
+
+    // records are fixed width, so every full page holds the same number
+    static size_t recordsPerPage(size_t size, PageLayout layout = PageLayout::Slotted) {
+        if (layout == PageLayout::PAX) return paxGeometry(size).capacity;
+        return (size - sizeof(PageHeader)) / (sizeof(PackedRecord) + sizeof(SlotEntry));
+    }
+    size_t getNumSlots() const { return view(nullptr).getNumSlots(); }
+    size_t getNumRecords() const { return view(nullptr).getNumRecords(); }
+    size_t getBlockSize() const { return blockSize; }
+    size_t getFreeSpace() const { return view(nullptr).getFreeSpace(); }
+
+    BlockView view(const TeamDictionary *teams) const { return BlockView(page.data(), blockSize, teams); }
+    BlockEditor edit() { return BlockEditor(page.data(), blockSize); }
+    const uint8_t *data() const { return page.data(); }
+    uint8_t *data() { return page.data(); }
 };
 
 #endif
@@ -2,8 +2,13 @@
 #include "databasefile.h"
 #include "block.h"
 #include "record.h"
+#include "keysearch.h"
+#include "parallel.h"
+#include "scan.h"
+#include "extsort.h"
 
 #include <algorithm>
+#include <type_traits>
 #include <iostream>
 #include <vector>
 #include <cstdint>
@@ -11,99 +16,1319 @@
 #include <iomanip>
 #include <fstream>
 #include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
 #include <set>
-#include <unordered_set>
+#include <limits>
+#include <cmath>
+#include <mutex>
+#include <thread>
 
 
-// read heap file and collect (key, RID) pairs
-void collect_pairs_ft_pct(const Database& db, std::vector<LeafEntry>& out_pairs) {
-    const auto& blocks = db.getBlocks();
+// read heap file and collect (key, RID) pairs in index order
+void collect_pairs_ft_pct(const Database& db, std::vector<LeafEntry>& out_pairs, unsigned numThreads) {
+    const size_t blocks = db.getNumBlocks();
+    // a buffered heap pins one page per thread at a time
+    unsigned threads = threadsFor(blocks, 16, numThreads);
+    if (const BufferPool* pool = db.getBufferPool()) {
+        threads = static_cast<unsigned>(std::min<size_t>(threads, pool->getNumFrames()));
+    }
+
+    // phase 1: every thread extracts and sorts the pairs of its block range
+    std::vector<std::vector<LeafEntry>> runs(threads);
+    runParallel(threads, [&](unsigned t) {
+        std::vector<LeafEntry>& run = runs[t];
+        const size_t first = blocks * t / threads;
+        const size_t last = blocks * (t + 1) / threads;
+        run.reserve((last - first) * db.getRecordsPerBlock());
+        for (size_t b = first; b < last; ++b) {
+            const BlockView blk = db.getBlock(b);
+            const size_t n = blk.getNumSlots();
+            for (size_t i = 0; i < n; ++i) {
+                if (!blk.isLive(i)) continue;
+                const RecordView r = blk.getRecordView(i);
+                RID rid{ static_cast<uint32_t>(b), static_cast<uint32_t>(i) };
+                run.push_back(LeafEntry{ static_cast<float>(r.FT_PCT_home()), rid });
+            }
+        }
+        std::sort(run.begin(), run.end(), entry_less);
+    });
+    if (threads == 1) {
+        out_pairs = std::move(runs[0]);
+        return;
+    }
+
+    // phase 2: splitters from a regular sample of every run cut the output
+    // into one key range per thread (parallel sort by regular sampling)
+    std::vector<LeafEntry> samples;
+    for (const auto& run : runs) {
+        for (unsigned i = 0; i < threads && !run.empty(); ++i) samples.push_back(run[run.size() * i / threads]);
+    }
+    std::sort(samples.begin(), samples.end(), entry_less);
+
+    // cuts[t][r]: where range t starts in run r
+    std::vector<std::vector<size_t>> cuts(threads + 1, std::vector<size_t>(threads, 0));
+    std::vector<size_t> start(threads + 1, 0);
+    for (unsigned r = 0; r < threads; ++r) cuts[threads][r] = runs[r].size();
+    for (unsigned t = 1; t < threads; ++t) {
+        const LeafEntry& splitter = samples[samples.size() * t / threads];
+        for (unsigned r = 0; r < threads; ++r) {
+            cuts[t][r] = static_cast<size_t>(std::lower_bound(runs[r].begin(), runs[r].end(), splitter, entry_less) - runs[r].begin());
+        }
+    }
+    for (unsigned t = 0; t < threads; ++t) {
+        start[t + 1] = start[t];
+        for (unsigned r = 0; r < threads; ++r) start[t + 1] += cuts[t + 1][r] - cuts[t][r];
+    }
+
+    // phase 3: each thread gathers its slice of every run and merges the
+    // slices pairwise
+    out_pairs.resize(start[threads]);
+    runParallel(threads, [&](unsigned t) {
+        auto dst = out_pairs.begin() + static_cast<std::ptrdiff_t>(start[t]);
+        std::vector<size_t> bounds{0};
+        for (unsigned r = 0; r < threads; ++r) {
+            std::copy(runs[r].begin() + static_cast<std::ptrdiff_t>(cuts[t][r]),
+                      runs[r].begin() + static_cast<std::ptrdiff_t>(cuts[t + 1][r]),
+                      dst + static_cast<std::ptrdiff_t>(bounds.back()));
+            bounds.push_back(bounds.back() + cuts[t + 1][r] - cuts[t][r]);
+        }
+        while (bounds.size() > 2) {
+            std::vector<size_t> merged{0};
+            const size_t segments = bounds.size() - 1;
+            for (size_t i = 0; i + 2 <= segments; i += 2) {
+                std::inplace_merge(dst + static_cast<std::ptrdiff_t>(bounds[i]),
+                                   dst + static_cast<std::ptrdiff_t>(bounds[i + 1]),
+                                   dst + static_cast<std::ptrdiff_t>(bounds[i + 2]), entry_less);
+                merged.push_back(bounds[i + 2]);
+            }
+            if (segments % 2) merged.push_back(bounds[segments]);
+            bounds = std::move(merged);
+        }
+    });
+}
 
-    for (size_t b = 0; b < blocks.size(); ++b) {
-        const Block& blk = blocks[b];
-        const size_t n = blk.getNumRecords();
+// feed every (key, RID) pair of the heap file to an external sort
+void collect_pairs_ft_pct(const Database& db, ExternalSorter& sorter) {
+    for (size_t b = 0; b < db.getNumBlocks(); ++b) {
+        const BlockView blk = db.getBlock(b);
+        const size_t n = blk.getNumSlots();
         for (size_t i = 0; i < n; ++i) {
-            const Record& r = blk.getRecord(i);
+            if (!blk.isLive(i)) continue;
+            const RecordView r = blk.getRecordView(i);
             RID rid{ static_cast<uint32_t>(b), static_cast<uint32_t>(i) };
-            out_pairs.push_back(LeafEntry{ static_cast<float>(r.FT_PCT_home), rid });
+            sorter.add(LeafEntry{ static_cast<float>(r.FT_PCT_home()), rid });
         }
     }
+    sorter.finish();
+}
+
+// zero a page from new_nodes and give it a fresh header
+static NodeEditor init_node(BPTree& tree, uint32_t id, bool leaf) {
+    NodeEditor node = tree.edit(id);
+    std::memset(node.data(), 0, tree.page_size);
+    NodeHeader& h = node.header();
+    h.is_leaf = leaf ? 1 : 0;
+    h.self_id = id;
+    h.parent_id = UINT32_MAX;
+    h.next_leaf_id = UINT32_MAX;
+    return node;
+}
+
+// bulk-load leaves; leaf l holds pairs [l * leaf_capacity, ...), so the
+// leaves are filled in parallel partitions
+NodeLevel build_leaves(BPTree& tree, const std::vector<LeafEntry>& pairs, unsigned numThreads) {
+    NodeLevel level;
+    const size_t cap = tree.leaf_capacity;
+    const size_t N = pairs.size();
+    const size_t count = (N + cap - 1) / cap;
+    if (count == 0) return level;
+
+    const uint32_t first = tree.new_nodes(count);
+    level.ids.resize(count);
+    level.min_keys.resize(count);
+
+    const unsigned threads = threadsFor(count, 64, numThreads);
+    runParallel(threads, [&](unsigned t) {
+        for (size_t l = count * t / threads; l < count * (t + 1) / threads; ++l) {
+            const uint32_t id = first + static_cast<uint32_t>(l);
+            const size_t begin = l * cap;
+            const size_t take = std::min(cap, N - begin);
+
+            NodeEditor leaf = init_node(tree, id, true);
+            for (size_t j = 0; j < take; ++j) {
+                leaf.keys()[j] = pairs[begin + j].key;
+                leaf.rids()[j] = pairs[begin + j].rid;
+            }
+            leaf.setSize(take);
+
+            // link the next leaf
+            if (l + 1 < count) leaf.header().next_leaf_id = id + 1;
+
+            level.ids[l] = id;
+            level.min_keys[l] = pairs[begin].key;
+        }
+    });
+    return level;
+}
 
-    // then sort
-    std::stable_sort(out_pairs.begin(), out_pairs.end(), [](const LeafEntry& a, const LeafEntry& b){
-            if (a.key != b.key) return a.key < b.key;
-            return a.rid < b.rid;
-        });
+// entries and key sum under a node, from its leaf entries or the aggregates
+// of its children
+static void subtree_totals(const NodeRef& n, uint64_t& count, double& sum) {
+    count = 0;
+    sum = 0.0;
+    if (n.isLeaf()) {
+        count = n.size();
+        for (size_t i = 0; i < n.size(); ++i) sum += n.entry(i).key;
+        return;
+    }
+    for (size_t i = 0; i < n.childCount(); ++i) {
+        count += n.subtreeCount(i);
+        sum += n.subtreeSum(i);
+    }
 }
 
-// bulk-load leaves
-std::vector<uint32_t> build_leaves(BPTree& tree, const std::vector<LeafEntry>& pairs) {
-    std::vector<uint32_t> leaf_ids;
-    size_t i = 0;
-    size_t N = pairs.size();
+// build internal level above; separator keys are the min keys carried up
+// from the level below
+NodeLevel build_internal_level(BPTree& tree, const NodeLevel& children, unsigned numThreads) {
+    NodeLevel level;
+    const size_t fanout = tree.internal_n;
+    const size_t N = children.ids.size();
+    const size_t count = (N + fanout - 1) / fanout;
+    if (count == 0) return level;
+
+    const uint32_t first = tree.new_nodes(count);
+    level.ids.resize(count);
+    level.min_keys.resize(count);
+
+    const unsigned threads = threadsFor(count, 16, numThreads);
+    runParallel(threads, [&](unsigned t) {
+        for (size_t p = count * t / threads; p < count * (t + 1) / threads; ++p) {
+            const uint32_t id = first + static_cast<uint32_t>(p);
+            const size_t begin = p * fanout;
+            const size_t take = std::min(fanout, N - begin);
+
+            NodeEditor node = init_node(tree, id, false);
+            for (size_t j = 0; j < take; ++j) {
+                const uint32_t cid = children.ids[begin + j];
+                node.children()[j] = cid;
+                tree.edit(cid).header().parent_id = id;
+                if (tree.aggregates) {
+                    uint64_t count;
+                    subtree_totals(tree.node(cid), count, node.sums()[j]);
+                    node.counts()[j] = static_cast<uint32_t>(count);
+                }
+            }
 
-    while (i < N) {
-        const size_t take = std::min<size_t>(tree.leaf_capacity, N - i);
+            // separator keys are the min of each right child
+            for (size_t j = 1; j < take; ++j) {
+                if (tree.packed_keys) encode_key(children.min_keys[begin + j], node.codes()[j - 1]);
+                else node.keys()[j - 1] = children.min_keys[begin + j];
+            }
+            node.setSize(take - 1);
 
-        uint32_t id = tree.new_node(true);
-        BPTNode& leaf = tree.nodes[id];
+            level.ids[p] = id;
+            level.min_keys[p] = children.min_keys[begin];
+        }
+    });
+    return level;
+}
 
-        leaf.leaf.insert(leaf.leaf.end(), pairs.begin() + static_cast<long>(i), pairs.begin() + static_cast<long>(i + take));
-        leaf.header.key_count = static_cast<uint16_t>(take);
+// leaves straight from a sorted stream, one at a time in key order
+NodeLevel build_leaves(BPTree& tree, ExternalSorter& sorted) {
+    NodeLevel level;
+    LeafEntry e;
+    bool more = sorted.next(e);
+    while (more) {
+        const uint32_t id = tree.new_node(true);
+        NodeEditor leaf = tree.edit(id);
+        size_t take = 0;
+        for (; more && take < tree.leaf_capacity; ++take, more = sorted.next(e)) {
+            leaf.keys()[take] = e.key;
+            leaf.rids()[take] = e.rid;
+        }
+        leaf.setSize(take);
 
         // link previous leaf
-        if (!leaf_ids.empty()) tree.nodes[leaf_ids.back()].header.next_leaf_id = id;
+        if (!level.ids.empty()) tree.edit(level.ids.back()).header().next_leaf_id = id;
+
+        level.ids.push_back(id);
+        level.min_keys.push_back(leaf.keys()[0]);
+    }
+    return level;
+}
 
-        leaf_ids.push_back(id);
-        i += take;
+// build internal levels bottom-up until a single root remains
+static void build_upper_levels(BPTree& tree, NodeLevel level, unsigned numThreads) {
+    if (level.ids.empty()) return;
+    uint32_t height = 1;
+    while (level.ids.size() > 1) {
+        level = build_internal_level(tree, level, numThreads);
+        height++;
     }
-    return leaf_ids;
+    tree.root_id = level.ids.front();
+    tree.levels = height;
 }
 
-// return the minimal key (for using it as a separator)
-static float min_key_of_node(const BPTree& tree, uint32_t nid) {
-    const BPTNode& c = tree.nodes[nid];
-    if (c.header.is_leaf) return c.leaf.front().key;
-    else return min_key_of_node(tree, c.pointers.front());
+void bulk_load(BPTree& tree, const std::vector<LeafEntry>& pairs, unsigned numThreads) {
+    build_upper_levels(tree, build_leaves(tree, pairs, numThreads), numThreads);
 }
 
-// build internal level above
-std::vector<uint32_t> build_internal_level(BPTree& tree, const std::vector<uint32_t>& child_ids) {
-    std::vector<uint32_t> level_ids;
-    if (child_ids.empty()) return level_ids;
+void bulk_load(BPTree& tree, ExternalSorter& sorted, unsigned numThreads) {
+    build_upper_levels(tree, build_leaves(tree, sorted), numThreads);
+}
 
-    const size_t fanout = tree.internal_n;
-    size_t i = 0, N = child_ids.size();
+void bulk_load_file(const BPTree& layout, ExternalSorter& sorted, const std::string& filename) {
+    if (layout.page_size == 0) throw std::runtime_error("Index has no page size, call compute_capacities first");
+    if (layout.posting_leaves || layout.packed_keys) {
+        throw std::logic_error("bulk_load_file writes (key, RID) leaves only");
+    }
+    const size_t cap = layout.leaf_capacity;
+    const size_t fanout = layout.internal_n;
+
+    // nodes per level, leaves first; a level's ids follow the one below
+    std::vector<size_t> sizes;
+    size_t n = (sorted.stats().entries + cap - 1) / cap;
+    size_t total = n;
+    if (n > 0) sizes.push_back(n);
+    while (n > 1) {
+        n = (n + fanout - 1) / fanout;
+        sizes.push_back(n);
+        total += n;
+    }
+    if (total > UINT32_MAX) throw std::length_error("Too many index nodes for 32-bit ids");
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out) throw std::runtime_error("Cannot open file for writing");
+    std::vector<uint8_t> page(layout.page_size, 0);
+    auto emit = [&] {
+        if (!out.write(reinterpret_cast<const char*>(page.data()), static_cast<std::streamsize>(page.size()))) {
+            throw std::runtime_error("Cannot write index file: " + filename);
+        }
+        std::fill(page.begin(), page.end(), 0);
+    };
+
+    IndexSuperblock sb = layout.superblock();
+    sb.root_id = total > 0 ? static_cast<uint32_t>(total - 1) : UINT32_MAX;
+    sb.levels = static_cast<uint32_t>(sizes.size());
+    sb.node_count = static_cast<uint32_t>(total);
+    sb.free_head = UINT32_MAX;
+    std::memcpy(page.data(), &sb, sizeof(sb));
+    emit();
+
+    // min key and totals of every node of the level last written
+    std::vector<float> min_keys;
+    std::vector<uint64_t> counts;
+    std::vector<double> sums;
+    // node i of the level starting at id `start`
+    auto parent_of = [&](size_t level, size_t start, size_t i) {
+        return level + 1 < sizes.size() ? static_cast<uint32_t>(start + sizes[level] + i / fanout) : UINT32_MAX;
+    };
+
+    LeafEntry e;
+    bool more = sorted.next(e);
+    for (size_t l = 0; l < (sizes.empty() ? 0 : sizes[0]); ++l) {
+        NodeEditor leaf(page.data(), layout.internal_n, layout.leaf_capacity);
+        NodeHeader& h = leaf.header();
+        h.is_leaf = 1;
+        h.self_id = static_cast<uint32_t>(l);
+        h.parent_id = parent_of(0, 0, l);
+        h.next_leaf_id = l + 1 < sizes[0] ? static_cast<uint32_t>(l + 1) : UINT32_MAX;
+        size_t take = 0;
+        double sum = 0.0;
+        for (; more && take < cap; ++take, more = sorted.next(e)) {
+            leaf.keys()[take] = e.key;
+            leaf.rids()[take] = e.rid;
+            sum += e.key;
+        }
+        leaf.setSize(take);
+        min_keys.push_back(leaf.keys()[0]);
+        counts.push_back(take);
+        sums.push_back(sum);
+        emit();
+    }
+    if (more) throw std::logic_error("The sorted stream holds more entries than it counted");
 
-    while (i < N) {
-        const size_t take = std::min<size_t>(fanout, N - i);
+    size_t base = 0; // first id of the level below
+    for (size_t k = 1; k < sizes.size(); ++k) {
+        const size_t first = base + sizes[k - 1];
+        std::vector<float> level_keys;
+        std::vector<uint64_t> level_counts;
+        std::vector<double> level_sums;
+        for (size_t p = 0; p < sizes[k]; ++p) {
+            const size_t begin = p * fanout;
+            const size_t take = std::min(fanout, sizes[k - 1] - begin);
+            NodeEditor node(page.data(), layout.internal_n, layout.leaf_capacity, false, layout.aggregates);
+            NodeHeader& h = node.header();
+            h.is_leaf = 0;
+            h.self_id = static_cast<uint32_t>(first + p);
+            h.parent_id = parent_of(k, first, p);
+            h.next_leaf_id = UINT32_MAX;
+            uint64_t count = 0;
+            double sum = 0.0;
+            for (size_t j = 0; j < take; ++j) {
+                node.children()[j] = static_cast<uint32_t>(base + begin + j);
+                if (layout.aggregates) {
+                    node.sums()[j] = sums[begin + j];
+                    node.counts()[j] = static_cast<uint32_t>(counts[begin + j]);
+                }
+                count += counts[begin + j];
+                sum += sums[begin + j];
+            }
+            for (size_t j = 1; j < take; ++j) node.keys()[j - 1] = min_keys[begin + j];
+            node.setSize(take - 1);
+            level_keys.push_back(min_keys[begin]);
+            level_counts.push_back(count);
+            level_sums.push_back(sum);
+            emit();
+        }
+        min_keys.swap(level_keys);
+        counts.swap(level_counts);
+        sums.swap(level_sums);
+        base = first;
+    }
+}
+
+// a RID in a posting list is the 48-bit value block << 16 | slot; a list is
+// | width | values |, the first RID and then the distance of each RID from
+// the one before it, all `width` bytes little-endian; a fixed width per list
+// keeps decoding free of data-dependent branches
+static uint64_t rid_value(const RID& rid) {
+    if (rid.slot > 0xffff) throw std::logic_error("Posting lists need slots below 65536");
+    return (static_cast<uint64_t>(rid.block) << 16) | rid.slot;
+}
+
+static uint8_t posting_width(const std::vector<LeafEntry>& pairs, size_t begin, size_t end) {
+    uint64_t widest = 0, prev = 0;
+    for (size_t i = begin; i < end; ++i) {
+        const uint64_t v = rid_value(pairs[i].rid);
+        widest = std::max(widest, v - prev);
+        prev = v;
+    }
+    uint8_t width = 1;
+    while (width < 8 && (widest >> (8 * width)) != 0) ++width;
+    return width;
+}
+
+static void put_fixed(uint8_t* out, uint64_t v, uint8_t width) {
+    for (uint8_t i = 0; i < width; ++i) out[i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+// write the RIDs of pairs[begin, end) over a chain of overflow pages and
+// return the first one; every page starts with its byte count and the width
+// of its values
+static uint32_t write_overflow(BPTree& tree, const std::vector<LeafEntry>& pairs, size_t begin, size_t end) {
+    const size_t room = tree.page_size - OVERFLOW_DATA;
+    const uint8_t width = posting_width(pairs, begin, end);
+    uint32_t first = UINT32_MAX, page_id = UINT32_MAX;
+    size_t used = 0;
+    uint64_t prev = 0;
+    for (size_t i = begin; i < end; ++i) {
+        const uint64_t v = rid_value(pairs[i].rid);
+        if (page_id == UINT32_MAX || used + width > room) {
+            const uint32_t next = tree.new_node(false);
+            NodeEditor page = tree.edit(next);
+            page.header().is_leaf = NODE_OVERFLOW;
+            page.data()[OVERFLOW_DATA] = width;
+            if (page_id == UINT32_MAX) first = next;
+            else tree.edit(page_id).header().next_leaf_id = next;
+            page_id = next;
+            used = 1;
+        }
+        NodeEditor page = tree.edit(page_id);
+        put_fixed(page.data() + OVERFLOW_DATA + used, v - prev, width);
+        prev = v;
+        used += width;
+        const uint32_t bytes = static_cast<uint32_t>(used);
+        std::memcpy(page.data() + sizeof(NodeHeader), &bytes, sizeof(bytes));
+    }
+    return first;
+}
+
+// posting-list leaves, filled in key order; a list longer than a quarter of
+// a page goes to overflow pages, so one hot key does not crowd out the rest
+NodeLevel build_posting_leaves(BPTree& tree, const std::vector<LeafEntry>& pairs) {
+    NodeLevel level;
+    if (tree.aggregates) throw std::logic_error("Subtree aggregates need (key, RID) leaves");
+    tree.posting_leaves = true;
+    const size_t room = tree.page_size - sizeof(NodeHeader);
+    const size_t hot = room / 4;
+
+    // the leaf being filled
+    std::vector<float> keys;
+    std::vector<uint32_t> ends;
+    std::vector<uint8_t> bytes;
+    auto flush = [&]() {
+        if (keys.empty()) return;
+        const uint32_t id = tree.new_node(true);
+        NodeEditor leaf = tree.edit(id);
+        leaf.header().is_leaf = NODE_POSTING;
+        leaf.setSize(keys.size());
+        uint8_t* p = leaf.data() + sizeof(NodeHeader);
+        std::memcpy(p, keys.data(), keys.size() * sizeof(float));
+        std::memcpy(p + keys.size() * sizeof(float), ends.data(), ends.size() * sizeof(uint32_t));
+        std::memcpy(p + keys.size() * (sizeof(float) + sizeof(uint32_t)), bytes.data(), bytes.size());
+
+        // link previous leaf
+        if (!level.ids.empty()) tree.edit(level.ids.back()).header().next_leaf_id = id;
+        level.ids.push_back(id);
+        level.min_keys.push_back(keys[0]);
+        keys.clear();
+        ends.clear();
+        bytes.clear();
+    };
+
+    std::vector<uint8_t> list;
+    for (size_t begin = 0, end = 0; begin < pairs.size(); begin = end) {
+        for (end = begin; end < pairs.size() && pairs[end].key == pairs[begin].key; ++end) {}
+        const uint8_t width = posting_width(pairs, begin, end);
+        list.assign(1 + (end - begin) * width, width);
+        uint64_t prev = 0;
+        for (size_t i = begin; i < end; ++i) {
+            const uint64_t v = rid_value(pairs[i].rid);
+            put_fixed(list.data() + 1 + (i - begin) * width, v - prev, width);
+            prev = v;
+        }
 
-        uint32_t id = tree.new_node(false);
-        BPTNode& node = tree.nodes[id];
+        const bool spill = list.size() > hot;
+        const size_t need = sizeof(float) + sizeof(uint32_t) + (spill ? 2 * sizeof(uint32_t) : list.size());
+        if (keys.size() * (sizeof(float) + sizeof(uint32_t)) + bytes.size() + need > room) flush();
 
-        node.pointers.reserve(take);
-        for (size_t j = 0; j < take; ++j) {
-            const uint32_t cid = child_ids[i + j];
-            node.pointers.push_back(cid);
-            tree.nodes[cid].header.parent_id = id;
+        uint32_t flag = 0;
+        if (spill) {
+            const uint32_t ref[2] = {write_overflow(tree, pairs, begin, end), static_cast<uint32_t>(end - begin)};
+            const uint8_t* raw = reinterpret_cast<const uint8_t*>(ref);
+            bytes.insert(bytes.end(), raw, raw + sizeof(ref));
+            flag = POSTING_OVERFLOW;
+        } else {
+            bytes.insert(bytes.end(), list.begin(), list.end());
         }
+        keys.push_back(pairs[begin].key);
+        ends.push_back(static_cast<uint32_t>(bytes.size()) | flag);
+    }
+    flush();
+    return level;
+}
+
+void bulk_load_postings(BPTree& tree, const std::vector<LeafEntry>& pairs, unsigned numThreads) {
+    build_upper_levels(tree, build_posting_leaves(tree, pairs), numThreads);
+}
+
+bool encode_key(float k, uint16_t& code) {
+    if (!(k >= 0.0f && k <= decode_key(UINT16_MAX))) return false;
+    const long q = std::lround(static_cast<double>(k) * KEY_SCALE);
+    code = static_cast<uint16_t>(q);
+    return decode_key(code) == k;
+}
 
-        // separator keys are the min of each right child
-        if (take) node.keys.reserve(take - 1);
-        else node.keys.reserve(0);
+uint32_t key_code_bound(float k, bool upper) {
+    if (std::isnan(k)) return 0; // no key compares below NaN, as in the float search
+    auto past = [&](uint32_t q) { return upper ? decode_key(static_cast<uint16_t>(q)) > k : decode_key(static_cast<uint16_t>(q)) >= k; };
+    const double guess = std::ceil(static_cast<double>(k) * KEY_SCALE);
+    uint32_t q = guess <= 0.0 ? 0 : static_cast<uint32_t>(std::min<double>(guess, UINT16_MAX + 1.0));
+    // the guess is off by at most one code either way after rounding
+    while (q > 0 && past(q - 1)) --q;
+    while (q <= UINT16_MAX && !past(q)) ++q;
+    return q;
+}
+
+// bytes of the largest offset span, up to 4
+static uint8_t offset_width(uint32_t span) {
+    uint8_t width = 0;
+    while (width < 4 && (span >> (8 * width)) != 0) ++width;
+    return width;
+}
+
+// packed leaves, filled in key order: a leaf takes entries while their codes
+// and RID offsets, at the widths the leaf's block and slot spans need, fit
+NodeLevel build_packed_leaves(BPTree& tree, const std::vector<LeafEntry>& pairs) {
+    if (tree.aggregates) throw std::logic_error("Subtree aggregates need (key, RID) leaves");
+    const NodeCapacities caps = packed_capacities(tree.page_size);
+    tree.internal_n = caps.internal_n;
+    tree.leaf_capacity = caps.leaf_capacity;
+    tree.packed_keys = true;
+    const size_t room = tree.page_size - sizeof(NodeHeader) - sizeof(PackedLeafBase);
+
+    std::vector<uint16_t> codes(pairs.size());
+    for (size_t i = 0; i < pairs.size(); ++i) {
+        if (!encode_key(pairs[i].key, codes[i])) throw std::runtime_error("Key has no 16-bit code: " + std::to_string(pairs[i].key));
+        if (pairs[i].rid.slot > UINT16_MAX) throw std::runtime_error("Packed leaves need slots below 65536");
+    }
+
+    NodeLevel level;
+    for (size_t begin = 0, end = 0; begin < pairs.size(); begin = end) {
+        PackedLeafBase base{pairs[begin].rid.block, static_cast<uint16_t>(pairs[begin].rid.slot), 0, 0};
+        uint32_t max_block = base.block, max_slot = base.slot;
+        for (end = begin + 1; end < pairs.size() && end - begin < caps.leaf_capacity; ++end) {
+            const RID& r = pairs[end].rid;
+            const uint32_t lo_block = std::min(base.block, r.block), hi_block = std::max(max_block, r.block);
+            const uint32_t lo_slot = std::min<uint32_t>(base.slot, r.slot), hi_slot = std::max(max_slot, r.slot);
+            const uint8_t bw = offset_width(hi_block - lo_block), sw = offset_width(hi_slot - lo_slot);
+            const size_t n = end - begin + 1;
+            if (packed_codes_bytes(n) + n * (bw + sw) > room) break;
+            base = PackedLeafBase{lo_block, static_cast<uint16_t>(lo_slot), bw, sw};
+            max_block = hi_block;
+            max_slot = hi_slot;
+        }
 
-        for (size_t j = 1; j < node.pointers.size(); ++j) {
-            node.keys.push_back(min_key_of_node(tree, node.pointers[j]));
+        const uint32_t id = tree.new_node(true);
+        NodeEditor leaf = tree.edit(id);
+        leaf.header().is_leaf = NODE_PACKED;
+        leaf.setSize(end - begin);
+        std::memcpy(leaf.codes(), codes.data() + begin, (end - begin) * sizeof(uint16_t));
+        uint8_t* p = leaf.data() + sizeof(NodeHeader) + packed_codes_bytes(end - begin);
+        std::memcpy(p, &base, sizeof(base));
+        p += sizeof(base);
+        for (size_t i = begin; i < end; ++i) {
+            const uint32_t block = pairs[i].rid.block - base.block, slot = pairs[i].rid.slot - base.slot;
+            for (uint8_t b = 0; b < base.block_width; ++b) *p++ = static_cast<uint8_t>(block >> (8 * b));
+            for (uint8_t b = 0; b < base.slot_width; ++b) *p++ = static_cast<uint8_t>(slot >> (8 * b));
         }
-        node.header.key_count = static_cast<uint16_t>(node.keys.size());
 
-        level_ids.push_back(id);
-        i += take;
+        // link previous leaf
+        if (!level.ids.empty()) tree.edit(level.ids.back()).header().next_leaf_id = id;
+        level.ids.push_back(id);
+        level.min_keys.push_back(pairs[begin].key);
+    }
+    return level;
+}
+
+void bulk_load_packed(BPTree& tree, const std::vector<LeafEntry>& pairs, unsigned numThreads) {
+    build_upper_levels(tree, build_packed_leaves(tree, pairs), numThreads);
+}
+
+static const char INDEX_MAGIC[8] = {'D', 'S', 'P', 'B', 'P', 'T', '\0', '\0'};
+static const uint32_t INDEX_VERSION = 7;
+
+// byte offset of the child array in an internal node page
+static size_t children_offset(uint32_t internal_n, bool packed = false) {
+    return sizeof(NodeHeader) + (packed ? packed_codes_bytes(internal_n - 1) : sizeof(float) * (internal_n - 1));
+}
+
+// byte offset of the RID array in a leaf page
+static size_t rids_offset(uint32_t leaf_capacity) {
+    return sizeof(NodeHeader) + sizeof(float) * leaf_capacity;
+}
+
+NodeRef::NodeRef(const uint8_t* p, uint32_t internalN, uint32_t leafCap, bool packedKeys)
+    : page(p), internal_n(internalN), leaf_capacity(leafCap), packed(packedKeys) {
+    std::memcpy(&hdr, p, sizeof(hdr));
+}
+
+NodeRef::NodeRef(PageGuard guard, uint32_t internalN, uint32_t leafCap, bool packedKeys)
+    : NodeRef(guard.data(), internalN, leafCap, packedKeys) {
+    pin = std::move(guard);
+}
+
+size_t NodeRef::size() const {
+    return hdr.key_count;
+}
+
+size_t NodeRef::childCount() const {
+    if (isLeaf()) return 0;
+    return static_cast<size_t>(hdr.key_count) + 1;
+}
+
+float NodeRef::key(size_t i) const {
+    if (packed) return decode_key(codeData()[i]);
+    float k;
+    std::memcpy(&k, page + sizeof(NodeHeader) + i * sizeof(float), sizeof(k));
+    return k;
+}
+
+uint32_t NodeRef::child(size_t i) const {
+    uint32_t c;
+    std::memcpy(&c, page + children_offset(internal_n, packed) + i * sizeof(uint32_t), sizeof(c));
+    return c;
+}
+
+uint32_t NodeRef::subtreeCount(size_t i) const {
+    uint32_t c;
+    std::memcpy(&c, page + aggregate_counts_offset(internal_n) + i * sizeof(uint32_t), sizeof(c));
+    return c;
+}
+
+double NodeRef::subtreeSum(size_t i) const {
+    double s;
+    std::memcpy(&s, page + aggregate_sums_offset(internal_n) + i * sizeof(double), sizeof(s));
+    return s;
+}
+
+LeafEntry NodeRef::entry(size_t i) const {
+    if (hdr.is_leaf == NODE_PACKED) return packedEntry(i);
+    LeafEntry e;
+    std::memcpy(&e.key, page + sizeof(NodeHeader) + i * sizeof(float), sizeof(e.key));
+    std::memcpy(&e.rid, page + rids_offset(leaf_capacity) + i * sizeof(RID), sizeof(e.rid));
+    return e;
+}
+
+uint32_t NodeRef::postingEnd(size_t i) const {
+    uint32_t e;
+    std::memcpy(&e, page + sizeof(NodeHeader) + (size() + i) * sizeof(float), sizeof(e));
+    return e;
+}
+
+const uint8_t* NodeRef::postingData() const {
+    return page + sizeof(NodeHeader) + size() * (sizeof(float) + sizeof(uint32_t));
+}
+
+// little-endian offset of `width` bytes
+static uint32_t get_offset(const uint8_t* p, uint8_t width) {
+    uint32_t v = 0;
+    for (uint8_t b = 0; b < width; ++b) v |= static_cast<uint32_t>(p[b]) << (8 * b);
+    return v;
+}
+
+LeafEntry NodeRef::packedEntry(size_t i) const {
+    const uint8_t* base_at = page + sizeof(NodeHeader) + packed_codes_bytes(size());
+    PackedLeafBase base;
+    std::memcpy(&base, base_at, sizeof(base));
+    const uint8_t* rid = base_at + sizeof(base) + i * (base.block_width + base.slot_width);
+    LeafEntry e;
+    e.key = decode_key(codeData()[i]);
+    e.rid.block = base.block + get_offset(rid, base.block_width);
+    e.rid.slot = base.slot + get_offset(rid + base.block_width, base.slot_width);
+    return e;
+}
+
+const float* NodeRef::keyData() const {
+    return reinterpret_cast<const float*>(page + sizeof(NodeHeader));
+}
+
+const uint16_t* NodeRef::codeData() const {
+    return reinterpret_cast<const uint16_t*>(page + sizeof(NodeHeader));
+}
+
+size_t NodeRef::lowerBound(float k) const {
+    if (packed) return codeLowerBound(codeData(), size(), key_code_bound(k, false));
+    return keyLowerBound(keyData(), size(), k);
+}
+
+size_t NodeRef::upperBound(float k) const {
+    if (packed) return codeLowerBound(codeData(), size(), key_code_bound(k, true));
+    return keyUpperBound(keyData(), size(), k);
+}
+
+void NodeEditor::insertEntry(size_t pos, const LeafEntry& e) {
+    const size_t n = size();
+    std::memmove(keys() + pos + 1, keys() + pos, (n - pos) * sizeof(float));
+    std::memmove(rids() + pos + 1, rids() + pos, (n - pos) * sizeof(RID));
+    keys()[pos] = e.key;
+    rids()[pos] = e.rid;
+    setSize(n + 1);
+}
+
+void NodeEditor::eraseEntry(size_t pos) {
+    const size_t n = size();
+    std::memmove(keys() + pos, keys() + pos + 1, (n - pos - 1) * sizeof(float));
+    std::memmove(rids() + pos, rids() + pos + 1, (n - pos - 1) * sizeof(RID));
+    setSize(n - 1);
+}
+
+void NodeEditor::insertKeyChild(size_t ki, float key, size_t ci, uint32_t child) {
+    const size_t n = size();
+    std::memmove(keys() + ki + 1, keys() + ki, (n - ki) * sizeof(float));
+    std::memmove(children() + ci + 1, children() + ci, (n + 1 - ci) * sizeof(uint32_t));
+    keys()[ki] = key;
+    children()[ci] = child;
+    if (aggregates) {
+        std::memmove(sums() + ci + 1, sums() + ci, (n + 1 - ci) * sizeof(double));
+        std::memmove(counts() + ci + 1, counts() + ci, (n + 1 - ci) * sizeof(uint32_t));
+        sums()[ci] = 0.0;
+        counts()[ci] = 0;
+    }
+    setSize(n + 1);
+}
+
+void NodeEditor::eraseKeyChild(size_t ki, size_t ci) {
+    const size_t n = size();
+    std::memmove(keys() + ki, keys() + ki + 1, (n - ki - 1) * sizeof(float));
+    std::memmove(children() + ci, children() + ci + 1, (n - ci) * sizeof(uint32_t));
+    if (aggregates) {
+        std::memmove(sums() + ci, sums() + ci + 1, (n - ci) * sizeof(double));
+        std::memmove(counts() + ci, counts() + ci + 1, (n - ci) * sizeof(uint32_t));
+    }
+    setSize(n - 1);
+}
+
+void NodeArena::reset(size_t pageSize) {
+    slabs.clear();
+    stride = (pageSize + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    count = 0;
+}
+
+uint32_t NodeArena::append() {
+    const uint32_t id = extend(1);
+    std::memset(at(id), 0, stride);
+    return id;
+}
+
+uint32_t NodeArena::extend(size_t n) {
+    while (count + n > slabs.size() * SLAB_NODES) {
+        const size_t bytes = stride * SLAB_NODES + sizeof(std::atomic<uint64_t>) * SLAB_NODES;
+        uint8_t* slab = static_cast<uint8_t*>(::operator new(bytes, std::align_val_t(CACHE_LINE)));
+        for (size_t i = 0; i < SLAB_NODES; ++i) {
+            new (slab + stride * SLAB_NODES + sizeof(std::atomic<uint64_t>) * i) std::atomic<uint64_t>(0);
+        }
+        slabs.emplace_back(slab);
+    }
+    const uint32_t id = static_cast<uint32_t>(count);
+    count += n;
+    return id;
+}
+
+// create a new node, reusing a freed id when there is one
+uint32_t BPTree::new_node(bool leaf) {
+    uint32_t id;
+    if (!free_ids.empty()) {
+        id = free_ids.back();
+        free_ids.pop_back();
+        NodeEditor reused = edit(id); // latched before it is cleared
+        std::memset(reused.data(), 0, page_size);
+    } else {
+        if (latch && arena.size() == arena.capacity()) {
+            throw std::length_error("Concurrent index is out of reserved node slots");
+        }
+        id = arena.append();
+        if (unloaded != 0) loaded.push_back(1);
+    }
+    NodeHeader& h = edit(id).header();
+    if (leaf) h.is_leaf = 1;
+    else h.is_leaf = 0;
+    h.key_count = 0;
+    h.self_id = id;
+    h.parent_id = UINT32_MAX; //root, no parent pointer
+    h.next_leaf_id = UINT32_MAX; // not leaf, no next leaf pointer
+    return id;
+}
+
+uint32_t BPTree::new_nodes(size_t n) {
+    const uint32_t first = arena.extend(n);
+    if (unloaded != 0) loaded.resize(loaded.size() + n, 1);
+    return first;
+}
+
+// the upper bound is found with one search per leaf, so entries are then
+// handed out without a compare each
+void LeafCursor::enterLeaf() {
+    end = leaf.size();
+    if (has_hi) {
+        end = hi_inclusive ? leaf.upperBound(hi) : leaf.lowerBound(hi);
+        last = end < leaf.size();
+    }
+}
+
+bool LeafCursor::next(LeafEntry& out) {
+    while (concurrent && !done) {
+        if (buf_pos < buf.size()) {
+            out = buf[buf_pos++];
+            if (!has_last || out.key != last_key) last_rids.clear();
+            has_last = true;
+            last_key = out.key;
+            last_rids.push_back(out.rid);
+            return true;
+        }
+        if (last || next_id == UINT32_MAX) {
+            done = true;
+            break;
+        }
+
+        // the link is only good while the leaf it came from is unchanged
+        const uint32_t id = next_id;
+        const uint64_t v = tree->readLatch(id);
+        if (!tree->validate(leaf_id, leaf_version) ||
+            !copyLeaf(id, v, -std::numeric_limits<float>::infinity(), false)) {
+            reseek();
+            continue;
+        }
+        leaf_id = id;
+        leaf_version = v;
+    }
+    while (!done) {
+        if (pos < end) {
+            if (!leaf.isPostingLeaf()) {
+                out = leaf.entry(pos++);
+                return true;
+            }
+            // common case inline: more RIDs on the current page
+            if (rid_pos < rids.size()) {
+                out.key = rid_key;
+                out.rid = rids[rid_pos++];
+                return true;
+            }
+            if (nextPosting(out)) return true;
+            continue;
+        }
+        const uint32_t next_id = leaf.nextLeaf();
+        if (last || next_id == UINT32_MAX) break;
+        leaf = tree->node(next_id);
+        pos = 0;
+        enterLeaf();
+    }
+    done = true;
+    leaf = NodeRef(); // unpin
+    return false;
+}
+
+// decode the RIDs of key `pos` in a posting leaf into rids, a page of them
+// at a time when they are on overflow pages; moves on to the next key when
+// the list is used up
+bool LeafCursor::nextPosting(LeafEntry& out) {
+    if (!posting_open) {
+        const uint32_t begin = pos == 0 ? 0 : leaf.postingEnd(pos - 1) & ~POSTING_OVERFLOW;
+        const uint32_t stop = leaf.postingEnd(pos);
+        const uint8_t* bytes = leaf.postingData();
+        prev_rid = 0;
+        if (stop & POSTING_OVERFLOW) {
+            uint32_t ref[2];
+            std::memcpy(ref, bytes + begin, sizeof(ref));
+            overflow = tree->node(ref[0]);
+            decodeOverflow();
+        } else {
+            decodeRids(bytes + begin, stop - begin);
+        }
+        rid_key = leaf.key(pos);
+        posting_open = true;
+    } else if (overflow.data() != nullptr && overflow.nextLeaf() != UINT32_MAX) {
+        overflow = tree->node(overflow.nextLeaf());
+        decodeOverflow();
+    } else {
+        // list done
+        posting_open = false;
+        rids.clear();
+        rid_pos = 0;
+        overflow = NodeRef(); // unpin
+        ++pos;
+        return false;
+    }
+    out.key = rid_key;
+    out.rid = rids[rid_pos++];
+    return true;
+}
+
+void LeafCursor::decodeOverflow() {
+    uint32_t bytes;
+    std::memcpy(&bytes, overflow.data() + sizeof(NodeHeader), sizeof(bytes));
+    decodeRids(overflow.data() + OVERFLOW_DATA, bytes);
+}
+
+// | width | values | of one list or overflow page; the loop is picked per
+// width so the decode itself has no branches
+void LeafCursor::decodeRids(const uint8_t* bytes, size_t size) {
+    const uint8_t width = bytes[0];
+    const size_t n = (size - 1) / width;
+    rids.resize(n);
+    rid_pos = 0;
+    uint64_t v = prev_rid;
+    auto decode = [&](auto w) {
+        const uint8_t* p = bytes + 1;
+        for (size_t i = 0; i < n; ++i, p += w) {
+            uint64_t d = 0;
+            for (size_t b = 0; b < w; ++b) d |= static_cast<uint64_t>(p[b]) << (8 * b);
+            v += d;
+            rids[i] = RID{static_cast<uint32_t>(v >> 16), static_cast<uint32_t>(v & 0xffff)};
+        }
+    };
+    switch (width) {
+        case 1: decode(std::integral_constant<size_t, 1>()); break;
+        case 2: decode(std::integral_constant<size_t, 2>()); break;
+        case 3: decode(std::integral_constant<size_t, 3>()); break;
+        case 4: decode(std::integral_constant<size_t, 4>()); break;
+        case 5: decode(std::integral_constant<size_t, 5>()); break;
+        case 6: decode(std::integral_constant<size_t, 6>()); break;
+        default: decode(std::integral_constant<size_t, 8>()); break;
+    }
+    prev_rid = v;
+}
+
+// copy the entries of a leaf from the lower bound `from` up to the upper
+// bound, leaving out the ones already handed out; false if the leaf changed
+bool LeafCursor::copyLeaf(uint32_t id, uint64_t version, float from, bool from_upper) {
+    const NodeRef n(tree->arena.at(id), tree->internal_n, tree->leaf_capacity);
+    if (n.header().is_leaf != 1) return false;
+    const size_t size = std::min<size_t>(n.size(), tree->leaf_capacity);
+    const float* keys = n.keyData();
+
+    size_t pos = from_upper ? keyUpperBound(keys, size, from) : keyLowerBound(keys, size, from);
+    size_t stop = size;
+    last = false;
+    if (has_hi) {
+        stop = hi_inclusive ? keyUpperBound(keys, size, hi) : keyLowerBound(keys, size, hi);
+        last = stop < size;
+    }
+    buf.clear();
+    buf_pos = 0;
+    for (; pos < stop; ++pos) {
+        const LeafEntry e = n.entry(pos);
+        if (has_last && e.key == last_key &&
+            std::find(last_rids.begin(), last_rids.end(), e.rid) != last_rids.end()) continue;
+        buf.push_back(e);
+    }
+    next_id = n.nextLeaf();
+    return tree->validate(id, version);
+}
+
+// descend again to the lower bound, or to the last key handed out, and load
+// that leaf; restarts until it gets a consistent copy
+void LeafCursor::reseek() {
+    for (;;) {
+        const bool has_from = has_last || has_lo;
+        const float from = has_last ? last_key : (has_lo ? lo : -std::numeric_limits<float>::infinity());
+        const bool from_upper = !has_last && has_lo && !lo_inclusive;
+
+        uint32_t id;
+        uint64_t v;
+        if (!tree->descendOptimistic(has_from ? from : -std::numeric_limits<float>::infinity(), from_upper, id, v)) continue;
+        if (id == UINT32_MAX) {
+            done = true;
+            return;
+        }
+        if (!copyLeaf(id, v, from, from_upper)) continue;
+        leaf_id = id;
+        leaf_version = v;
+        return;
+    }
+}
+
+// position a cursor on the first entry above the lower bound; a separator
+// is the min key of its right subtree, so the descent goes left on equality
+// for an inclusive bound and right for an exclusive one
+LeafCursor BPTree::seek(bool has_lo, float lo, bool lo_inclusive, bool has_hi, float hi, bool hi_inclusive) const {
+    LeafCursor c;
+    c.tree = this;
+    c.has_hi = has_hi;
+    c.hi = hi;
+    c.hi_inclusive = hi_inclusive;
+    if (latch) {
+        c.concurrent = true;
+        c.has_lo = has_lo;
+        c.lo = lo;
+        c.lo_inclusive = lo_inclusive;
+        c.done = false;
+        c.reseek();
+        return c;
+    }
+    if (nodeCount() == 0 || root_id == UINT32_MAX) return c;
+
+    NodeRef n = node(root_id);
+    while (!n.isLeaf()) {
+        const size_t i = !has_lo ? 0 : (lo_inclusive ? n.lowerBound(lo) : n.upperBound(lo));
+        n = node(n.child(i));
+    }
+    c.pos = !has_lo ? 0 : (lo_inclusive ? n.lowerBound(lo) : n.upperBound(lo));
+    c.leaf = std::move(n);
+    c.enterLeaf();
+    c.done = false;
+    return c;
+}
+
+LeafCursor BPTree::search(CompareOp op, float key) const {
+    switch (op) {
+    case CompareOp::EQ: return seek(true, key, true, true, key, true);
+    case CompareOp::LT: return seek(false, 0.0f, true, true, key, false);
+    case CompareOp::LE: return seek(false, 0.0f, true, true, key, true);
+    case CompareOp::GT: return seek(true, key, false, false, 0.0f, true);
+    case CompareOp::GE: return seek(true, key, true, false, 0.0f, true);
+    }
+    return LeafCursor();
+}
+
+LeafCursor BPTree::search(const ColumnPredicate& pred) const {
+    if (pred.column != Column::FT_PCT_home) throw std::invalid_argument("The index is on FT_PCT_home");
+    uint16_t lo, hi;
+    if (!predicateCodeRange(pred, lo, hi)) return LeafCursor();
+    // keys are built as float(code / 1000.0), which keeps the code order
+    static const TeamDictionary none;
+    const float first = static_cast<float>(columnValue(Column::FT_PCT_home, lo, none));
+    const float last = static_cast<float>(columnValue(Column::FT_PCT_home, hi, none));
+    return seek(true, first, true, true, last, true);
+}
+
+void BPTree::requireAggregates() const {
+    if (!aggregates) throw std::logic_error("Index keeps no subtree aggregates, see setAggregates");
+}
+
+// one descent: the children left of the path are counted whole, only the
+// leaf at the end is looked into
+// the entries of n's subtree before the bound (suffix = false) or from it
+// on: whole subtrees on the far side of the path to the bound, plus part of
+// one leaf
+BPTree::RangeAggregate BPTree::boundAggregate(NodeRef n, float key, bool upper, bool suffix) const {
+    RangeAggregate agg;
+    while (!n.isLeaf()) {
+        const size_t i = upper ? n.upperBound(key) : n.lowerBound(key);
+        for (size_t j = suffix ? i + 1 : 0; j < (suffix ? n.childCount() : i); ++j) {
+            agg.count += n.subtreeCount(j);
+            agg.sum += n.subtreeSum(j);
+        }
+        n = node(n.child(i));
+    }
+    const size_t pos = upper ? n.upperBound(key) : n.lowerBound(key);
+    for (size_t j = suffix ? pos : 0; j < (suffix ? n.size() : pos); ++j) agg.sum += n.entry(j).key;
+    agg.count += suffix ? n.size() - pos : pos;
+    return agg;
+}
+
+BPTree::RangeAggregate BPTree::prefixAggregate(float key, bool upper) const {
+    requireAggregates();
+    if (root_id == UINT32_MAX) return RangeAggregate();
+    return boundAggregate(node(root_id), key, upper, false);
+}
+
+// the paths to the two bounds are shared down to the node where they part;
+// below it the range is the suffix of one child, the prefix of another and
+// the whole subtrees in between, so the sum only adds values that are in
+// the range (subtracting two prefix sums loses the low bits of a small
+// range far into a large tree)
+BPTree::RangeAggregate BPTree::rangeAggregate(float lo, float hi, bool lo_inclusive, bool hi_inclusive) const {
+    requireAggregates();
+    RangeAggregate agg;
+    if (root_id == UINT32_MAX) return agg;
+    const bool lo_upper = !lo_inclusive;
+    NodeRef n = node(root_id);
+    while (!n.isLeaf()) {
+        const size_t a = lo_upper ? n.upperBound(lo) : n.lowerBound(lo);
+        const size_t b = hi_inclusive ? n.upperBound(hi) : n.lowerBound(hi);
+        if (a > b) return agg; // empty range
+        if (a == b) {
+            n = node(n.child(a));
+            continue;
+        }
+        for (size_t j = a + 1; j < b; ++j) {
+            agg.count += n.subtreeCount(j);
+            agg.sum += n.subtreeSum(j);
+        }
+        const RangeAggregate left = boundAggregate(node(n.child(a)), lo, lo_upper, true);
+        const RangeAggregate right = boundAggregate(node(n.child(b)), hi, hi_inclusive, false);
+        agg.count += left.count + right.count;
+        agg.sum += left.sum + right.sum;
+        return agg;
+    }
+    const size_t a = lo_upper ? n.upperBound(lo) : n.lowerBound(lo);
+    const size_t b = hi_inclusive ? n.upperBound(hi) : n.lowerBound(hi);
+    for (size_t j = a; j < b; ++j) agg.sum += n.entry(j).key;
+    agg.count = b > a ? b - a : 0;
+    return agg;
+}
+
+BPTree::RangeAggregate BPTree::aggregate(CompareOp op, float key) const {
+    switch (op) {
+    case CompareOp::EQ: return rangeAggregate(key, key);
+    case CompareOp::LT: return prefixAggregate(key, false);
+    case CompareOp::LE: return prefixAggregate(key, true);
+    case CompareOp::GT:
+    case CompareOp::GE:
+        requireAggregates();
+        if (root_id == UINT32_MAX) return RangeAggregate();
+        return boundAggregate(node(root_id), key, op == CompareOp::GT, true);
+    }
+    return RangeAggregate();
+}
+
+size_t BPTree::entryCount() const {
+    requireAggregates();
+    if (root_id == UINT32_MAX) return 0;
+    uint64_t count;
+    double sum;
+    subtree_totals(node(root_id), count, sum);
+    return count;
+}
+
+bool BPTree::select(size_t k, LeafEntry& out) const {
+    requireAggregates();
+    if (root_id == UINT32_MAX) return false;
+    NodeRef n = node(root_id);
+    while (!n.isLeaf()) {
+        size_t i = 0;
+        while (i + 1 < n.childCount() && k >= n.subtreeCount(i)) k -= n.subtreeCount(i++);
+        n = node(n.child(i));
+    }
+    if (k >= n.size()) return false;
+    out = n.entry(k);
+    return true;
+}
+
+float BPTree::percentile(double p) const {
+    const size_t n = entryCount();
+    if (n == 0) throw std::out_of_range("Percentile of an empty index");
+    const double rank = std::ceil(std::min(std::max(p, 0.0), 1.0) * static_cast<double>(n));
+    LeafEntry e;
+    select(rank < 1.0 ? 0 : static_cast<size_t>(rank) - 1, e);
+    return e.key;
+}
+
+// per node id, set while the owning thread runs deleteHighFTPCT
+static thread_local std::vector<uint8_t>* visitLog = nullptr;
+
+void BPTree::noteVisit(uint32_t id) const {
+    if (!visitLog) return;
+    if (id >= visitLog->size()) visitLog->resize(static_cast<size_t>(id) + 1, 0);
+    (*visitLog)[id] = 1;
+}
+
+NodeRef BPTree::node(uint32_t id) const {
+    noteVisit(id);
+    if (isMapped()) {
+        return NodeRef(mapped.data() + static_cast<size_t>(id + 1) * page_size, internal_n, leaf_capacity, packed_keys);
+    }
+    if (isBuffered()) {
+        return NodeRef(pooled.fetch(static_cast<uint64_t>(id) + 1), internal_n, leaf_capacity, packed_keys);
+    }
+    return NodeRef(residentPage(id), internal_n, leaf_capacity, packed_keys);
+}
+
+void BPTree::faultIn(uint32_t id) const {
+    backing->readPage(static_cast<uint64_t>(id) + 1, arena.at(id));
+    loaded[id] = 1;
+    ++pages_read;
+    if (--unloaded == 0) {
+        backing.reset();
+        loaded.clear();
+    }
+}
+
+void BPTree::loadAll() const {
+    for (uint32_t id = 0; unloaded != 0 && id < arena.size(); ++id) residentPage(id);
+}
+
+static void check_superblock(const IndexSuperblock& sb, const std::string& filename) {
+    if (std::memcmp(sb.magic, INDEX_MAGIC, sizeof(sb.magic)) != 0) {
+        throw std::runtime_error("Not an index file: " + filename);
+    }
+    if (sb.version != INDEX_VERSION) {
+        throw std::runtime_error("Unsupported index file version in " + filename);
     }
-    return level_ids;
 }
 
+// write the index as one page per node behind a superblock page
 void BPTree::saveToBinaryFile(const std::string& filename) const {
+    if (page_size == 0) throw std::runtime_error("Index has no page size, call compute_capacities first");
+    // the output may be the file still backing a lazy load
+    loadAll();
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out) throw std::runtime_error("Cannot open file for writing");
+
+    std::vector<uint8_t> page(page_size, 0);
+    const IndexSuperblock sb = superblock();
+    std::memcpy(page.data(), &sb, sizeof(sb));
+    out.write(reinterpret_cast<const char*>(page.data()), page_size);
+
+    // a node is its page image, wherever it lives
+    for (uint32_t id = 0; id < nodeCount(); ++id) {
+        const NodeRef n = node(id);
+        out.write(reinterpret_cast<const char*>(n.data()), page_size);
+    }
+}
+
+IndexSuperblock BPTree::superblock() const {
+    IndexSuperblock sb{};
+    std::memcpy(sb.magic, INDEX_MAGIC, sizeof(sb.magic));
+    sb.version = INDEX_VERSION;
+    sb.page_size = page_size;
+    sb.internal_n = internal_n;
+    sb.leaf_capacity = leaf_capacity;
+    sb.root_id = root_id;
+    sb.levels = levels;
+    sb.node_count = static_cast<uint32_t>(nodeCount());
+    sb.free_head = free_ids.empty() ? UINT32_MAX : free_ids.back();
+    sb.leaf_format = posting_leaves ? 1 : (packed_keys ? 2 : 0);
+    sb.aggregates = aggregates ? 1 : 0;
+    return sb;
+}
+
+// read only the superblock; node pages are faulted in by node() / edit()
+void BPTree::loadFromBinaryFile(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in) throw std::runtime_error("Cannot open file for reading");
+
+    IndexSuperblock sb{};
+    if (!in.read(reinterpret_cast<char*>(&sb), sizeof(sb))) {
+        throw std::runtime_error("Not an index file: " + filename);
+    }
+    check_superblock(sb, filename);
+    in.close();
+
+    auto file = std::make_unique<PageFile>(filename, sb.page_size);
+    if (file->numPages() < static_cast<uint64_t>(sb.node_count) + 1) {
+        throw std::runtime_error("Truncated index file: " + filename);
+    }
+
+    closeFile();
+    applySuperblock(sb);
+    for (uint32_t id = 0; id < sb.node_count; ++id) arena.append();
+    if (sb.node_count != 0) {
+        backing = std::move(file);
+        loaded.assign(sb.node_count, 0);
+        unloaded = sb.node_count;
+    }
+    loadFreeList(sb.free_head);
+}
+
+void BPTree::openMapped(const std::string& filename) {
+    MappedFile file(filename);
+
+    IndexSuperblock sb{};
+    if (file.size() < sizeof(sb)) throw std::runtime_error("Not an index file: " + filename);
+    std::memcpy(&sb, file.data(), sizeof(sb));
+    check_superblock(sb, filename);
+    if (file.size() < static_cast<size_t>(sb.node_count + 1) * sb.page_size) {
+        throw std::runtime_error("Truncated index file: " + filename);
+    }
+
+    closeFile();
+    applySuperblock(sb);
+    file_nodes = sb.node_count;
+    mapped = std::move(file);
+    loadFreeList(sb.free_head);
+}
+
+void BPTree::openBuffered(const std::string& filename, BufferPool& pool) {
+    PooledFile file(pool, filename);
+
+    IndexSuperblock sb{};
+    {
+        PageGuard first = file.fetch(0);
+        std::memcpy(&sb, first.data(), sizeof(sb));
+    }
+    check_superblock(sb, filename);
+    if (sb.page_size != pool.getPageSize()) {
+        throw std::runtime_error("Page size of " + filename + " does not match the buffer pool");
+    }
+
+    closeFile();
+    applySuperblock(sb);
+    file_nodes = sb.node_count;
+    pooled = std::move(file);
+    loadFreeList(sb.free_head);
+}
+
+void BPTree::applySuperblock(const IndexSuperblock& sb) {
+    page_size = sb.page_size;
+    internal_n = sb.internal_n;
+    leaf_capacity = sb.leaf_capacity;
+    root_id = sb.root_id;
+    levels = sb.levels;
+    posting_leaves = sb.leaf_format == 1;
+    packed_keys = sb.leaf_format == 2;
+    aggregates = sb.aggregates != 0;
+    arena.reset(page_size);
+}
+
+void BPTree::closeFile() {
+    mapped.close();
+    pooled.close();
+    file_nodes = 0;
+    free_ids.clear();
+    backing.reset();
+    loaded.clear();
+    unloaded = 0;
+    pages_read = 0;
+}
+
+void BPTree::exportToTextFile(const std::string& filename) const {
+    if (isCompressed()) throw std::logic_error("The text dump holds (key, RID) leaves only");
     std::ofstream out(filename);  
     if (!out) throw std::runtime_error("Cannot open file for writing");
 
@@ -112,89 +1337,104 @@ void BPTree::saveToBinaryFile(const std::string& filename) const {
     out << leaf_capacity << "\n";
     out << root_id << "\n";
     out << levels << "\n";
-    out << nodes.size() << "\n";
+    out << nodeCount() << "\n";
 
     // write nodes
-    for (const auto& node : nodes) {
+    for (uint32_t id = 0; id < nodeCount(); ++id) {
+        const NodeRef node = this->node(id);
+        const bool leaf = node.header().is_leaf == 1;
+
         // write header fields
-        out << static_cast<int>(node.header.is_leaf) << "|"
-            << node.header.key_count << "|"
-            << node.header.parent_id << "|"
-            << node.header.next_leaf_id << "\n";
+        out << static_cast<int>(node.header().is_leaf) << "|"
+            << node.header().key_count << "|"
+            << node.header().parent_id << "|"
+            << node.header().next_leaf_id << "\n";
 
         // write pointers
-        out << node.pointers.size();
-        for (uint32_t ptr : node.pointers) {
-            out << "|" << ptr;
+        out << node.childCount();
+        for (size_t i = 0; i < node.childCount(); ++i) {
+            out << "|" << node.child(i);
         }
         out << "\n";
 
         // write keys
-        out << node.keys.size();
-        for (float key : node.keys) {
-            out << "|" << std::fixed << std::setprecision(6) << key;
+        out << (leaf ? 0 : node.size());
+        for (size_t i = 0; !leaf && i < node.size(); ++i) {
+            out << "|" << std::fixed << std::setprecision(6) << node.key(i);
         }
         out << "\n";
 
         // write leaf entries
-        out << node.leaf.size();
+        out << (leaf ? node.size() : 0);
         out << std::fixed << std::setprecision(6);
-        for (const LeafEntry& e : node.leaf) {
+        for (size_t i = 0; leaf && i < node.size(); ++i) {
+            const LeafEntry e = node.entry(i);
             out << "|" << e.key << ":" << e.rid.block << "," << e.rid.slot;
         }
         out << "\n";
     }
 }
 
-void BPTree::loadFromBinaryFile(const std::string& filename) {
+void BPTree::importFromTextFile(const std::string& filename) {
     std::ifstream in(filename);  
     if (!in) throw std::runtime_error("Cannot open file for reading");
 
     // read metadata as text
-    uint32_t node_count;
-    in >> internal_n >> leaf_capacity >> root_id >> levels >> node_count;
-    nodes.resize(node_count);
+    uint32_t node_count, root;
+    in >> internal_n >> leaf_capacity >> root >> levels >> node_count;
+    root_id = root;
+    closeFile();
+
+    // the dump does not record the page size, use the smallest one that fits
+    page_size = static_cast<uint32_t>(std::max<size_t>(
+        children_offset(internal_n) + sizeof(uint32_t) * internal_n,
+        rids_offset(leaf_capacity) + sizeof(RID) * leaf_capacity));
+    arena.reset(page_size);
+    posting_leaves = false;
+    packed_keys = false;
+    aggregates = false; // the dump has no subtree aggregates
 
     std::string line;
     std::getline(in, line); 
 
     // read nodes
-    for (auto& node : nodes) {
+    for (uint32_t n = 0; n < node_count; ++n) {
+        NodeEditor node = edit(arena.append());
+        NodeHeader& header = node.header();
         // read header line
         std::getline(in, line);
         size_t pos = 0, nextPos = 0;
 
         // parse header fields
         nextPos = line.find('|', pos);
-        node.header.is_leaf = (std::stoi(line.substr(pos, nextPos - pos)) == 1);
+        header.is_leaf = static_cast<uint8_t>(std::stoi(line.substr(pos, nextPos - pos)));
         pos = nextPos + 1;
 
         nextPos = line.find('|', pos);
-        node.header.key_count = static_cast<uint16_t>(std::stoi(line.substr(pos, nextPos - pos)));
+        header.key_count = static_cast<uint16_t>(std::stoi(line.substr(pos, nextPos - pos)));
         pos = nextPos + 1;
 
         nextPos = line.find('|', pos);
-        node.header.parent_id = static_cast<uint32_t>(std::stoul(line.substr(pos, nextPos - pos)));
+        header.parent_id = static_cast<uint32_t>(std::stoul(line.substr(pos, nextPos - pos)));
         pos = nextPos + 1;
 
-        node.header.next_leaf_id = static_cast<uint32_t>(std::stoul(line.substr(pos)));
+        header.next_leaf_id = static_cast<uint32_t>(std::stoul(line.substr(pos)));
+        header.self_id = n;
 
         // read pointers line
         std::getline(in, line);
         pos = 0;
         nextPos = line.find('|', pos);
         uint32_t psize = static_cast<uint32_t>(std::stoul(line.substr(pos, nextPos - pos)));
-        node.pointers.clear();
-        node.pointers.reserve(psize);
 
-        for (uint32_t i = 0; i < psize; ++i) {
+        for (uint32_t i = 0; i < psize && i < internal_n; ++i) {
             if (nextPos == std::string::npos) break;
             pos = nextPos + 1;
             nextPos = line.find('|', pos);
             if (nextPos == std::string::npos) {
-                node.pointers.push_back(static_cast<uint32_t>(std::stoul(line.substr(pos))));
+                node.children()[i] = static_cast<uint32_t>(std::stoul(line.substr(pos)));
             } else {
-                node.pointers.push_back(static_cast<uint32_t>(std::stoul(line.substr(pos, nextPos - pos))));
+                node.children()[i] = static_cast<uint32_t>(std::stoul(line.substr(pos, nextPos - pos)));
             }
         }
 
@@ -202,17 +1442,15 @@ void BPTree::loadFromBinaryFile(const std::string& filename) {
         pos = 0;
         nextPos = line.find('|', pos);
         uint32_t ksize = static_cast<uint32_t>(std::stoul(line.substr(pos, nextPos - pos)));
-        node.keys.clear();
-        node.keys.reserve(ksize);
 
-        for (uint32_t i = 0; i < ksize; ++i) {
+        for (uint32_t i = 0; i < ksize && i + 1 < internal_n; ++i) {
             if (nextPos == std::string::npos) break;
             pos = nextPos + 1;
             nextPos = line.find('|', pos);
             if (nextPos == std::string::npos) {
-                node.keys.push_back(std::stof(line.substr(pos)));
+                node.keys()[i] = std::stof(line.substr(pos));
             } else {
-                node.keys.push_back(std::stof(line.substr(pos, nextPos - pos)));
+                node.keys()[i] = std::stof(line.substr(pos, nextPos - pos));
             }
         }
 
@@ -220,10 +1458,8 @@ void BPTree::loadFromBinaryFile(const std::string& filename) {
         pos = 0;
         nextPos = line.find('|', pos);
         uint32_t lsize = static_cast<uint32_t>(std::stoul(line.substr(pos, nextPos - pos)));
-        node.leaf.clear();
-        node.leaf.reserve(lsize);
 
-        for (uint32_t i = 0; i < lsize; ++i) {
+        for (uint32_t i = 0; i < lsize && i < leaf_capacity; ++i) {
             if (nextPos == std::string::npos) break;
             pos = nextPos + 1;
             nextPos = line.find('|', pos);
@@ -238,230 +1474,668 @@ void BPTree::loadFromBinaryFile(const std::string& filename) {
             size_t colon_pos = entry_str.find(':');
             if (colon_pos != std::string::npos) {
                 float key = std::stof(entry_str.substr(0, colon_pos));
-                uint32_t recno = static_cast<uint32_t>(std::stoul(entry_str.substr(colon_pos + 1)));
-                node.leaf.push_back(LeafEntry{key, recno});
+                // rid is written as "block,slot"
+                const size_t comma_pos = entry_str.find(',', colon_pos + 1);
+                RID rid{};
+                rid.block = static_cast<uint32_t>(std::stoul(entry_str.substr(colon_pos + 1, comma_pos - colon_pos - 1)));
+                if (comma_pos != std::string::npos) {
+                    rid.slot = static_cast<uint32_t>(std::stoul(entry_str.substr(comma_pos + 1)));
+                }
+                const LeafEntry e{key, rid};
+                node.keys()[i] = e.key;
+                node.rids()[i] = e.rid;
             }
         }
     }
+    rebuildFreeList();
 }
 
 
-void BPTree::updateInternalKeys(uint32_t node_id) {
-    if (node_id == UINT32_MAX) return;
-    
-    auto& node = nodes[node_id];
-    if (node.header.is_leaf) return;
+// exclusive writer section of a concurrent tree, a no-op otherwise; nodes
+// latched by edit() inside it are released at the end
+class BPTree::ExclusiveWrite {
+private:
+    BPTree& tree;
+    std::unique_lock<std::shared_mutex> lock;
 
-    
-    // completely clear and rebuild keys
-    node.keys.clear();
-    
-    for (size_t i = 1; i < node.pointers.size(); ++i) {
-        uint32_t child_id = node.pointers[i];
-        
-        // find the ACTUAL minimum key in this child's subtree
-        float min_key = findActualMinKey(child_id);
-        
-        if (min_key < 1000.0f) { // Valid key found
-            node.keys.push_back(min_key);
-        }
+public:
+    explicit ExclusiveWrite(BPTree& t) : tree(t) {
+        if (!tree.latch) return;
+        lock = std::unique_lock<std::shared_mutex>(tree.latch->writers);
+        tree.latch->exclusive = true;
     }
-    
-    node.header.key_count = static_cast<uint16_t>(node.keys.size());
+    ~ExclusiveWrite() {
+        if (!lock.owns_lock()) return;
+        tree.releaseLatches();
+        tree.latch->exclusive = false;
+    }
+};
+
+// insert / erase section of a tree with subtree aggregates, a no-op
+// otherwise; the aggregates are brought up to date at the end
+class BPTree::AggregateUpdate {
+private:
+    BPTree& tree;
+    bool active;
+
+public:
+    explicit AggregateUpdate(BPTree& t) : tree(t), active(t.aggregates && !t.aggregate_update) {
+        tree.aggregate_update = active;
+    }
+    ~AggregateUpdate() {
+        if (active) tree.flushAggregates();
+    }
+};
 
-    // update parent
-    if (node.header.parent_id != UINT32_MAX) {
-        updateInternalKeys(node.header.parent_id);
+// every node edited since the update began, and every ancestor of one,
+// writes its totals into its slot in the parent, deepest nodes first; the
+// slots of other children were moved along with them and are still right
+void BPTree::flushAggregates() {
+    aggregate_update = false;
+    std::vector<uint32_t> ids;
+    ids.reserve(touched.size() * 2);
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+    for (uint32_t id : touched) {
+        if (node(id).header().is_leaf == NODE_FREE) continue;
+        for (uint32_t a = id; a != UINT32_MAX; a = node(a).header().parent_id) ids.push_back(a);
+    }
+    touched.clear();
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+    std::vector<std::pair<uint32_t, uint32_t>> by_depth; // (depth, id)
+    by_depth.reserve(ids.size());
+    for (uint32_t id : ids) {
+        uint32_t depth = 0;
+        for (uint32_t a = node(id).header().parent_id; a != UINT32_MAX; a = node(a).header().parent_id) ++depth;
+        by_depth.emplace_back(depth, id);
+    }
+    std::sort(by_depth.rbegin(), by_depth.rend());
+
+    for (const auto& d : by_depth) {
+        const NodeRef n = node(d.second);
+        const uint32_t parent_id = n.header().parent_id;
+        if (parent_id == UINT32_MAX) continue;
+        uint64_t count;
+        double sum;
+        subtree_totals(n, count, sum);
+        NodeEditor parent = edit(parent_id);
+        const size_t slot = std::find(parent.children(), parent.children() + parent.size() + 1, d.second) - parent.children();
+        parent.sums()[slot] = sum;
+        parent.counts()[slot] = static_cast<uint32_t>(count);
     }
 }
 
-float BPTree::findActualMinKey(uint32_t node_id) {
-    const auto& node = nodes[node_id];
-    
-    if (node.header.is_leaf) {
-        // for leaves, find the first valid key (not empty and <= 0.9)
-        for (const auto& entry : node.leaf) {
-            if (entry.key <= 0.9f) {
-                return entry.key;
-            }
-        }
-        return 1000.0f; // no valid keys found
-    } else {
-        // for internal nodes, recursively check all children
-        float min_key = 1000.0f;
-        for (uint32_t child_id : node.pointers) {
-            float child_min = findActualMinKey(child_id);
-            if (child_min < min_key) {
-                min_key = child_min;
-            }
-        }
-        return min_key;
+void BPTree::setAggregates(bool on) {
+    if (page_size == 0) throw std::logic_error("Index has no capacities, call compute_capacities first");
+    if (isReadOnly() || latch || isCompressed() || nodeCount() != 0) {
+        throw std::logic_error("Subtree aggregates are chosen for an empty, resident index");
     }
+    internal_n = on ? aggregate_capacities(page_size).internal_n : node_capacities(page_size).internal_n;
+    aggregates = on;
 }
-// Helper function to find minimum key in a subtree
-float BPTree::findMinKeyInSubtree(uint32_t node_id) {
-    const auto& node = nodes[node_id];
-    
-    if (node.header.is_leaf) {
-        // For leaf nodes, return the first key (leaves are sorted)
-        return node.leaf.empty() ? 0.0f : node.leaf.front().key;
+
+// rightmost leaf that can hold `key`, so a new duplicate lands after the others
+uint32_t BPTree::findLeafForInsert(float key) const {
+    uint32_t id = root_id;
+    NodeRef n = node(id);
+    while (!n.isLeaf()) {
+        id = n.child(n.upperBound(key));
+        n = node(id);
+    }
+    return id;
+}
+
+void BPTree::insert(float key, RID rid) {
+    if (isReadOnly()) throw std::logic_error("Cannot insert into an index opened read-only");
+    if (isCompressed()) throw std::logic_error("Compressed leaves are bulk-loaded only");
+    if (leaf_capacity == 0) throw std::logic_error("Index has no capacities, call compute_capacities first");
+
+    if (latch) {
+        std::shared_lock<std::shared_mutex> shared(latch->writers);
+        if (tryInsertInLeaf(key, rid)) return;
+    }
+    ExclusiveWrite scope(*this);
+    AggregateUpdate update(*this);
+
+    if (root_id == UINT32_MAX) {
+        setRoot(new_node(true));
+        levels = 1;
+    }
+
+    const uint32_t leaf_id = findLeafForInsert(key);
+    NodeEditor leaf = edit(leaf_id);
+    const size_t pos = keyUpperBound(leaf.keys(), leaf.size(), key);
+    if (leaf.size() < leaf_capacity) {
+        leaf.insertEntry(pos, LeafEntry{key, rid});
     } else {
-        // For internal nodes, recursively find min in first child
-        return findMinKeyInSubtree(node.pointers.front());
+        splitLeaf(leaf_id, pos, LeafEntry{key, rid});
     }
 }
 
-// Find all records with key > threshold
-std::vector<LeafEntry> BPTree::findRecordsGreaterThan(float threshold) {
-    std::vector<LeafEntry> result;
-    
-    if (nodes.empty() || root_id == UINT32_MAX) return result;
-    
-    // Navigate to the first leaf that might contain keys > threshold
-    uint32_t current_id = root_id;
-    while (!nodes[current_id].header.is_leaf) {
-        const auto& node = nodes[current_id];
-        
-        // Find the first pointer where key > threshold
-        size_t i = 0;
-        while (i < node.keys.size() && node.keys[i] <= threshold) {
-            i++;
+// split a full leaf into it and a new right sibling while adding `entry` at
+// `pos`; the left half gets the larger share of the leaf_capacity + 1 entries
+void BPTree::splitLeaf(uint32_t leaf_id, size_t pos, const LeafEntry& entry) {
+    const uint32_t right_id = new_node(true);
+    NodeEditor left = edit(leaf_id);
+    NodeEditor right = edit(right_id);
+
+    const size_t n = left.size();
+    const size_t left_share = (n + 2) / 2;
+    const size_t keep = pos < left_share ? left_share - 1 : left_share; // old entries staying left
+    std::memcpy(right.keys(), left.keys() + keep, (n - keep) * sizeof(float));
+    std::memcpy(right.rids(), left.rids() + keep, (n - keep) * sizeof(RID));
+    right.setSize(n - keep);
+    left.setSize(keep);
+    if (pos < left_share) left.insertEntry(pos, entry);
+    else right.insertEntry(pos - keep, entry);
+
+    right.header().next_leaf_id = left.header().next_leaf_id;
+    left.header().next_leaf_id = right_id;
+
+    insertIntoParent(leaf_id, right.keys()[0], right_id);
+}
+
+// hang a new right sibling under the left node's parent, splitting the parent
+// around its middle key when it is full and growing the root when the split
+// node was the root
+void BPTree::insertIntoParent(uint32_t left_id, float sep, uint32_t right_id) {
+    const uint32_t parent_id = edit(left_id).header().parent_id;
+
+    if (parent_id == UINT32_MAX) {
+        const uint32_t new_root = new_node(false);
+        NodeEditor root = edit(new_root);
+        root.keys()[0] = sep;
+        root.children()[0] = left_id;
+        root.children()[1] = right_id;
+        root.setSize(1);
+        edit(left_id).header().parent_id = new_root;
+        edit(right_id).header().parent_id = new_root;
+        setRoot(new_root);
+        levels++;
+        return;
+    }
+
+    NodeEditor parent = edit(parent_id);
+    const size_t n = parent.size();
+    const size_t idx = std::find(parent.children(), parent.children() + n + 1, left_id) - parent.children();
+    edit(right_id).header().parent_id = parent_id;
+    if (n + 1 < internal_n) {
+        parent.insertKeyChild(idx, sep, idx + 1, right_id);
+        return;
+    }
+
+    // full: lay out the internal_n keys and internal_n + 1 children it would
+    // hold, keep the lower half, push the middle key up, move the rest right
+    std::vector<float> keys(parent.keys(), parent.keys() + n);
+    std::vector<uint32_t> kids(parent.children(), parent.children() + n + 1);
+    keys.insert(keys.begin() + static_cast<long>(idx), sep);
+    kids.insert(kids.begin() + static_cast<long>(idx) + 1, right_id);
+    std::vector<double> sums;
+    std::vector<uint32_t> counts;
+    if (aggregates) {
+        sums.assign(parent.sums(), parent.sums() + n + 1);
+        counts.assign(parent.counts(), parent.counts() + n + 1);
+        sums.insert(sums.begin() + static_cast<long>(idx) + 1, 0.0);
+        counts.insert(counts.begin() + static_cast<long>(idx) + 1, 0);
+    }
+
+    const uint32_t sibling_id = new_node(false);
+    NodeEditor sibling = edit(sibling_id);
+    const size_t mid = keys.size() / 2;
+    std::copy(keys.begin(), keys.begin() + static_cast<long>(mid), parent.keys());
+    std::copy(kids.begin(), kids.begin() + static_cast<long>(mid) + 1, parent.children());
+    parent.setSize(mid);
+    std::copy(keys.begin() + static_cast<long>(mid) + 1, keys.end(), sibling.keys());
+    std::copy(kids.begin() + static_cast<long>(mid) + 1, kids.end(), sibling.children());
+    sibling.setSize(keys.size() - mid - 1);
+    if (aggregates) {
+        std::copy(sums.begin(), sums.begin() + static_cast<long>(mid) + 1, parent.sums());
+        std::copy(counts.begin(), counts.begin() + static_cast<long>(mid) + 1, parent.counts());
+        std::copy(sums.begin() + static_cast<long>(mid) + 1, sums.end(), sibling.sums());
+        std::copy(counts.begin() + static_cast<long>(mid) + 1, counts.end(), sibling.counts());
+    }
+    for (size_t i = 0; i <= sibling.size(); ++i) {
+        edit(sibling.children()[i]).header().parent_id = sibling_id;
+    }
+
+    insertIntoParent(parent_id, keys[mid], sibling_id);
+}
+
+void BPTree::setConcurrent(bool on, size_t maxNodes) {
+    if (!on) {
+        latch.reset();
+        return;
+    }
+    if (isReadOnly() || isCompressed()) throw std::logic_error("Concurrent mode is for resident, writable indexes");
+    if (aggregates) throw std::logic_error("Concurrent mode does not keep subtree aggregates");
+    if (latch) return;
+    loadAll(); // no lazy page faults while threads share the tree
+    if (maxNodes == 0) maxNodes = std::max<size_t>(arena.size() * 4, size_t(1) << 16);
+    arena.reserve(std::max(maxNodes, arena.size()));
+    latch = std::make_unique<TreeLatch>();
+}
+
+// latch a node whose version is `expected` (even) by making it odd; the
+// release fence keeps the node stores that follow from becoming visible
+// before the lock bit does
+static bool lockVersion(std::atomic<uint64_t>& version, uint64_t& expected) {
+    if (!version.compare_exchange_strong(expected, expected + 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    return true;
+}
+
+// wait out a writer holding the node and return the version it left
+uint64_t BPTree::readLatch(uint32_t id) const {
+    uint64_t v;
+    while ((v = arena.version(id).load(std::memory_order_acquire)) & 1) std::this_thread::yield();
+    return v;
+}
+
+// true if nothing wrote the node since readLatch returned `version`
+bool BPTree::validate(uint32_t id, uint64_t version) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return arena.version(id).load(std::memory_order_relaxed) == version;
+}
+
+// the exclusive writer latches each node once, until releaseLatches
+void BPTree::latchForWrite(uint32_t id) {
+    if (latch->holding.size() <= id) latch->holding.resize(std::max<size_t>(arena.size(), id + 1), 0);
+    if (latch->holding[id]) return;
+    std::atomic<uint64_t>& v = arena.version(id);
+    uint64_t cur = v.load(std::memory_order_relaxed);
+    while ((cur & 1) || !lockVersion(v, cur)) {
+        std::this_thread::yield();
+        cur = v.load(std::memory_order_relaxed);
+    }
+    latch->holding[id] = 1;
+    latch->held.push_back(id);
+}
+
+void BPTree::releaseLatches() {
+    for (uint32_t id : latch->held) {
+        arena.version(id).fetch_add(1, std::memory_order_release);
+        latch->holding[id] = 0;
+    }
+    latch->held.clear();
+}
+
+// lock-free descent of a concurrent tree: a child id is used only after the
+// parent it came from is validated; false when a writer got in the way and
+// the caller has to start over; leaf is UINT32_MAX for an empty tree
+bool BPTree::descendOptimistic(float key, bool upper, uint32_t& leaf, uint64_t& version) const {
+    uint32_t id = loadRoot();
+    leaf = UINT32_MAX;
+    if (id == UINT32_MAX) return true;
+    uint64_t v = readLatch(id);
+    if (loadRoot() != id) return false;
+
+    for (;;) {
+        const NodeRef n(arena.at(id), internal_n, leaf_capacity);
+        if (n.header().is_leaf == 1) {
+            leaf = id;
+            version = v;
+            return true;
         }
-        current_id = node.pointers[i];
+        if (n.header().is_leaf != 0) return false; // freed under us
+        const size_t size = std::min<size_t>(n.size(), internal_n - 1);
+        const size_t i = upper ? keyUpperBound(n.keyData(), size, key) : keyLowerBound(n.keyData(), size, key);
+        const uint32_t child = n.child(i);
+        if (!validate(id, v)) return false;
+        const uint64_t cv = readLatch(child);
+        if (!validate(id, v)) return false;
+        id = child;
+        v = cv;
     }
-    
-    // Now traverse leaves from this point forward
-    uint32_t leaf_id = current_id;
-    while (leaf_id != UINT32_MAX) {
-        const auto& leaf = nodes[leaf_id];
-        
-        for (const auto& entry : leaf.leaf) {
-            if (entry.key > threshold) {
-                result.push_back(entry);
-            }
+}
+
+// insert without a structure change: latch only the target leaf, and give
+// up (false) when it is full
+bool BPTree::tryInsertInLeaf(float key, RID rid) {
+    for (;;) {
+        uint32_t id;
+        uint64_t v;
+        if (!descendOptimistic(key, true, id, v)) continue;
+        if (id == UINT32_MAX) return false;
+        std::atomic<uint64_t>& version = arena.version(id);
+        if (!lockVersion(version, v)) continue;
+
+        NodeEditor leaf(arena.at(id), internal_n, leaf_capacity);
+        if (leaf.size() >= leaf_capacity) {
+            version.store(v, std::memory_order_release); // untouched
+            return false;
         }
-        
-        // Move to next leaf
-        leaf_id = leaf.header.next_leaf_id;
+        leaf.insertEntry(keyUpperBound(leaf.keys(), leaf.size(), key), LeafEntry{key, rid});
+        version.store(v + 2, std::memory_order_release);
+        return true;
+    }
+}
+
+// erase without a structure change: only the leftmost leaf for the key is
+// latched; false when the entry may sit in a later leaf or the leaf would
+// underflow, so the caller falls back to an exclusive erase
+bool BPTree::tryEraseInLeaf(float key, RID rid, bool& erased) {
+    for (;;) {
+        uint32_t id;
+        uint64_t v;
+        if (!descendOptimistic(key, false, id, v)) continue;
+        erased = false;
+        if (id == UINT32_MAX) return true;
+        std::atomic<uint64_t>& version = arena.version(id);
+        if (!lockVersion(version, v)) continue;
+
+        NodeEditor leaf(arena.at(id), internal_n, leaf_capacity);
+        const size_t n = leaf.size();
+        size_t i = keyLowerBound(leaf.keys(), n, key);
+        while (i < n && leaf.keys()[i] == key && !(leaf.rids()[i] == rid)) ++i;
+        const bool found = i < n && leaf.keys()[i] == key;
+        const bool root = leaf.header().parent_id == UINT32_MAX;
+        if (found && (root || n - 1 >= minKeys(true))) {
+            leaf.eraseEntry(i);
+            version.store(v + 2, std::memory_order_release);
+            erased = true;
+            return true;
+        }
+        // a bigger key or the end of the leaf chain settles it
+        const bool absent = !found && (i < n || leaf.header().next_leaf_id == UINT32_MAX);
+        version.store(v, std::memory_order_release); // untouched
+        return absent;
+    }
+}
+
+bool BPTree::erase(float key, RID rid) {
+    if (isReadOnly()) throw std::logic_error("Cannot delete from an index opened read-only");
+    if (isCompressed()) throw std::logic_error("Compressed leaves are bulk-loaded only");
+    if (latch) {
+        std::shared_lock<std::shared_mutex> shared(latch->writers);
+        bool erased;
+        if (tryEraseInLeaf(key, rid, erased)) return erased;
+    }
+    ExclusiveWrite scope(*this);
+    AggregateUpdate update(*this);
+    return removeEntry(LeafEntry{key, rid});
+}
+
+// Find all records with key > threshold
+std::vector<LeafEntry> BPTree::findRecordsMatching(const ColumnPredicate& pred) const {
+    std::vector<LeafEntry> result;
+    LeafCursor cursor = search(pred);
+    LeafEntry entry;
+    while (cursor.next(entry)) {
+        result.push_back(entry);
     }
-    
     return result;
 }
 
+// Tombstone the heap records behind the given index entries
+HeapDeleteStats BPTree::deleteFromDatabase(Database& db, const std::vector<LeafEntry>& to_delete) {
+    std::vector<RID> rids;
+    rids.reserve(to_delete.size());
+    for (const auto& entry : to_delete) {
+        rids.push_back(entry.rid);
+    }
+    return db.deleteRecords(std::move(rids)); // sorted and grouped by page in there
+}
+
 bool BPTree::isNodeUnderflow(uint32_t node_id) {
-    const auto& node = nodes[node_id];
-    size_t min_keys = node.header.is_leaf ? (leaf_capacity + 1) / 2 : (internal_n + 1) / 2 - 1;
-    return node.isUnderflow(min_keys);
+    NodeEditor node = edit(node_id);
+    return node.size() < minKeys(node.isLeaf());
 }
 
-BPTree::DeletionStats BPTree::deleteHighFTPCT(Database& db, float threshold) {
-    DeletionStats stats;
-    auto start_time = std::chrono::high_resolution_clock::now();
-    
-    // Store initial state for comparison
-    size_t initial_total_records = 0;
-    for (const auto& node : nodes) {
-        if (node.header.is_leaf) {
-            initial_total_records += node.leaf.size();
-        }
+void BPTree::free_node(uint32_t id) {
+    NodeEditor freed = edit(id); // latched before it is cleared
+    std::memset(freed.data(), 0, page_size);
+    NodeHeader& h = freed.header();
+    h.is_leaf = NODE_FREE;
+    h.self_id = id;
+    h.parent_id = UINT32_MAX;
+    h.next_leaf_id = free_ids.empty() ? UINT32_MAX : free_ids.back();
+    free_ids.push_back(id);
+}
+
+// free nodes are marked in their header, so the list is rebuilt after a
+// text import by scanning every node
+void BPTree::rebuildFreeList() {
+    free_ids.clear();
+    for (uint32_t id = 0; id < arena.size(); ++id) {
+        if (edit(id).header().is_leaf == NODE_FREE) free_ids.push_back(id);
     }
-    
-    // Method 1: Using B+ Tree index
-    auto records_to_delete = findRecordsGreaterThan(threshold);
-    stats.games_deleted = records_to_delete.size();
-    
-    // Calculate average FT_PCT
-    double sum_ft_pct = 0.0;
-    for (const auto& entry : records_to_delete) {
-        sum_ft_pct += entry.key;
+}
+
+// a binary index records the last freed node, so only the free chain is read;
+// free_ids keeps the most recently freed id at the back
+void BPTree::loadFreeList(uint32_t head) {
+    free_ids.clear();
+    for (uint32_t id = head; id != UINT32_MAX && free_ids.size() < nodeCount(); id = node(id).header().next_leaf_id) {
+        free_ids.push_back(id);
     }
-    stats.average_ft_pct = stats.games_deleted > 0 ? sum_ft_pct / stats.games_deleted : 0.0;
-    
-    // Track accessed data blocks (using RID)
-    std::unordered_set<uint32_t> accessed_blocks;
-    
-    for (const auto& entry : records_to_delete) {
-        uint32_t block_num = entry.rid.block;
-        accessed_blocks.insert(block_num);
+    std::reverse(free_ids.begin(), free_ids.end());
+}
+
+// leftmost leaf that can hold `key`; equal keys may continue in the leaves
+// after it, since a separator is the min key of its right subtree
+uint32_t BPTree::findLeftmostLeaf(float key) const {
+    uint32_t id = root_id;
+    NodeRef n = node(id);
+    while (!n.isLeaf()) {
+        id = n.child(n.lowerBound(key));
+        n = node(id);
     }
-    stats.data_blocks_accessed = accessed_blocks.size();
-    
-    // Count index nodes accessed
-    stats.index_nodes_accessed = levels;
-    
-    // Remove records from B+ tree leaves
-    size_t total_deleted_from_tree = 0;
-    std::unordered_set<uint32_t> modified_leaves;
-    std::unordered_set<uint32_t> affected_parents;
-    
-    for (uint32_t i = 0; i < nodes.size(); i++) {
-        if (nodes[i].header.is_leaf) {
-            auto& leaf = nodes[i].leaf;
-            size_t original_size = leaf.size();
-            
-            // Remove entries with key > threshold
-            auto new_end = std::remove_if(leaf.begin(), leaf.end(),
-                [threshold](const LeafEntry& entry) {
-                    return entry.key > threshold;
-                });
-            
-            size_t new_size = std::distance(leaf.begin(), new_end);
-            if (new_size != original_size) {
-                leaf.erase(new_end, leaf.end());
-                nodes[i].header.key_count = static_cast<uint16_t>(leaf.size());
-                modified_leaves.insert(i);
-                total_deleted_from_tree += (original_size - leaf.size());
-                
-                // Track affected parent for key updates
-                if (nodes[i].header.parent_id != UINT32_MAX) {
-                    affected_parents.insert(nodes[i].header.parent_id);
-                }
+    return id;
+}
+
+// remove one (key, RID) entry, rebalancing the tree if its leaf underflows
+bool BPTree::removeEntry(const LeafEntry& entry) {
+    if (root_id == UINT32_MAX) return false;
+
+    for (uint32_t leaf_id = findLeftmostLeaf(entry.key); leaf_id != UINT32_MAX;
+         leaf_id = edit(leaf_id).header().next_leaf_id) {
+        NodeEditor leaf = edit(leaf_id);
+        const size_t n = leaf.size();
+        for (size_t i = keyLowerBound(leaf.keys(), n, entry.key); i < n; ++i) {
+            if (leaf.keys()[i] > entry.key) return false;
+            if (leaf.rids()[i] == entry.rid) {
+                leaf.eraseEntry(i);
+                handleUnderflow(leaf_id);
+                return true;
             }
         }
     }
-    
-    // Update internal node keys after deletions
-    if (!modified_leaves.empty()) {
-        // Update all directly affected parents
-        for (uint32_t parent_id : affected_parents) {
-            updateInternalKeys(parent_id);
+    return false;
+}
+
+// restore the minimum fill of a node by borrowing from a sibling or merging
+// with one, then fix the parent; a root with a single child is collapsed
+void BPTree::handleUnderflow(uint32_t node_id) {
+    NodeEditor node = edit(node_id);
+
+    if (node_id == root_id) {
+        if (!node.isLeaf() && node.size() == 0) {
+            setRoot(node.children()[0]);
+            edit(root_id).header().parent_id = UINT32_MAX;
+            free_node(node_id);
+            levels--;
         }
-        
-        // Also ensure root gets updated
-        if (root_id != UINT32_MAX && !nodes[root_id].header.is_leaf) {
-            updateInternalKeys(root_id);
+        return;
+    }
+    if (!isNodeUnderflow(node_id)) return;
+
+    const uint32_t parent_id = node.header().parent_id;
+    NodeEditor parent = edit(parent_id);
+    const uint32_t* siblings = parent.children();
+    const size_t count = parent.size() + 1;
+    const size_t idx = std::find(siblings, siblings + count, node_id) - siblings;
+    const uint32_t left_id = idx > 0 ? siblings[idx - 1] : UINT32_MAX;
+    const uint32_t right_id = idx + 1 < count ? siblings[idx + 1] : UINT32_MAX;
+
+    // a sibling above the minimum can lend one entry
+    const size_t min_keys = minKeys(node.isLeaf());
+    if (left_id != UINT32_MAX && edit(left_id).size() > min_keys) {
+        borrowFromLeft(node_id, left_id, parent_id, idx - 1);
+        return;
+    }
+    if (right_id != UINT32_MAX && edit(right_id).size() > min_keys) {
+        borrowFromRight(node_id, right_id, parent_id, idx);
+        return;
+    }
+
+    // otherwise both fit in one node
+    if (left_id != UINT32_MAX) {
+        mergeNodes(left_id, node_id, parent_id, idx - 1);
+    } else if (right_id != UINT32_MAX) {
+        mergeNodes(node_id, right_id, parent_id, idx);
+    }
+    handleUnderflow(parent_id);
+}
+
+// keys[sep] of the parent separates the node from its left sibling
+void BPTree::borrowFromLeft(uint32_t node_id, uint32_t left_id, uint32_t parent_id, size_t sep) {
+    NodeEditor node = edit(node_id);
+    NodeEditor left = edit(left_id);
+    NodeEditor parent = edit(parent_id);
+
+    if (node.isLeaf()) {
+        node.insertEntry(0, left.entry(left.size() - 1));
+        left.setSize(left.size() - 1);
+        parent.keys()[sep] = node.keys()[0];
+    } else {
+        // rotate through the parent
+        const uint32_t moved = left.children()[left.size()];
+        node.insertKeyChild(0, parent.keys()[sep], 0, moved);
+        parent.keys()[sep] = left.keys()[left.size() - 1];
+        left.setSize(left.size() - 1);
+        edit(moved).header().parent_id = node_id;
+    }
+}
+
+// keys[sep] of the parent separates the node from its right sibling
+void BPTree::borrowFromRight(uint32_t node_id, uint32_t right_id, uint32_t parent_id, size_t sep) {
+    NodeEditor node = edit(node_id);
+    NodeEditor right = edit(right_id);
+    NodeEditor parent = edit(parent_id);
+
+    if (node.isLeaf()) {
+        node.insertEntry(node.size(), right.entry(0));
+        right.eraseEntry(0);
+        parent.keys()[sep] = right.keys()[0];
+    } else {
+        const uint32_t moved = right.children()[0];
+        node.insertKeyChild(node.size(), parent.keys()[sep], node.size() + 1, moved);
+        parent.keys()[sep] = right.keys()[0];
+        right.eraseKeyChild(0, 0);
+        edit(moved).header().parent_id = node_id;
+    }
+}
+
+// fold the right node into the left one and drop keys[sep] from the parent
+void BPTree::mergeNodes(uint32_t left_id, uint32_t right_id, uint32_t parent_id, size_t sep) {
+    NodeEditor left = edit(left_id);
+    NodeEditor right = edit(right_id);
+    NodeEditor parent = edit(parent_id);
+
+    const size_t ln = left.size(), rn = right.size();
+    if (left.isLeaf()) {
+        std::memcpy(left.keys() + ln, right.keys(), rn * sizeof(float));
+        std::memcpy(left.rids() + ln, right.rids(), rn * sizeof(RID));
+        left.setSize(ln + rn);
+        left.header().next_leaf_id = right.header().next_leaf_id;
+    } else {
+        left.keys()[ln] = parent.keys()[sep];
+        std::memcpy(left.keys() + ln + 1, right.keys(), rn * sizeof(float));
+        std::memcpy(left.children() + ln + 1, right.children(), (rn + 1) * sizeof(uint32_t));
+        if (aggregates) {
+            std::memcpy(left.sums() + ln + 1, right.sums(), (rn + 1) * sizeof(double));
+            std::memcpy(left.counts() + ln + 1, right.counts(), (rn + 1) * sizeof(uint32_t));
+        }
+        left.setSize(ln + 1 + rn);
+        for (size_t i = 0; i <= rn; ++i) {
+            edit(right.children()[i]).header().parent_id = left_id;
         }
     }
+
+    parent.eraseKeyChild(sep, sep + 1);
+    free_node(right_id);
+}
+
+BPTree::DeletionStats BPTree::deleteHighFTPCT(Database& db, double threshold) {
+    if (isReadOnly()) throw std::logic_error("Cannot delete from an index opened read-only");
+    if (isCompressed()) throw std::logic_error("Compressed leaves are bulk-loaded only");
+
+    DeletionStats stats;
+    // both methods select with the same predicate: the scan compares it with
+    // the stored values, the index turns it into key bounds (search)
+    const ColumnPredicate above{Column::FT_PCT_home, CompareOp::GT, threshold};
     
+    // Method 2: Linear scan for comparison, run first so it sees the rows;
+    // a scan has to visit every page to find them (on PAX pages only the
+    // FT_PCT_home minipage is read), spread over every core by the morsel
+    // scan; the page edits that follow are the same batched delete the
+    // index method does
+    auto linear_start = std::chrono::high_resolution_clock::now();
     
-    auto end_time = std::chrono::high_resolution_clock::now();
-    stats.running_time_ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+    // what a scan would hand to the delete
+    const std::vector<RID> linear_matches =
+        ParallelScan(db).where({above}).collect();
     
-    // Method 2: Linear scan for comparison
-    auto linear_start = std::chrono::high_resolution_clock::now();
+    auto linear_end = std::chrono::high_resolution_clock::now();
+    stats.linear_scan_blocks = db.getNumBlocks();
+    const double linear_scan_ms = std::chrono::duration<double, std::milli>(linear_end - linear_start).count();
+    
+    auto start_time = std::chrono::high_resolution_clock::now();
     
-    size_t linear_blocks_accessed = 0;
-    const auto& blocks = db.getBlocks();
-    for (const auto& block : blocks) {
-        bool block_accessed = false;
-        for (size_t i = 0; i < block.getNumRecords(); i++) {
-            const Record& rec = block.getRecord(i);
-            if (rec.FT_PCT_home > threshold) {
-                block_accessed = true;
-                break;
+    // Method 1: Using B+ Tree index; every node the lookup and the removals
+    // read or edit is logged once
+    struct LogVisits {
+        explicit LogVisits(std::vector<uint8_t>& log) { visitLog = &log; }
+        ~LogVisits() { visitLog = nullptr; }
+    };
+    std::vector<uint8_t> visited(nodeCount(), 0);
+    const LogVisits logging(visited);
+    auto records_to_delete = findRecordsMatching(above);
+    
+    // Tombstone the records in the heap file, one visit per affected page
+    auto heap_start = std::chrono::high_resolution_clock::now();
+    const HeapDeleteStats heap = deleteFromDatabase(db, records_to_delete);
+    auto heap_end = std::chrono::high_resolution_clock::now();
+    const double heap_delete_ms = std::chrono::duration<double, std::milli>(heap_end - heap_start).count();
+    stats.data_blocks_accessed = heap.pages_touched;
+    stats.bytes_freed = heap.bytes_freed;
+    
+    // Remove the entries one by one, rebalancing as leaves underflow; the
+    // count and the average FT_PCT both come from the entries removed
+    size_t total_deleted_from_tree = 0;
+    double sum_ft_pct = 0.0;
+    {
+        AggregateUpdate update(*this); // aggregates are fixed up once, after the batch
+        for (const auto& entry : records_to_delete) {
+            ExclusiveWrite scope(*this);
+            if (removeEntry(entry)) {
+                total_deleted_from_tree++;
+                sum_ft_pct += entry.key;
             }
         }
-        if (block_accessed) {
-            linear_blocks_accessed++;
-        }
     }
+    stats.index_nodes_accessed = static_cast<size_t>(std::count(visited.begin(), visited.end(), 1));
     
-    auto linear_end = std::chrono::high_resolution_clock::now();
-    stats.linear_scan_blocks = linear_blocks_accessed;
-    stats.linear_scan_time_ms = std::chrono::duration<double, std::milli>(linear_end - linear_start).count();
+    auto end_time = std::chrono::high_resolution_clock::now();
+    stats.running_time_ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+    stats.linear_scan_time_ms = linear_scan_ms + heap_delete_ms;
+    
+    // the scan must have timed the same result set: its RIDs, in RID order,
+    // against the index's
+    std::vector<RID> index_rids;
+    index_rids.reserve(records_to_delete.size());
+    for (const auto& entry : records_to_delete) index_rids.push_back(entry.rid);
+    std::sort(index_rids.begin(), index_rids.end());
+    stats.linear_scan_matches = linear_matches.size();
+    stats.linear_scan_agrees = index_rids == linear_matches;
     
     // update games deleted count to reflect actual tree deletions
     stats.games_deleted = total_deleted_from_tree;
+    stats.average_ft_pct = total_deleted_from_tree > 0 ? sum_ft_pct / total_deleted_from_tree : 0.0;
     
     return stats;
 }
@@ -1,39 +1,96 @@
 #ifndef BPLUSTREE_H
 #define BPLUSTREE_H
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstddef>
+#include <memory>
+#include <new>
+#include <shared_mutex>
 #include <vector>
 #include <iomanip>
 #include <string>
 
+#include "block.h"
+#include "mappedfile.h"
+#include "bufferpool.h"
+#include "pagefile.h"
+
 class Database;
+class ExternalSorter;
+struct HeapDeleteStats;
 struct Record;
 
 #pragma pack(push, 1)
 // header for a node
 struct NodeHeader {
-    uint8_t is_leaf; // 1 = leaf, 0 = internal
+    uint8_t is_leaf; // 1 = leaf, 0 = internal, NODE_FREE = on the free list
+    uint8_t reserved; // pads the header to 16 bytes, so node keys start 16-byte aligned
     uint16_t key_count; // number of separator keys
     uint32_t self_id;       
     uint32_t parent_id;     
     uint32_t next_leaf_id; // for leaf-level linked list
 };
+
+// page 0 of the index file; node i is stored in page i + 1
+struct IndexSuperblock {
+    char magic[8]; // "DSPBPT"
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t internal_n;
+    uint32_t leaf_capacity;
+    uint32_t root_id;
+    uint32_t levels;
+    uint32_t node_count;
+    uint32_t free_head; // last freed node, UINT32_MAX when none
+    uint32_t leaf_format; // 0 = (key, RID) entries, 1 = posting lists, 2 = packed
+    uint32_t aggregates;  // 1 = internal nodes carry subtree counts and sums
+};
 #pragma pack(pop)
 
-// RID - Record ID: block number, slot number inside the block
-// 4B + 4B = 8B
-struct RID {
-    uint32_t block; //4B
-    uint32_t slot; //4B
-    // define comparison operators
-    bool operator<(const RID& o) const {
-        return block < o.block || (block == o.block && slot < o.slot); // compare based on blocks, then slots
-    }
-    bool operator==(const RID& o) const {
-        return block == o.block && slot == o.slot; // 2 RID equal if the block number AND the slot number is the same
-    }
+// is_leaf value of a freed node; free nodes are chained through next_leaf_id
+static const uint8_t NODE_FREE = 2;
+
+// posting-list leaves (bulk-loaded, read-only): each distinct key once, with
+// its RIDs in (block, slot) order, delta-encoded at a fixed width per list:
+// | header | keys[n] | ends[n] | RID bytes |
+// ends[i] is where key i's bytes end; with POSTING_OVERFLOW set, key i's
+// bytes are instead { first overflow page, RID count }, and the list fills a
+// chain of NODE_OVERFLOW pages linked through next_leaf_id:
+// | header | bytes used (uint32) | width | values |
+// (the byte count is too wide for key_count once pages pass 64 KiB)
+static const uint8_t NODE_POSTING = 3;
+static const uint8_t NODE_OVERFLOW = 4;
+static const uint32_t POSTING_OVERFLOW = 0x80000000u;
+static const size_t OVERFLOW_DATA = sizeof(NodeHeader) + sizeof(uint32_t); // where the width byte is
+
+// quantized keys: three-decimal data such as FT_PCT_home is stored as the
+// 16-bit code k * 1000; code q stands for the float nearest q / 1000, which
+// is the float the text parser made of the same digits, so nothing is lost
+static const uint32_t KEY_SCALE = 1000;
+inline float decode_key(uint16_t code) { return static_cast<float>(code) / static_cast<float>(KEY_SCALE); }
+// false if k is not exactly some decode_key(code)
+bool encode_key(float k, uint16_t& code);
+// first code whose key is >= k (> k when upper), UINT16_MAX + 1 when none; a
+// float bound is mapped once, the node search then compares integers
+uint32_t key_code_bound(float k, bool upper);
+
+// packed trees (bulk-loaded, read-only) keep codes in every node; internal
+// nodes are | header | codes[internal_n - 1] | pad to 4 | children[internal_n] |
+// and a packed leaf stores its RIDs as offsets from the smallest block and
+// slot in it, each offset in as few bytes as the leaf needs:
+// | header | codes[n] | pad to 4 | PackedLeafBase | RIDs[n] |
+static const uint8_t NODE_PACKED = 5;
+
+#pragma pack(push, 1)
+struct PackedLeafBase {
+    uint32_t block;
+    uint16_t slot;
+    uint8_t block_width; // bytes per block offset, 0 when every RID shares the block
+    uint8_t slot_width;
 };
+#pragma pack(pop)
 
 // (key, RID) pairs
 // 4B + 8B = 12B
@@ -42,94 +99,540 @@ struct LeafEntry {
     RID   rid; // (block, slot)
 };
 
-// node representation
-struct BPTNode {
-    NodeHeader header{};
-    std::vector<uint32_t> pointers; // child node ids
-    std::vector<float> keys; // separator keys
-    std::vector<LeafEntry> leaf;
-
-    bool isUnderflow(size_t min_keys) const {
-        if (header.is_leaf) {
-            return leaf.size() < min_keys;
-        } else {
-            return keys.size() < min_keys;
-        }
+// index order: key, then RID; the order is total, so sorting needs no
+// stability
+inline bool entry_less(const LeafEntry& a, const LeafEntry& b) {
+    if (a.key != b.key) return a.key < b.key;
+    return a.rid < b.rid;
+}
+
+// node page layout, NodeHeader first; keys are contiguous in both kinds of
+// node so they can be searched with vector loads:
+// internal: | header | keys[internal_n - 1] | children[internal_n] |
+// leaf:     | header | keys[leaf_capacity] | RID[leaf_capacity] |
+// the same bytes are used in memory and on disk
+
+// node capacities for one page size
+struct NodeCapacities {
+    uint32_t internal_n;    // max number of children
+    uint32_t leaf_capacity; // max number of entries
+};
+
+constexpr NodeCapacities node_capacities(size_t page_size) {
+    // internal node:
+    // (n key) + (n+1 pointer) + headerSize
+    // -4 is the +1 pointer's size
+    // key => 4B, pointer => 4B, so every (key, pointer) is 8B
+    // leaf node:
+    // m entries, each contains (key, RID)
+    // the next leaf pointer is already in the header
+    return NodeCapacities{
+        static_cast<uint32_t>(page_size >= sizeof(NodeHeader) + 12 ? (page_size - sizeof(NodeHeader) - 4) / 8 + 1 : 2),
+        static_cast<uint32_t>(page_size >= sizeof(NodeHeader) + 12 ? (page_size - sizeof(NodeHeader)) / 12 : 1)};
+}
+
+// packed trees: a (code, pointer) pair is 6B, the code array is padded so
+// the children stay 4-byte aligned; a leaf holds at most one code per 2B,
+// when every RID is the same
+constexpr size_t packed_codes_bytes(size_t n) { return (2 * n + 3) / 4 * 4; }
+constexpr NodeCapacities packed_capacities(size_t page_size) {
+    size_t n = page_size >= sizeof(NodeHeader) + 12 ? (page_size - sizeof(NodeHeader) + 2) / 6 : 2;
+    while (n > 2 && sizeof(NodeHeader) + packed_codes_bytes(n - 1) + 4 * n > page_size) --n;
+    return NodeCapacities{
+        static_cast<uint32_t>(n),
+        static_cast<uint32_t>(page_size >= sizeof(NodeHeader) + sizeof(PackedLeafBase) + 8
+                                  ? std::min<size_t>(UINT16_MAX, (page_size - sizeof(NodeHeader) - sizeof(PackedLeafBase)) / 2)
+                                  : 1)};
+}
+
+// the common page sizes are fixed at compile time
+static constexpr NodeCapacities NODE_CAPS_1K = node_capacities(1024);
+static constexpr NodeCapacities NODE_CAPS_2K = node_capacities(2048);
+static constexpr NodeCapacities NODE_CAPS_4K = node_capacities(4096);
+static constexpr NodeCapacities NODE_CAPS_8K = node_capacities(8192);
+static constexpr NodeCapacities NODE_CAPS_16K = node_capacities(16384);
+static_assert(sizeof(NodeHeader) == 16, "node keys must start 16-byte aligned");
+static_assert(NODE_CAPS_4K.internal_n == 510 && NODE_CAPS_4K.leaf_capacity == 340, "4 KiB node layout changed");
+static_assert(NODE_CAPS_16K.leaf_capacity <= UINT16_MAX, "key_count is 16 bits");
+static_assert(packed_capacities(4096).internal_n == 680, "4 KiB packed node layout changed");
+
+// trees with subtree aggregates: after its children an internal node keeps,
+// per child, the sum of the keys and the number of entries under it
+// | header | keys[internal_n - 1] | children[internal_n] | pad to 8 | sums f64[internal_n] | counts u32[internal_n] |
+// a (key, pointer, sum, count) group is 20B; leaves are unchanged
+constexpr size_t aggregate_sums_offset(size_t internal_n) {
+    return (sizeof(NodeHeader) + 8 * internal_n - 4 + 7) / 8 * 8;
+}
+constexpr size_t aggregate_counts_offset(size_t internal_n) {
+    return aggregate_sums_offset(internal_n) + sizeof(double) * internal_n;
+}
+constexpr NodeCapacities aggregate_capacities(size_t page_size) {
+    return NodeCapacities{
+        static_cast<uint32_t>(page_size >= sizeof(NodeHeader) + 40 ? (page_size - sizeof(NodeHeader)) / 20 : 2),
+        node_capacities(page_size).leaf_capacity};
+}
+static_assert(aggregate_capacities(4096).internal_n == 204, "4 KiB aggregate node layout changed");
+
+// read-only handle on one node page, resident in the tree's arena or in a
+// mapped or buffered index file, so search code does not care where the node
+// lives; a buffered page stays pinned while the handle exists
+class NodeRef {
+private:
+    const uint8_t* page = nullptr;
+    uint32_t internal_n = 0;
+    uint32_t leaf_capacity = 0;
+    bool packed = false; // codes instead of float keys, see NODE_PACKED
+    NodeHeader hdr{};
+    PageGuard pin;
+
+    LeafEntry packedEntry(size_t i) const;
+
+public:
+    NodeRef() = default;
+    NodeRef(const uint8_t* p, uint32_t internalN, uint32_t leafCap, bool packedKeys = false);
+    NodeRef(PageGuard guard, uint32_t internalN, uint32_t leafCap, bool packedKeys = false);
+
+    const NodeHeader& header() const { return hdr; }
+    bool isLeaf() const { return hdr.is_leaf != 0; }
+    size_t size() const; // leaf entries or separator keys
+    size_t childCount() const;
+    float key(size_t i) const;
+    uint32_t child(size_t i) const;
+    LeafEntry entry(size_t i) const;
+    // trees with subtree aggregates: entries and key sum under child i
+    uint32_t subtreeCount(size_t i) const;
+    double subtreeSum(size_t i) const;
+    uint32_t nextLeaf() const { return hdr.next_leaf_id; }
+    const float* keyData() const; // separator keys (internal) or entry keys (leaf)
+    const uint16_t* codeData() const; // the same in a packed tree
+    const uint8_t* data() const { return page; }
+
+    bool isPostingLeaf() const { return hdr.is_leaf == NODE_POSTING; }
+    uint32_t postingEnd(size_t i) const;  // ends[i] of a posting leaf
+    const uint8_t* postingData() const;   // start of its RID bytes
+
+    // search over keyData() (codeData() when packed) with the SIMD /
+    // branch-free kernels of keysearch.h
+    size_t lowerBound(float k) const; // first i with key(i) >= k
+    size_t upperBound(float k) const; // first i with key(i) > k
+};
+
+// in-place edits of one resident node page
+class NodeEditor {
+private:
+    uint8_t* page;
+    uint32_t internal_n;
+    uint32_t leaf_capacity;
+    bool packed;
+    bool aggregates;
+
+public:
+    NodeEditor(uint8_t* p, uint32_t internalN, uint32_t leafCap, bool packedKeys = false, bool subtreeAggregates = false)
+        : page(p), internal_n(internalN), leaf_capacity(leafCap), packed(packedKeys), aggregates(subtreeAggregates) {}
+
+    NodeHeader& header() { return *reinterpret_cast<NodeHeader*>(page); }
+    uint8_t* data() { return page; }
+    bool isLeaf() { return header().is_leaf != 0; }
+    size_t size() { return header().key_count; } // leaf entries or separator keys
+    void setSize(size_t n) { header().key_count = static_cast<uint16_t>(n); }
+
+    float* keys() { return reinterpret_cast<float*>(page + sizeof(NodeHeader)); }
+    uint16_t* codes() { return reinterpret_cast<uint16_t*>(page + sizeof(NodeHeader)); } // packed trees
+    uint32_t* children() {
+        return reinterpret_cast<uint32_t*>(page + sizeof(NodeHeader) +
+                                           (packed ? packed_codes_bytes(internal_n - 1) : sizeof(float) * (internal_n - 1)));
+    }
+    RID* rids() { return reinterpret_cast<RID*>(page + sizeof(NodeHeader) + sizeof(float) * leaf_capacity); }
+    // per-child aggregates, trees with subtree aggregates only
+    double* sums() { return reinterpret_cast<double*>(page + aggregate_sums_offset(internal_n)); }
+    uint32_t* counts() { return reinterpret_cast<uint32_t*>(page + aggregate_counts_offset(internal_n)); }
+    LeafEntry entry(size_t i) { return LeafEntry{keys()[i], rids()[i]}; }
+
+    // leaf: shift entries to open / close position pos
+    void insertEntry(size_t pos, const LeafEntry& e);
+    void eraseEntry(size_t pos);
+    // internal: key at index ki and child at index ci go in / out together;
+    // a child's aggregates move with it, a new child's start at zero
+    void insertKeyChild(size_t ki, float key, size_t ci, uint32_t child);
+    void eraseKeyChild(size_t ki, size_t ci);
+};
+
+// resident node pages, one per node id, in slabs of SLAB_NODES pages; a slab
+// never moves, so a node's address stays valid while the arena grows, and
+// every page starts on a cache line; the version words of a slab's nodes
+// (concurrent trees) follow its pages
+class NodeArena {
+private:
+    static const size_t CACHE_LINE = 64;
+    static const size_t SLAB_NODES = 64;
+    struct SlabFree {
+        void operator()(uint8_t* p) const { ::operator delete(p, std::align_val_t(CACHE_LINE)); }
+    };
+
+    std::vector<std::unique_ptr<uint8_t, SlabFree>> slabs;
+    size_t stride = 0; // page size rounded up to a cache line
+    size_t count = 0;
+
+public:
+    void reset(size_t pageSize); // drop every node and switch page size
+    uint32_t append();           // zeroed page, returns its id
+    uint32_t extend(size_t n);   // n pages left as they are, returns the first id
+    size_t size() const { return count; }
+    uint8_t* at(uint32_t id) { return slabs[id / SLAB_NODES].get() + (id % SLAB_NODES) * stride; }
+    const uint8_t* at(uint32_t id) const { return slabs[id / SLAB_NODES].get() + (id % SLAB_NODES) * stride; }
+    std::atomic<uint64_t>& version(uint32_t id) const {
+        return reinterpret_cast<std::atomic<uint64_t>*>(slabs[id / SLAB_NODES].get() + SLAB_NODES * stride)[id % SLAB_NODES];
+    }
+
+    // the slab table must not reallocate while other threads read it, so a
+    // concurrent tree reserves it up front
+    void reserve(size_t nodes) { slabs.reserve((nodes + SLAB_NODES - 1) / SLAB_NODES); }
+    size_t capacity() const { return slabs.capacity() * SLAB_NODES; }
+};
+
+struct BPTree;
+
+// the root id, read by concurrent readers while a writer may swap it; copies
+// and moves of a tree carry it over, those only happen while no other
+// thread uses the tree
+struct RootId : std::atomic<uint32_t> {
+    RootId(uint32_t id = UINT32_MAX) : std::atomic<uint32_t>(id) {}
+    RootId(const RootId& o) : std::atomic<uint32_t>(o.load(std::memory_order_relaxed)) {}
+    RootId& operator=(const RootId& o) {
+        store(o.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
     }
+    RootId& operator=(uint32_t id) {
+        store(id);
+        return *this;
+    }
+};
+
+// streaming result of a lookup: walks the leaf chain one leaf at a time and
+// holds only the current leaf (pinned in buffered mode), so memory stays the
+// same however many entries match; stop calling next() to end early
+class LeafCursor {
+private:
+    const BPTree* tree = nullptr;
+    NodeRef leaf;
+    size_t pos = 0;
+    size_t end = 0;    // entries of the current leaf inside the upper bound
+    bool last = false; // the upper bound ends inside the current leaf
+    bool done = true;
+    bool has_hi = false;
+    bool hi_inclusive = true;
+    float hi = 0.0f;
+
+    // concurrent mode: the entries of a leaf are copied out and checked
+    // against its version; when a writer changed the leaf or the link to
+    // the next one, the cursor seeks again past the last entry it returned
+    bool concurrent = false;
+    bool has_lo = false;
+    bool lo_inclusive = true;
+    float lo = 0.0f;
+    std::vector<LeafEntry> buf;
+    size_t buf_pos = 0;
+    uint32_t leaf_id = UINT32_MAX;
+    uint64_t leaf_version = 0;
+    uint32_t next_id = UINT32_MAX;
+    bool has_last = false;
+    float last_key = 0.0f;
+    std::vector<RID> last_rids; // returned entries with key == last_key
+
+    // posting leaves: the decoded RIDs of key `pos`, a page of them at a
+    // time when they are on overflow pages
+    bool posting_open = false;
+    std::vector<RID> rids;
+    size_t rid_pos = 0;
+    uint64_t prev_rid = 0;
+    float rid_key = 0.0f;
+    NodeRef overflow;
+
+    friend struct BPTree;
+    void enterLeaf(); // sets end / last for a freshly loaded leaf
+    bool nextPosting(LeafEntry& out); // false once key `pos` has no RIDs left
+    void decodeRids(const uint8_t* bytes, size_t size);
+    void decodeOverflow(); // the RIDs of the current overflow page
+    bool copyLeaf(uint32_t id, uint64_t version, float from, bool from_upper);
+    void reseek();
+
+public:
+    LeafCursor() = default;
+    bool next(LeafEntry& out); // false once no entry is left
 };
 
 struct BPTree {
     uint32_t internal_n = 0; //max number of children
     uint32_t leaf_capacity = 0; //max number of entries
+    uint32_t page_size = 0; // bytes per node page
 
-    std::vector<BPTNode> nodes;
-    uint32_t root_id = UINT32_MAX;
+    RootId root_id; // concurrent readers load it with loadRoot
     uint32_t levels = 0;
+    bool posting_leaves = false; // leaves hold posting lists, see NODE_POSTING
+    bool packed_keys = false;    // codes in every node and packed leaves, see NODE_PACKED
+    bool isCompressed() const { return posting_leaves || packed_keys; } // bulk-loaded only
+    bool aggregates = false;     // subtree counts and sums in internal nodes, see setAggregates
 
-    // Task 3: Delete records with FT_PCT_home > 0.9
+    // COUNT / SUM / AVG of the keys of some entries
+    struct RangeAggregate {
+        size_t count = 0;
+        double sum = 0.0;
+        double average() const { return count > 0 ? sum / count : 0.0; }
+    };
+
+    // Task 3: Delete records with FT_PCT_home > 0.9. The node and page
+    // counts are pages touched in memory, not I/O: the resident tree and
+    // heap do not go through a buffer pool
     struct DeletionStats {
         size_t index_nodes_accessed = 0;
-        size_t data_blocks_accessed = 0;
+        size_t data_blocks_accessed = 0; // heap pages the batched delete edited
+        size_t bytes_freed = 0;          // heap page space given back
         size_t games_deleted = 0;
         double average_ft_pct = 0.0;
         double running_time_ms = 0.0;
-        size_t linear_scan_blocks = 0;
+        size_t linear_scan_blocks = 0; // a scan reads every heap page
         double linear_scan_time_ms = 0.0;
+        size_t linear_scan_matches = 0;
+        bool linear_scan_agrees = false; // the scan found exactly the RIDs the index did
     };
 
     void compute_capacities(size_t blockSizeBytes) {
-        const size_t headerSize = sizeof(NodeHeader);
-        // internal node:
-        // (n key) + (n+1 pointer) + headerSize
-        // -4 is the +1 pointer's size
-        // key => 4B, pointer => 4B, so every (key, pointer) is 8B
-        size_t kmax = (blockSizeBytes - headerSize - 4) / 8; 
-        if (kmax < 1) kmax = 1;
-        internal_n = static_cast<uint32_t>(kmax + 1);
-
-        // leaf node:
-        // m entries, each contains (key, RID)
-        // the next leaf pointer is already in the header
-        size_t mmax = (blockSizeBytes - headerSize) / sizeof(LeafEntry);
-        if (mmax < 1) mmax = 1;
-        leaf_capacity = static_cast<uint32_t>(mmax);
+        NodeCapacities caps;
+        switch (blockSizeBytes) {
+            case 1024: caps = NODE_CAPS_1K; break;
+            case 2048: caps = NODE_CAPS_2K; break;
+            case 4096: caps = NODE_CAPS_4K; break;
+            case 8192: caps = NODE_CAPS_8K; break;
+            case 16384: caps = NODE_CAPS_16K; break;
+            default: caps = node_capacities(blockSizeBytes); break;
+        }
+        page_size = static_cast<uint32_t>(blockSizeBytes);
+        internal_n = caps.internal_n;
+        leaf_capacity = caps.leaf_capacity;
+        closeFile();
+        arena.reset(page_size);
+        posting_leaves = false;
+        packed_keys = false;
+        aggregates = false;
     }
 
-    // create a new node
-    uint32_t new_node(bool leaf) {
-        BPTNode n;
-        if (leaf) n.header.is_leaf = 1;
-        else n.header.is_leaf = 0;
-        n.header.key_count = 0;
-        n.header.parent_id = UINT32_MAX; //root, no parent pointer
-        n.header.next_leaf_id = UINT32_MAX; // not leaf, no next leaf pointer
-        uint32_t id = static_cast<uint32_t>(nodes.size());
-        n.header.self_id = id;
-        nodes.push_back(std::move(n));
-        return id;
-    }
+    // keep subtree aggregates in internal nodes, which lowers their fanout
+    // (aggregate_capacities); switch it after compute_capacities, before the
+    // tree is built
+    void setAggregates(bool on);
+
+    // create a new node, reusing a freed id when there is one
+    uint32_t new_node(bool leaf);
+    // append n nodes with consecutive ids and return the first; the pages are
+    // not initialized, the caller writes every one (bulk load)
+    uint32_t new_nodes(size_t n);
+    // put a node on the free list
+    void free_node(uint32_t id);
 
+    // paged index file: superblock page, then one page per node
     void saveToBinaryFile(const std::string& filename) const;
+    IndexSuperblock superblock() const; // page 0 of that file
+    // opening reads only the superblock; a node page is read into the arena
+    // the first time the node is touched
     void loadFromBinaryFile(const std::string& filename);
+    size_t pagesRead() const { return pages_read; } // node pages read on demand since the load
+    // old text dump, kept for debugging
+    void exportToTextFile(const std::string& filename) const;
+    void importFromTextFile(const std::string& filename);
+
+    // read-only mode: nodes are read straight from the mapped pages, only the
+    // superblock is touched when opening
+    void openMapped(const std::string& filename);
+    bool isMapped() const { return mapped.isOpen(); }
+
+    // read-only mode through a buffer pool with the same page size; the pool
+    // must outlive the tree
+    void openBuffered(const std::string& filename, BufferPool& pool);
+    bool isBuffered() const { return pooled.isOpen(); }
+    BufferPool* getBufferPool() const { return pooled.getPool(); }
+    bool isReadOnly() const { return isMapped() || isBuffered(); }
+
+    NodeRef node(uint32_t id) const;
+    NodeEditor edit(uint32_t id) { // resident trees
+        noteVisit(id);
+        if (latch && latch->exclusive) latchForWrite(id);
+        if (aggregate_update) touched.push_back(id);
+        return NodeEditor(residentPage(id), internal_n, leaf_capacity, packed_keys, aggregates);
+    }
+    size_t nodeCount() const { return isReadOnly() ? file_nodes : arena.size(); }
+    // nodes in use, freed ids excluded
+    size_t liveNodeCount() const { return nodeCount() - free_ids.size(); }
+
+    // lookups, valid in every open mode; the tree must not change while a
+    // cursor is in use
+    LeafCursor find(float key) const { return search(CompareOp::EQ, key); }
+    LeafCursor range(float lo, float hi, bool lo_inclusive = true, bool hi_inclusive = true) const {
+        return seek(true, lo, lo_inclusive, true, hi, hi_inclusive);
+    }
+    LeafCursor search(CompareOp op, float key) const;
+    // entries a predicate on FT_PCT_home matches the way a heap scan does:
+    // the bounds are the keys of the lowest and highest stored codes it
+    // admits (predicateCodeRange), so a decimal threshold such as 0.9 picks
+    // the rows the heap filter picks and not those a float 0.9f would
+    LeafCursor search(const ColumnPredicate& pred) const;
+
+    // add one entry, splitting full nodes and growing the root as needed;
+    // equal keys go after the ones already in the tree
+    void insert(float key, RID rid);
+    // remove one entry, rebalancing as needed; false if it is not in the tree
+    bool erase(float key, RID rid);
+
+    // aggregates over the entries of a key range, from the subtree counts and
+    // sums of the nodes on the paths to the two bounds; no leaf is walked
+    RangeAggregate rangeAggregate(float lo, float hi, bool lo_inclusive = true, bool hi_inclusive = true) const;
+    RangeAggregate aggregate(CompareOp op, float key) const;
+    size_t entryCount() const;
+    // entries with a smaller key
+    size_t rank(float key) const { return prefixAggregate(key, false).count; }
+    // the entry at position k of the index order; false if k >= entryCount()
+    bool select(size_t k, LeafEntry& out) const;
+    // nearest-rank percentile, p in [0, 1]; throws on an empty tree
+    float percentile(double p) const;
+
+    // concurrent mode (resident trees): lookups and cursors take no locks,
+    // they validate node versions and restart when a writer got in the way;
+    // an insert or erase that stays inside one leaf latches only that leaf,
+    // splits and merges run one at a time; switch it while no other thread
+    // uses the tree. Node slots are reserved for maxNodes nodes (0: four
+    // times the current count, at least 64Ki); a split past them throws
+    void setConcurrent(bool on, size_t maxNodes = 0);
+    bool isConcurrent() const { return latch != nullptr; }
 
     // Task 3 methods
-    DeletionStats deleteHighFTPCT(Database& db, float threshold = 0.9f);
+    DeletionStats deleteHighFTPCT(Database& db, double threshold = 0.9);
     
 private:
+    MappedFile mapped;
+    mutable PooledFile pooled;
+    uint32_t file_nodes = 0; // nodes in the mapped / pooled file
+    std::vector<uint32_t> free_ids; // freed node ids, reused by new_node
+    mutable NodeArena arena; // resident node pages
+
+    // lazy load: pages not read yet are fetched from the index file on first
+    // touch; the file is closed once every page is resident
+    mutable std::unique_ptr<PageFile> backing;
+    mutable std::vector<uint8_t> loaded; // per node id, empty when all resident
+    mutable size_t unloaded = 0;
+    mutable size_t pages_read = 0;
+
+    // flags id in the calling thread's visit log, if it keeps one
+    // (deleteHighFTPCT counts the distinct nodes it reads or edits)
+    void noteVisit(uint32_t id) const;
+
+    // concurrent mode state
+    struct TreeLatch {
+        std::shared_mutex writers;    // shared: single-leaf writers, exclusive: structure changes
+        bool exclusive = false;       // edit() latches every node it hands out
+        std::vector<uint32_t> held;   // nodes latched by the exclusive writer
+        std::vector<uint8_t> holding; // per node id
+    };
+    class ExclusiveWrite;
+
+    // subtree aggregates: nodes edited by an insert or erase are collected,
+    // their slots and those of their ancestors are recomputed at the end
+    class AggregateUpdate;
+    bool aggregate_update = false;
+    std::vector<uint32_t> touched;
+    void flushAggregates();
+    void requireAggregates() const;
+    RangeAggregate prefixAggregate(float key, bool upper) const; // keys < key (<= key when upper)
+    RangeAggregate boundAggregate(NodeRef n, float key, bool upper, bool suffix) const;
+    std::unique_ptr<TreeLatch> latch;
+    friend class LeafCursor;
+
+    uint32_t loadRoot() const { return root_id.load(std::memory_order_acquire); }
+    void setRoot(uint32_t id) { root_id.store(id, std::memory_order_release); }
+    // node versions: odd while a writer holds the node
+    uint64_t readLatch(uint32_t id) const;
+    bool validate(uint32_t id, uint64_t version) const;
+    void latchForWrite(uint32_t id);
+    void releaseLatches();
+    bool descendOptimistic(float key, bool upper, uint32_t& leaf, uint64_t& version) const;
+    bool tryInsertInLeaf(float key, RID rid);
+    bool tryEraseInLeaf(float key, RID rid, bool& erased);
+
+    uint8_t* residentPage(uint32_t id) const {
+        if (unloaded != 0 && !loaded[id]) faultIn(id);
+        return arena.at(id);
+    }
+    void faultIn(uint32_t id) const;
+    void loadAll() const;
+
+    void closeFile();
+    void applySuperblock(const IndexSuperblock& sb);
+    void rebuildFreeList();
+    void loadFreeList(uint32_t head);
+    LeafCursor seek(bool has_lo, float lo, bool lo_inclusive, bool has_hi, float hi, bool hi_inclusive) const;
+
+    // Helper methods for insertion
+    uint32_t findLeafForInsert(float key) const;
+    void splitLeaf(uint32_t leaf_id, size_t pos, const LeafEntry& entry);
+    void insertIntoParent(uint32_t left_id, float sep, uint32_t right_id);
+
     // Helper methods for deletion
-    std::vector<LeafEntry> findRecordsGreaterThan(float threshold);
-    void deleteFromDatabase(Database& db, const std::vector<LeafEntry>& to_delete);
+    std::vector<LeafEntry> findRecordsMatching(const ColumnPredicate& pred) const;
+    HeapDeleteStats deleteFromDatabase(Database& db, const std::vector<LeafEntry>& to_delete);
+    bool removeEntry(const LeafEntry& entry);
+    uint32_t findLeftmostLeaf(float key) const;
+    size_t minKeys(bool leaf) const { return leaf ? (leaf_capacity + 1) / 2 : (internal_n + 1) / 2 - 1; }
     bool isNodeUnderflow(uint32_t node_id);
     void handleUnderflow(uint32_t node_id);
-    void updateInternalKeys(uint32_t node_id);
-    float findMinKeyInSubtree(uint32_t node_id);
-    float findActualMinKey(uint32_t node_id);
+    void borrowFromLeft(uint32_t node_id, uint32_t left_id, uint32_t parent_id, size_t sep);
+    void borrowFromRight(uint32_t node_id, uint32_t right_id, uint32_t parent_id, size_t sep);
+    void mergeNodes(uint32_t left_id, uint32_t right_id, uint32_t parent_id, size_t sep);
+
+};
+
 
+// one tree level in key order, with the min key under each node, so the
+// level above gets its separators without descending again
+struct NodeLevel {
+    std::vector<uint32_t> ids;
+    std::vector<float> min_keys;
 };
 
+// bulk load, numThreads = 0 uses all cores; the tree comes out the same
+// whatever the thread count
+// collect_pairs_ft_pct replaces out_pairs with the sorted (key, RID) pairs
+void collect_pairs_ft_pct(const Database& db, std::vector<LeafEntry>& out_pairs, unsigned numThreads = 0);
+NodeLevel build_leaves(BPTree& tree, const std::vector<LeafEntry>& pairs, unsigned numThreads = 0);
+NodeLevel build_internal_level(BPTree& tree, const NodeLevel& children, unsigned numThreads = 0);
+// leaves and internal levels above sorted pairs; sets root_id and levels
+void bulk_load(BPTree& tree, const std::vector<LeafEntry>& pairs, unsigned numThreads = 0);
+
+// bulk load through an external sort: the pairs are sorted within the
+// sorter's budget and the leaves are filled straight from its merged
+// stream. The resident tree still holds every node; bulk_load_file is the
+// bounded-memory build
+void collect_pairs_ft_pct(const Database& db, ExternalSorter& sorter);
+NodeLevel build_leaves(BPTree& tree, ExternalSorter& sorted);
+void bulk_load(BPTree& tree, ExternalSorter& sorted, unsigned numThreads = 0);
+
+// bounded-memory bulk load into an index file: leaves are cut from the
+// sorted stream and written as they fill, then each internal level above
+// them. The level sizes follow from the entry count, so every page is
+// written once, in id order, with its parent and next-leaf ids set. Besides
+// the sorter, memory is one page plus a min key and totals per node of the
+// level being built (a few bytes per leaf). layout is an empty tree that
+// gives the page size, capacities and aggregates; (key, RID) leaves only.
+// The file holds the pages bulk_load makes; openBuffered keeps reading it
+// within bounded memory too
+void bulk_load_file(const BPTree& layout, ExternalSorter& sorted, const std::string& filename);
+
+// posting-list leaves over sorted pairs; the tree can be searched and saved
+// but not changed
+NodeLevel build_posting_leaves(BPTree& tree, const std::vector<LeafEntry>& pairs);
+void bulk_load_postings(BPTree& tree, const std::vector<LeafEntry>& pairs, unsigned numThreads = 0);
 
-void collect_pairs_ft_pct(const Database& db, std::vector<LeafEntry>& out_pairs);
-std::vector<uint32_t> build_leaves(BPTree& tree, const std::vector<LeafEntry>& pairs);
-std::vector<uint32_t> build_internal_level(BPTree& tree, const std::vector<uint32_t>& child_ids);
+// packed tree over sorted pairs: switches the tree to packed capacities, so
+// fanout and leaf fill rise; every key must have a code (encode_key), the
+// tree can be searched and saved but not changed
+NodeLevel build_packed_leaves(BPTree& tree, const std::vector<LeafEntry>& pairs);
+void bulk_load_packed(BPTree& tree, const std::vector<LeafEntry>& pairs, unsigned numThreads = 0);
 
 #endif
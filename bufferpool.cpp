@@ -0,0 +1,355 @@
+#include "bufferpool.h"
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+const char* policyName(ReplacementPolicy policy) {
+    switch (policy) {
+        case ReplacementPolicy::LRU: return "LRU";
+        case ReplacementPolicy::CLOCK: return "CLOCK";
+        case ReplacementPolicy::LRU_K: return "LRU-K";
+    }
+    return "?";
+}
+
+// LRU
+
+LRUReplacer::LRUReplacer(size_t numFrames) : pos(numFrames), inList(numFrames, false) {}
+
+void LRUReplacer::recordAccess(size_t) {
+    // recency is taken when the frame becomes evictable again
+}
+
+void LRUReplacer::setEvictable(size_t frame, bool evictable) {
+    if (inList[frame]) {
+        order.erase(pos[frame]);
+        inList[frame] = false;
+    }
+    if (evictable) {
+        order.push_front(frame);
+        pos[frame] = order.begin();
+        inList[frame] = true;
+    }
+}
+
+bool LRUReplacer::evict(size_t& frame) {
+    if (order.empty()) return false;
+    frame = order.back();
+    order.pop_back();
+    inList[frame] = false;
+    return true;
+}
+
+void LRUReplacer::remove(size_t frame) {
+    setEvictable(frame, false);
+}
+
+// CLOCK
+
+ClockReplacer::ClockReplacer(size_t numFrames) : refBit(numFrames, false), evictable(numFrames, false) {}
+
+void ClockReplacer::recordAccess(size_t frame) {
+    refBit[frame] = true;
+}
+
+void ClockReplacer::setEvictable(size_t frame, bool e) {
+    evictable[frame] = e;
+}
+
+bool ClockReplacer::evict(size_t& frame) {
+    // two sweeps are enough: the first clears every reference bit it passes
+    const size_t n = refBit.size();
+    for (size_t step = 0; step < 2 * n; ++step) {
+        const size_t f = hand;
+        hand = (hand + 1) % n;
+        if (!evictable[f]) continue;
+        if (refBit[f]) {
+            refBit[f] = false;
+            continue;
+        }
+        evictable[f] = false;
+        frame = f;
+        return true;
+    }
+    return false;
+}
+
+void ClockReplacer::remove(size_t frame) {
+    refBit[frame] = false;
+    evictable[frame] = false;
+}
+
+// LRU-K
+
+LRUKReplacer::LRUKReplacer(size_t numFrames, size_t kAccesses)
+    : k(kAccesses ? kAccesses : 1), history(numFrames), evictable(numFrames, false) {}
+
+void LRUKReplacer::recordAccess(size_t frame) {
+    auto& h = history[frame];
+    h.push_back(++clock);
+    if (h.size() > k) h.pop_front();
+}
+
+void LRUKReplacer::setEvictable(size_t frame, bool e) {
+    evictable[frame] = e;
+}
+
+bool LRUKReplacer::evict(size_t& frame) {
+    bool found = false;
+    bool bestInfinite = false;
+    uint64_t bestTime = std::numeric_limits<uint64_t>::max();
+
+    for (size_t f = 0; f < history.size(); ++f) {
+        if (!evictable[f]) continue;
+        const auto& h = history[f];
+        const bool infinite = h.size() < k;
+        // h.front() is the k-th most recent access, or the first access when
+        // the frame has fewer than k; the oldest one loses either way
+        const uint64_t t = h.empty() ? 0 : h.front();
+        if (!found || (infinite && !bestInfinite) || (infinite == bestInfinite && t < bestTime)) {
+            found = true;
+            bestInfinite = infinite;
+            bestTime = t;
+            frame = f;
+        }
+    }
+    if (found) remove(frame);
+    return found;
+}
+
+void LRUKReplacer::remove(size_t frame) {
+    history[frame].clear();
+    evictable[frame] = false;
+}
+
+// PageGuard
+
+PageGuard::PageGuard(const PageGuard& o) : pool(o.pool), frame(o.frame), bytes(o.bytes) {
+    if (pool) pool->pinFrame(frame);
+}
+
+PageGuard& PageGuard::operator=(const PageGuard& o) {
+    if (this != &o) {
+        if (o.pool) o.pool->pinFrame(o.frame);
+        release();
+        pool = o.pool;
+        frame = o.frame;
+        bytes = o.bytes;
+    }
+    return *this;
+}
+
+PageGuard::PageGuard(PageGuard&& o) noexcept
+    : pool(std::exchange(o.pool, nullptr)), frame(o.frame), bytes(std::exchange(o.bytes, nullptr)) {}
+
+PageGuard& PageGuard::operator=(PageGuard&& o) noexcept {
+    if (this != &o) {
+        release();
+        pool = std::exchange(o.pool, nullptr);
+        frame = o.frame;
+        bytes = std::exchange(o.bytes, nullptr);
+    }
+    return *this;
+}
+
+void PageGuard::markDirty() {
+    if (pool) pool->markDirty(frame);
+}
+
+void PageGuard::release() {
+    if (pool) pool->unpinFrame(frame);
+    pool = nullptr;
+    bytes = nullptr;
+}
+
+// BufferPool
+
+BufferPool::BufferPool(size_t size, size_t numFrames, ReplacementPolicy p, size_t k)
+    : pageSize(size), memory(size * numFrames), frames(numFrames), policy(p) {
+    if (numFrames == 0) throw std::invalid_argument("Buffer pool needs at least one frame");
+    switch (policy) {
+        case ReplacementPolicy::LRU: replacer = std::make_unique<LRUReplacer>(numFrames); break;
+        case ReplacementPolicy::CLOCK: replacer = std::make_unique<ClockReplacer>(numFrames); break;
+        case ReplacementPolicy::LRU_K: replacer = std::make_unique<LRUKReplacer>(numFrames, k); break;
+    }
+    freeFrames.reserve(numFrames);
+    for (size_t f = numFrames; f-- > 0;) freeFrames.push_back(f);
+}
+
+void BufferPool::pinFrame(size_t frame) {
+    std::lock_guard<std::mutex> lock(latch);
+    pin(frame);
+}
+
+void BufferPool::unpinFrame(size_t frame) {
+    std::lock_guard<std::mutex> lock(latch);
+    unpin(frame);
+}
+
+void BufferPool::markDirty(size_t frame) {
+    std::lock_guard<std::mutex> lock(latch);
+    frames[frame].dirty = true;
+}
+
+void BufferPool::pin(size_t frame) {
+    if (frames[frame].pinCount++ == 0) replacer->setEvictable(frame, false);
+    replacer->recordAccess(frame);
+}
+
+// a frame whose read failed holds no page; the last pin frees it
+void BufferPool::unpin(size_t frame) {
+    if (--frames[frame].pinCount > 0) return;
+    if (frames[frame].file) {
+        replacer->setEvictable(frame, true);
+    } else {
+        replacer->remove(frame);
+        freeFrames.push_back(frame);
+    }
+}
+
+void BufferPool::writeBack(size_t frame) {
+    Frame& fr = frames[frame];
+    if (!fr.dirty) return;
+    fr.file->writePage(fr.page, memory.data() + frame * pageSize);
+    fr.dirty = false;
+    counters.write_backs++;
+}
+
+PageGuard BufferPool::fetchPage(PageFile& file, uint64_t pageNo) {
+    if (file.getPageSize() != pageSize) {
+        throw std::invalid_argument("Page size of " + file.getPath() + " does not match the buffer pool");
+    }
+    std::unique_lock<std::mutex> lock(latch);
+
+    for (;;) {
+        auto it = pageTable.find(PageId{&file, pageNo});
+        if (it == pageTable.end()) break;
+        const size_t frame = it->second;
+        pin(frame); // the frame stays put while we wait for its read
+        loaded.wait(lock, [&] { return !frames[frame].loading; });
+        if (frames[frame].file == &file && frames[frame].page == pageNo) {
+            counters.hits++;
+            return PageGuard(this, frame, memory.data() + frame * pageSize);
+        }
+        unpin(frame); // the read failed, try again
+    }
+
+    size_t frame;
+    if (!freeFrames.empty()) {
+        frame = freeFrames.back();
+        freeFrames.pop_back();
+    } else {
+        if (!replacer->evict(frame)) {
+            throw std::runtime_error("Buffer pool exhausted: every frame is pinned");
+        }
+        writeBack(frame);
+        pageTable.erase(PageId{frames[frame].file, frames[frame].page});
+        counters.evictions++;
+    }
+
+    // claim the frame for the page, then read it with the latch released
+    frames[frame] = Frame{&file, pageNo, 0, false, true};
+    pageTable[PageId{&file, pageNo}] = frame;
+    pin(frame);
+    uint8_t* bytes = memory.data() + frame * pageSize;
+    lock.unlock();
+    try {
+        file.readPage(pageNo, bytes);
+    } catch (...) {
+        // forget the page, so waiters retry and no later discardFile of the
+        // file finds the frame; the last pin frees it
+        lock.lock();
+        pageTable.erase(PageId{&file, pageNo});
+        frames[frame].file = nullptr;
+        frames[frame].loading = false;
+        unpin(frame);
+        loaded.notify_all();
+        throw;
+    }
+    lock.lock();
+    counters.misses++;
+    frames[frame].loading = false;
+    loaded.notify_all();
+    return PageGuard(this, frame, bytes);
+}
+
+void BufferPool::flushAll() {
+    std::lock_guard<std::mutex> lock(latch);
+    for (size_t f = 0; f < frames.size(); ++f) {
+        if (frames[f].file) writeBack(f);
+    }
+    for (size_t f = 0; f < frames.size(); ++f) {
+        if (frames[f].file) frames[f].file->sync();
+    }
+}
+
+void BufferPool::discardFile(const PageFile& file, bool strict) {
+    std::lock_guard<std::mutex> lock(latch);
+    if (strict) {
+        for (const Frame& fr : frames) {
+            if (fr.file == &file && fr.pinCount > 0) {
+                throw std::logic_error("Closing " + file.getPath() + " while its pages are pinned");
+            }
+        }
+    }
+    for (size_t f = 0; f < frames.size(); ++f) {
+        Frame& fr = frames[f];
+        if (fr.file != &file) continue;
+        if (fr.pinCount > 0) {
+            std::cerr << "Closing " << file.getPath() << " while page " << fr.page
+                      << " is pinned, its changes are dropped\n";
+        } else {
+            try {
+                writeBack(f);
+            } catch (const std::exception& e) {
+                if (strict) throw;
+                std::cerr << "Dropping page " << fr.page << " of " << file.getPath() << ": " << e.what() << "\n";
+            }
+        }
+        pageTable.erase(PageId{fr.file, fr.page});
+        if (fr.pinCount > 0) {
+            // the guard still holding it frees it (unpin of a frame with no file)
+            fr.file = nullptr;
+            fr.dirty = false;
+            continue;
+        }
+        replacer->remove(f);
+        fr = Frame{};
+        freeFrames.push_back(f);
+    }
+}
+
+// PooledFile
+
+PooledFile::PooledFile(BufferPool& p, const std::string& filename)
+    : pool(&p), file(std::make_unique<PageFile>(filename, p.getPageSize())) {}
+
+PooledFile& PooledFile::operator=(PooledFile&& o) noexcept {
+    if (this != &o) {
+        release();
+        pool = o.pool;
+        file = std::move(o.file);
+    }
+    return *this;
+}
+
+void PooledFile::close() {
+    if (pool && file) {
+        pool->discardFile(*file);
+        file->sync();
+    }
+    file.reset();
+}
+
+void PooledFile::release() noexcept {
+    if (pool && file) {
+        try {
+            pool->discardFile(*file, false);
+            file->sync();
+        } catch (const std::exception& e) {
+            std::cerr << "Closing " << file->getPath() << ": " << e.what() << "\n";
+        }
+    }
+    file.reset();
+}
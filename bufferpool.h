@@ -0,0 +1,216 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include "pagefile.h"
+#include <cstddef>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+enum class ReplacementPolicy { LRU, CLOCK, LRU_K };
+
+const char* policyName(ReplacementPolicy policy);
+
+// chooses which unpinned frame to give up when the pool is full
+class Replacer {
+public:
+    virtual ~Replacer() = default;
+    virtual void recordAccess(size_t frame) = 0;                // frame was pinned
+    virtual void setEvictable(size_t frame, bool evictable) = 0; // pin count hit / left zero
+    virtual bool evict(size_t& frame) = 0;                       // pick a victim, false if none
+    virtual void remove(size_t frame) = 0;                       // frame emptied, drop its history
+};
+
+// least recently unpinned frame goes first
+class LRUReplacer : public Replacer {
+private:
+    std::list<size_t> order; // front = most recent
+    std::vector<std::list<size_t>::iterator> pos;
+    std::vector<bool> inList;
+
+public:
+    explicit LRUReplacer(size_t numFrames);
+    void recordAccess(size_t frame) override;
+    void setEvictable(size_t frame, bool evictable) override;
+    bool evict(size_t& frame) override;
+    void remove(size_t frame) override;
+};
+
+// second chance: a reference bit per frame and a sweeping hand
+class ClockReplacer : public Replacer {
+private:
+    std::vector<bool> refBit;
+    std::vector<bool> evictable;
+    size_t hand = 0;
+
+public:
+    explicit ClockReplacer(size_t numFrames);
+    void recordAccess(size_t frame) override;
+    void setEvictable(size_t frame, bool e) override;
+    bool evict(size_t& frame) override;
+    void remove(size_t frame) override;
+};
+
+// evicts the frame with the largest backward k-distance; frames seen fewer
+// than k times count as infinitely distant and fall back to plain LRU,
+// so one sequential scan cannot flush the hot pages
+class LRUKReplacer : public Replacer {
+private:
+    size_t k;
+    uint64_t clock = 0;
+    std::vector<std::deque<uint64_t>> history; // last k access times, oldest first
+    std::vector<bool> evictable;
+
+public:
+    LRUKReplacer(size_t numFrames, size_t k);
+    void recordAccess(size_t frame) override;
+    void setEvictable(size_t frame, bool e) override;
+    bool evict(size_t& frame) override;
+    void remove(size_t frame) override;
+};
+
+struct BufferPoolStats {
+    size_t hits = 0;
+    size_t misses = 0;     // pages read from disk
+    size_t evictions = 0;
+    size_t write_backs = 0; // dirty pages written to disk
+
+    double hitRatio() const {
+        const size_t total = hits + misses;
+        return total ? static_cast<double>(hits) / total : 0.0;
+    }
+};
+
+class BufferPool;
+
+// pin on one buffered page; the frame stays resident while any guard on it
+// is alive, copying a guard pins the page again
+class PageGuard {
+private:
+    BufferPool* pool = nullptr;
+    size_t frame = 0;
+    uint8_t* bytes = nullptr;
+
+public:
+    PageGuard() = default;
+    PageGuard(BufferPool* p, size_t f, uint8_t* d) : pool(p), frame(f), bytes(d) {}
+    PageGuard(const PageGuard& o);
+    PageGuard& operator=(const PageGuard& o);
+    PageGuard(PageGuard&& o) noexcept;
+    PageGuard& operator=(PageGuard&& o) noexcept;
+    ~PageGuard() { release(); }
+
+    uint8_t* data() const { return bytes; }
+    bool valid() const { return bytes != nullptr; }
+    void markDirty();
+    void release();
+};
+
+// fixed number of page frames shared by every file that goes through it.
+// Only the buffered opens use it: Database::openBuffered (scans and
+// deletes, no inserts) and the read-only BPTree::openBuffered. Resident
+// databases and trees keep every page in memory and never touch a pool.
+// One latch serializes the page table, the replacer and pin counts, so
+// threads may fetch and release pages concurrently. A miss claims its frame
+// under the latch and reads the page without it, so other threads' hits and
+// misses go on meanwhile; a thread that wants a page still being read
+// waits for that read
+class BufferPool {
+private:
+    struct PageId {
+        const PageFile* file;
+        uint64_t page;
+        bool operator==(const PageId& o) const { return file == o.file && page == o.page; }
+    };
+    struct PageIdHash {
+        size_t operator()(const PageId& id) const {
+            return std::hash<const void*>()(id.file) ^ (std::hash<uint64_t>()(id.page) * 0x9e3779b97f4a7c15ULL);
+        }
+    };
+    struct Frame {
+        PageFile* file = nullptr;
+        uint64_t page = 0;
+        int pinCount = 0;
+        bool dirty = false;
+        bool loading = false; // being read by the thread that missed on it
+    };
+
+    size_t pageSize;
+    std::vector<uint8_t> memory; // numFrames * pageSize, frame i at i * pageSize
+    std::vector<Frame> frames;
+    std::vector<size_t> freeFrames;
+    std::unordered_map<PageId, size_t, PageIdHash> pageTable;
+    std::unique_ptr<Replacer> replacer;
+    ReplacementPolicy policy;
+    BufferPoolStats counters;
+    mutable std::mutex latch;
+    std::condition_variable loaded; // a frame stopped loading
+
+    friend class PageGuard;
+    // PageGuard entry points, they take the latch
+    void pinFrame(size_t frame);
+    void unpinFrame(size_t frame);
+    void markDirty(size_t frame);
+    // latch held
+    void pin(size_t frame);
+    void unpin(size_t frame);
+    void writeBack(size_t frame);
+
+public:
+    BufferPool(size_t pageSize, size_t numFrames, ReplacementPolicy policy = ReplacementPolicy::LRU, size_t k = 2);
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    PageGuard fetchPage(PageFile& file, uint64_t pageNo);
+    void flushAll();
+    // flush and forget every page of a file being closed. strict: a pinned
+    // page throws before anything changes, and so does a failed write-back.
+    // Otherwise (destructors) nothing throws: a pinned frame is detached from
+    // the file and freed by its last unpin, and a page whose write-back fails
+    // is dropped; both are reported on stderr
+    void discardFile(const PageFile& file, bool strict = true);
+
+    size_t getPageSize() const { return pageSize; }
+    size_t getNumFrames() const { return frames.size(); }
+    ReplacementPolicy getPolicy() const { return policy; }
+    BufferPoolStats stats() const {
+        std::lock_guard<std::mutex> lock(latch);
+        return counters;
+    }
+    void resetStats() {
+        std::lock_guard<std::mutex> lock(latch);
+        counters = BufferPoolStats{};
+    }
+};
+
+// a page file attached to a pool; its pages are flushed and dropped from the
+// pool when the attachment goes away, so no frame outlives its file
+class PooledFile {
+private:
+    BufferPool* pool = nullptr;
+    std::unique_ptr<PageFile> file;
+
+    void release() noexcept; // close() for the destructor and move-assign
+
+public:
+    PooledFile() = default;
+    PooledFile(BufferPool& p, const std::string& filename);
+    ~PooledFile() { release(); }
+
+    PooledFile(PooledFile&& o) noexcept : pool(o.pool), file(std::move(o.file)) {}
+    PooledFile& operator=(PooledFile&& o) noexcept;
+
+    // throws if a page of the file is still pinned or cannot be written back
+    void close();
+    bool isOpen() const { return file != nullptr; }
+    PageGuard fetch(uint64_t pageNo) { return pool->fetchPage(*file, pageNo); }
+    BufferPool* getPool() const { return file ? pool : nullptr; }
+};
+
+#endif
@@ -1,8 +1,15 @@
 #include "databasefile.h"
 #include "record.h"
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
+#include <utility>
 
 Database::Database(size_t blkSize)
     : blockSize(blkSize), recordSize(0), totalRecords(0) {}
@@ -13,11 +20,14 @@ void Database::loadFromFile(const std::string &filename) {
         throw std::runtime_error("Cannot open file: " + filename);
     }
 
+    // appending parsed rows needs resident blocks
+    closeFile();
+
     std::string line;
     // Skip header row
     if (!std::getline(file, line)) return;
 
-    Block currentBlock(blockSize);
+    Block currentBlock(blockSize, pageLayout);
 
     while (std::getline(file, line)) {
         if (line.empty()) continue;  // skip blank lines
@@ -29,10 +39,12 @@ void Database::loadFromFile(const std::string &filename) {
                 recordSize = r.size(); // record size from first real record
             }
 
-            if (!currentBlock.addRecord(r)) {
-                blocks.push_back(currentBlock);
-                currentBlock = Block(blockSize);
-                currentBlock.addRecord(r);
+            if (!currentBlock.addRecord(r, teams)) {
+                blocks.push_back(std::move(currentBlock));
+                currentBlock = Block(blockSize, pageLayout);
+                if (!currentBlock.addRecord(r, teams)) {
+                    throw std::runtime_error("Record does not fit an empty block");
+                }
             }
 
             ++totalRecords;
@@ -43,13 +55,268 @@ void Database::loadFromFile(const std::string &filename) {
     }
 
     if (currentBlock.getNumRecords() > 0) {
-        blocks.push_back(currentBlock);
+        blocks.push_back(std::move(currentBlock));
     }
+    catalog.rebuildAll(*this);
 }
 
+IngestStats Database::bulkLoadFromFile(const std::string &filename, unsigned numThreads) {
+    IngestStats stats;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    MappedFile input(filename);
+    const char *data = reinterpret_cast<const char *>(input.data());
+    const char *end = data + input.size();
+
+    // Skip header row
+    const char *body = static_cast<const char *>(std::memchr(data, '\n', input.size()));
+    body = body ? body + 1 : end;
+
+    // split the body into line-aligned chunks, no smaller than 64 KiB each
+    const size_t minChunk = 64 * 1024;
+    const size_t bodySize = static_cast<size_t>(end - body);
+    const unsigned threads = threadsFor(bodySize, minChunk, numThreads);
+    stats.threads = threads;
+
+    std::vector<const char *> cuts(threads + 1, end);
+    cuts[0] = body;
+    for (unsigned t = 1; t < threads; ++t) {
+        const char *p = std::max(cuts[t - 1], body + bodySize * t / threads);
+        const char *nl = static_cast<const char *>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+        cuts[t] = nl ? nl + 1 : end;
+    }
+
+    // phase 1: parse every chunk in parallel
+    struct Chunk {
+        std::vector<Record> rows;
+        size_t skipped = 0;
+    };
+    std::vector<Chunk> chunks(threads);
+    runParallel(threads, [&](unsigned t) {
+        Chunk &c = chunks[t];
+        c.rows.reserve(static_cast<size_t>(cuts[t + 1] - cuts[t]) / 40 + 1);
+        Record r;
+        for (const char *p = cuts[t]; p < cuts[t + 1];) {
+            const char *nl = static_cast<const char *>(std::memchr(p, '\n', static_cast<size_t>(cuts[t + 1] - p)));
+            const char *lineEnd = nl ? nl : cuts[t + 1];
+            const char *next = nl ? nl + 1 : cuts[t + 1];
+            if (lineEnd > p && lineEnd[-1] == '\r') --lineEnd;
+            if (lineEnd > p) {
+                if (Record::parseLine(p, lineEnd, r)) c.rows.push_back(r);
+                else c.skipped++;
+            }
+            p = next;
+        }
+    });
+
+    // phase 2: records are fixed width, so block b simply holds rows
+    // [b * perBlock, (b + 1) * perBlock) in file order; team codes are handed
+    // out here in file order too, so phase 3 only ever looks them up
+    std::vector<size_t> chunkStart(threads + 1, 0);
+    for (unsigned t = 0; t < threads; ++t) {
+        chunkStart[t + 1] = chunkStart[t] + chunks[t].rows.size();
+        stats.skipped += chunks[t].skipped;
+    }
+    const size_t rows = chunkStart[threads];
+    auto rowAt = [&](size_t g) -> const Record & {
+        const size_t t = static_cast<size_t>(std::upper_bound(chunkStart.begin(), chunkStart.end(), g) - chunkStart.begin()) - 1;
+        return chunks[t].rows[g - chunkStart[t]];
+    };
+
+    closeFile();
+    blocks.clear();
+    teams.clear();
+    for (const Chunk &c : chunks) {
+        for (const Record &r : c.rows) teams.intern(r.TEAM_ID_home);
+    }
 
-// store data in dummy binary file 
+    // phase 3: pack the rows of each block range in parallel
+    const size_t perBlock = Block::recordsPerPage(blockSize, pageLayout);
+    const size_t numBlocks = (rows + perBlock - 1) / perBlock;
+    blocks.reserve(numBlocks);
+    for (size_t b = 0; b < numBlocks; ++b) blocks.emplace_back(blockSize, pageLayout);
+
+    std::atomic<bool> overflow{false};
+    runParallel(threads, [&](unsigned t) {
+        const size_t first = numBlocks * t / threads;
+        const size_t last = numBlocks * (t + 1) / threads;
+        for (size_t b = first; b < last; ++b) {
+            const size_t stop = std::min(rows, (b + 1) * perBlock);
+            for (size_t g = b * perBlock; g < stop; ++g) {
+                if (!blocks[b].addRecord(rowAt(g), teams)) {
+                    overflow = true; // recordsPerPage is wrong for this layout
+                    return;
+                }
+            }
+        }
+    });
+    if (overflow) {
+        blocks.clear();
+        throw std::runtime_error("Bulk load: a row does not fit its block");
+    }
+
+    recordSize = rows > 0 ? rowAt(0).size() : 0;
+    totalRecords = rows;
+
+    stats.rows = rows;
+    auto finish = std::chrono::high_resolution_clock::now();
+    stats.seconds = std::chrono::duration<double>(finish - start).count();
+    catalog.rebuildAll(*this);
+    return stats;
+}
+
+
+static const char HEAP_MAGIC[8] = {'D', 'S', 'P', 'H', 'E', 'A', 'P', '\0'};
+static const uint32_t HEAP_VERSION = 5;
+
+// store data as a real paged heap file: one header page, then one page per block
 void Database::saveToBinaryFile(const std::string &filename) const {
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cerr << "Error opening file for writing: " << filename << "\n";
+        return;
+    }
+
+    std::vector<char> headerPage(blockSize, 0);
+    HeapFileHeader h{};
+    std::memcpy(h.magic, HEAP_MAGIC, sizeof(h.magic));
+    h.version = HEAP_VERSION;
+    h.block_size = static_cast<uint32_t>(blockSize);
+    h.record_size = recordSize;
+    h.total_records = totalRecords;
+    h.num_blocks = getNumBlocks();
+    h.num_teams = static_cast<uint32_t>(teams.size());
+    if (sizeof(h) + teams.size() * sizeof(int32_t) > blockSize) {
+        throw std::runtime_error("Team dictionary does not fit the header page");
+    }
+    std::memcpy(headerPage.data(), &h, sizeof(h));
+    std::memcpy(headerPage.data() + sizeof(h), teams.entries().data(), teams.size() * sizeof(int32_t));
+    out.write(headerPage.data(), static_cast<std::streamsize>(blockSize));
+
+    for (size_t b = 0; b < getNumBlocks(); ++b) {
+        const BlockView block = getBlock(b);
+        out.write(reinterpret_cast<const char *>(block.data()), static_cast<std::streamsize>(blockSize));
+    }
+}
+
+// validate the header page and read the team dictionary stored behind it
+static HeapFileHeader readHeaderPage(const uint8_t *page, size_t avail, const std::string &dbFile,
+                                     TeamDictionary &teams) {
+    HeapFileHeader h{};
+    if (avail < sizeof(h)) {
+        throw std::runtime_error("Not a heap file: " + dbFile);
+    }
+    std::memcpy(&h, page, sizeof(h));
+    if (std::memcmp(h.magic, HEAP_MAGIC, sizeof(h.magic)) != 0) {
+        throw std::runtime_error("Not a heap file: " + dbFile);
+    }
+    if (h.version != HEAP_VERSION) {
+        throw std::runtime_error("Unsupported heap file version in " + dbFile);
+    }
+    if (sizeof(h) + h.num_teams * sizeof(int32_t) > std::min<size_t>(avail, h.block_size)) {
+        throw std::runtime_error("Corrupt team dictionary in " + dbFile);
+    }
+    std::vector<int32_t> ids(h.num_teams);
+    std::memcpy(ids.data(), page + sizeof(h), ids.size() * sizeof(int32_t));
+    teams.assign(ids.data(), ids.size());
+    return h;
+}
+
+// read the paged heap file back, whole pages at a time
+void Database::loadFromBinaryFile(const std::string &dbFile) {
+    std::ifstream in(dbFile, std::ios::binary);
+    if (!in) {
+        std::cerr << "Error opening file for reading: " << dbFile << "\n";
+        return;
+    }
+
+    HeapFileHeader peek{};
+    if (!in.read(reinterpret_cast<char *>(&peek), sizeof(peek))) {
+        throw std::runtime_error("Not a heap file: " + dbFile);
+    }
+    std::vector<uint8_t> headerPage(std::max<size_t>(peek.block_size, sizeof(peek)));
+    in.seekg(0);
+    in.read(reinterpret_cast<char *>(headerPage.data()), static_cast<std::streamsize>(headerPage.size()));
+    closeFile();
+    const HeapFileHeader h = readHeaderPage(headerPage.data(), static_cast<size_t>(in.gcount()), dbFile, teams);
+
+    blockSize = h.block_size;
+    recordSize = h.record_size;
+    totalRecords = h.total_records;
+
+    blocks.clear();
+    blocks.reserve(h.num_blocks);
+
+    std::vector<uint8_t> buf(blockSize);
+    in.seekg(static_cast<std::streamoff>(blockSize));
+    for (uint64_t b = 0; b < h.num_blocks; ++b) {
+        if (!in.read(reinterpret_cast<char *>(buf.data()), static_cast<std::streamsize>(blockSize))) {
+            throw std::runtime_error("Truncated heap file: " + dbFile);
+        }
+        blocks.emplace_back(blockSize, buf.data());
+    }
+    adoptPageLayout();
+    catalog.rebuildAll(*this);
+}
+
+void Database::openMapped(const std::string &dbFile) {
+    MappedFile file(dbFile);
+
+    TeamDictionary dict;
+    const HeapFileHeader h = readHeaderPage(file.data(), file.size(), dbFile, dict);
+    if (file.size() < (h.num_blocks + 1) * h.block_size) {
+        throw std::runtime_error("Truncated heap file: " + dbFile);
+    }
+
+    closeFile();
+    teams = std::move(dict);
+    blockSize = h.block_size;
+    recordSize = h.record_size;
+    totalRecords = h.total_records;
+    blocks.clear();
+    fileBlocks = h.num_blocks;
+    mapped = std::move(file);
+    adoptPageLayout();
+    catalog.rebuildAll(*this);
+}
+
+void Database::openBuffered(const std::string &dbFile, BufferPool &pool) {
+    PooledFile file(pool, dbFile);
+
+    TeamDictionary dict;
+    HeapFileHeader h;
+    {
+        PageGuard headerPage = file.fetch(0);
+        h = readHeaderPage(headerPage.data(), pool.getPageSize(), dbFile, dict);
+    }
+    if (h.block_size != pool.getPageSize()) {
+        throw std::runtime_error("Block size of " + dbFile + " does not match the buffer pool page size");
+    }
+
+    closeFile();
+    teams = std::move(dict);
+    blockSize = h.block_size;
+    recordSize = h.record_size;
+    totalRecords = h.total_records;
+    blocks.clear();
+    fileBlocks = h.num_blocks;
+    pooled = std::move(file);
+    adoptPageLayout();
+    catalog.rebuildAll(*this);
+}
+
+void Database::adoptPageLayout() {
+    if (getNumBlocks() > 0) pageLayout = getBlock(0).layout();
+}
+
+void Database::closeFile() {
+    mapped.close();
+    pooled.close();
+    fileBlocks = 0;
+}
+
+// dump data as the old pipe-delimited text file
+void Database::exportToTextFile(const std::string &filename) const {
     std::ofstream out(filename); 
     if (!out) {
         std::cerr << "Error opening file for writing: " << filename << "\n";
@@ -60,17 +327,19 @@ void Database::saveToBinaryFile(const std::string &filename) const {
     out << blockSize << "\n";
     out << recordSize << "\n"; 
     out << totalRecords << "\n";
-    out << blocks.size() << "\n";
+    out << getNumBlocks() << "\n";
 
     // write blocks
-    for (const auto& block : blocks) {
+    for (size_t b = 0; b < getNumBlocks(); ++b) {
+        const BlockView block = getBlock(b);
         out << block.getNumRecords() << "\n";
 
-        for (size_t i = 0; i < block.getNumRecords(); ++i) {
-            const Record& r = block.getRecord(i);
+        for (size_t i = 0; i < block.getNumSlots(); ++i) {
+            if (!block.isLive(i)) continue;
+            const Record r = block.getRecord(i);
 
             // write all fields separated by |
-            out << r.GAME_DATE_EST << "|"
+            out << formatDate(r.GAME_DATE_EST) << "|"
                 << r.TEAM_ID_home << "|"
                 << r.PTS_home << "|"
                 << r.FG_PCT_home << "|"
@@ -83,8 +352,8 @@ void Database::saveToBinaryFile(const std::string &filename) const {
     }
 }
 
-// load binary file to test that it is working
-void Database::loadFromBinaryFile(const std::string &dbFile) {
+// load a text dump written by exportToTextFile
+void Database::importFromTextFile(const std::string &dbFile) {
     std::ifstream in(dbFile);  
     if (!in) {
         std::cerr << "Error opening file for reading: " << dbFile << "\n";
@@ -97,7 +366,9 @@ void Database::loadFromBinaryFile(const std::string &dbFile) {
     size_t numBlocks = 0;
     in >> numBlocks;
 
+    closeFile();
     blocks.clear();
+    teams.clear();
     blocks.reserve(numBlocks);
 
     std::string line;
@@ -108,7 +379,7 @@ void Database::loadFromBinaryFile(const std::string &dbFile) {
         in >> numRecs;
         std::getline(in, line); 
 
-        Block block(blockSize);
+        Block block(blockSize, pageLayout);
         for (size_t i = 0; i < numRecs; ++i) {
             std::getline(in, line);
             if (line.empty()) continue;
@@ -120,7 +391,10 @@ void Database::loadFromBinaryFile(const std::string &dbFile) {
             
             // parse data
             nextPos = line.find('|', pos);
-            r.GAME_DATE_EST = line.substr(pos, nextPos - pos);
+            const std::string date = line.substr(pos, nextPos - pos);
+            if (!parseDate(date.data(), date.data() + date.size(), r.GAME_DATE_EST)) {
+                throw std::runtime_error("Bad date in text dump: " + date);
+            }
             pos = nextPos + 1;
 
             nextPos = line.find('|', pos);
@@ -153,10 +427,19 @@ void Database::loadFromBinaryFile(const std::string &dbFile) {
 
             r.HOME_TEAM_WINS = std::stoi(line.substr(pos));
 
-            block.addRecord(r);
+            // dumps from before the paged format packed more rows per block
+            // than fit in a real page, so spill into a fresh block if needed
+            if (!block.addRecord(r, teams)) {
+                blocks.push_back(std::move(block));
+                block = Block(blockSize, pageLayout);
+                if (!block.addRecord(r, teams)) {
+                    throw std::runtime_error("Record does not fit an empty block");
+                }
+            }
         }
         blocks.push_back(block);
     }
+    catalog.rebuildAll(*this);
 }
 
 
@@ -170,10 +453,130 @@ size_t Database::getTotalRecords() const {
 
 size_t Database::getRecordsPerBlock() const {
     if (recordSize == 0) return 0;
-    return blockSize / recordSize;
+    return Block::recordsPerPage(blockSize, pageLayout);
 }
 
 size_t Database::getNumBlocks() const {
-    return blocks.size();
+    return (isMapped() || isBuffered()) ? fileBlocks : blocks.size();
+}
+
+BlockView Database::getBlock(size_t idx) const {
+    if (isMapped()) {
+        return BlockView(mapped.data() + (idx + 1) * blockSize, blockSize, &teams);
+    }
+    if (isBuffered()) {
+        return BlockView(pooled.fetch(idx + 1), blockSize, &teams);
+    }
+    return blocks[idx].view(&teams);
+}
+
+
+// tombstone the rids of one page, rids[first, last) all name that page
+static size_t deleteFromPage(uint8_t *page, size_t blockSize, const std::vector<RID> &rids,
+                             size_t first, size_t last, HeapDeleteStats &stats) {
+    const size_t freeBefore = BlockView(page, blockSize, nullptr).getFreeSpace();
+    BlockEditor editor(page, blockSize);
+    size_t deleted = 0;
+    for (size_t i = first; i < last; ++i) {
+        if (rids[i].slot < NO_SLOT && editor.deleteRecord(static_cast<uint16_t>(rids[i].slot))) {
+            ++deleted;
+        }
+    }
+    if (deleted > 0) {
+        stats.records += deleted;
+        stats.pages_touched++;
+        stats.bytes_freed += BlockView(page, blockSize, nullptr).getFreeSpace() - freeBefore;
+    }
+    return deleted;
 }
 
+HeapDeleteStats Database::deleteRecords(std::vector<RID> rids) {
+    if (isMapped()) {
+        throw std::logic_error("Cannot delete from a heap file opened read-only");
+    }
+
+    HeapDeleteStats stats;
+    std::sort(rids.begin(), rids.end());
+    rids.erase(std::unique(rids.begin(), rids.end()), rids.end());
+
+    const size_t numBlocks = getNumBlocks();
+    for (size_t first = 0; first < rids.size();) {
+        const uint32_t b = rids[first].block;
+        size_t last = first;
+        while (last < rids.size() && rids[last].block == b) ++last;
+        if (b >= numBlocks) {
+            throw std::out_of_range("RID names a block past the end of the heap file");
+        }
+
+        // the indexes need the keys, read them before the slots go dead
+        if (!catalog.empty()) {
+            const BlockView view = getBlock(b);
+            for (size_t i = first; i < last; ++i) {
+                if (view.isLive(rids[i].slot)) catalog.onDelete(view.getRecord(rids[i].slot), rids[i]);
+            }
+        }
+
+        if (isBuffered()) {
+            PageGuard page = pooled.fetch(b + 1);
+            if (deleteFromPage(page.data(), blockSize, rids, first, last, stats) > 0) {
+                page.markDirty();
+            }
+        } else {
+            deleteFromPage(blocks[b].data(), blockSize, rids, first, last, stats);
+        }
+        first = last;
+    }
+    totalRecords -= stats.records;
+
+    // keep the header page's record count in step with the pooled pages
+    if (isBuffered() && stats.records > 0) {
+        PageGuard header = pooled.fetch(0);
+        const uint64_t total = totalRecords;
+        std::memcpy(header.data() + offsetof(HeapFileHeader, total_records), &total, sizeof(total));
+        header.markDirty();
+    }
+    return stats;
+}
+
+RID Database::insertRecord(const Record &record) {
+    if (isMapped() || isBuffered()) {
+        throw std::logic_error("Records are inserted into resident databases only");
+    }
+    uint16_t slot = 0;
+    if (blocks.empty() || !blocks.back().addRecord(record, teams, &slot)) {
+        blocks.emplace_back(blockSize, pageLayout);
+        if (!blocks.back().addRecord(record, teams, &slot)) {
+            throw std::runtime_error("Record does not fit an empty block");
+        }
+    }
+    if (recordSize == 0) recordSize = record.size();
+    ++totalRecords;
+
+    const RID rid{static_cast<uint32_t>(blocks.size() - 1), slot};
+    catalog.onInsert(record, rid);
+    return rid;
+}
+
+std::vector<RID> Database::selectWhere(const std::vector<ColumnPredicate> &where, ScanStats *stats) const {
+    std::vector<RID> out;
+    const ColumnFilter filter(where, teams);
+    std::vector<uint64_t> bits;
+    ScanStats local;
+    for (size_t b = 0; b < getNumBlocks() && !filter.never(); ++b) {
+        const BlockView block = getBlock(b);
+        local.pages++;
+        if (!block.mayMatch(filter)) {
+            local.pages_skipped++;
+            continue;
+        }
+        if (block.select(filter, bits) == 0) continue;
+        for (size_t w = 0; w < bits.size(); ++w) {
+            for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+                const size_t slot = w * 64 + static_cast<size_t>(__builtin_ctzll(word));
+                out.push_back(RID{static_cast<uint32_t>(b), static_cast<uint32_t>(slot)});
+            }
+        }
+    }
+    if (stats) *stats = local;
+    return out;
+}
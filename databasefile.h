@@ -2,27 +2,151 @@
 #define DATABASEFILE_H
 
 #include "block.h"
+#include "mappedfile.h"
+#include "bufferpool.h"
+#include "indexcatalog.h"
+#include <cstdint>
 #include <vector>
 #include <string>
 
+#pragma pack(push, 1)
+// page 0 of the heap file, zero padded to blockSize; page i (i >= 1) is block i - 1
+struct HeapFileHeader {
+    char magic[8];         // "DSPHEAP"
+    uint32_t version;
+    uint32_t block_size;
+    uint64_t record_size;
+    uint64_t total_records;
+    uint64_t num_blocks;
+    uint32_t num_teams;    // TeamDictionary entries (int32 each) right after this header
+};
+#pragma pack(pop)
+
+// result of a bulk load
+struct IngestStats {
+    size_t rows = 0;
+    size_t skipped = 0; // malformed lines
+    unsigned threads = 0;
+    double seconds = 0.0;
+
+    double rowsPerSec() const { return seconds > 0 ? rows / seconds : 0.0; }
+};
+
+// result of a batched heap delete
+struct HeapDeleteStats {
+    size_t records = 0;       // slots tombstoned
+    size_t pages_touched = 0; // distinct pages edited, each visited once
+    size_t bytes_freed = 0;   // growth of those pages' free space
+};
+
+// pages a filtered scan looked at, and how many of them its zone maps ruled out
+struct ScanStats {
+    size_t pages = 0;
+    size_t pages_skipped = 0;
+};
+
 class Database {
 private:
     std::vector<Block> blocks;
     size_t blockSize;
     size_t recordSize;
     size_t totalRecords;
+    TeamDictionary teams;
+    PageLayout pageLayout = PageLayout::Slotted; // of the pages loads and inserts create
+
+    // read-only mapped mode: pages are served straight from the mapping
+    MappedFile mapped;
+    // buffered mode: pages are fetched through a bounded buffer pool (mutable
+    // because fetching a page is a logically const read)
+    mutable PooledFile pooled;
+    size_t fileBlocks = 0; // blocks in the mapped / pooled file
+
+    // secondary indexes, maintained by insertRecord / deleteRecords and
+    // rebuilt whenever a load replaces the heap contents
+    IndexCatalog catalog;
+
+    void closeFile();
+    void adoptPageLayout(); // the layout of an opened heap file's first page
 
 public:
     explicit Database(size_t blockSize);
+    // layout of the pages built from now on (text loads, inserts); a heap
+    // file keeps the layout it was written with, and opening one switches
+    // to it
+    void setPageLayout(PageLayout layout) { pageLayout = layout; }
+    PageLayout getPageLayout() const { return pageLayout; }
     void loadFromFile(const std::string &filename);
+    // parallel loader: maps the input, parses line-aligned chunks on
+    // numThreads threads (0 = all cores) and packs rows straight into their
+    // pages; replaces the current contents, and the block layout is the same
+    // as loadFromFile's whatever the thread count
+    IngestStats bulkLoadFromFile(const std::string &filename, unsigned numThreads = 0);
     void saveToBinaryFile(const std::string &filename) const;
     void loadFromBinaryFile(const std::string &dbFile);
 
+    // old pipe-delimited text dump, kept for debugging and diffing
+    void exportToTextFile(const std::string &filename) const;
+    void importFromTextFile(const std::string &filename);
+
+    // open a heap file written by saveToBinaryFile without reading it; only
+    // the header page is touched here, data pages fault in on first access
+    void openMapped(const std::string &dbFile);
+    bool isMapped() const { return mapped.isOpen(); }
+
+    // open a heap file through a buffer pool, only the pool's frames are
+    // ever resident; the pool must outlive this database
+    void openBuffered(const std::string &dbFile, BufferPool &pool);
+    bool isBuffered() const { return pooled.isOpen(); }
+    BufferPool *getBufferPool() const { return pooled.getPool(); }
+
+    // tombstone every record in rids; rids are sorted by block first so each
+    // affected page is pinned and edited exactly once, dead or duplicate rids
+    // are skipped. Works on resident and buffered databases (pooled pages are
+    // marked dirty and reach the file on flush), mapped ones are read-only
+    HeapDeleteStats deleteRecords(std::vector<RID> rids);
+
+    // append one record to the last block, or to a new one when it is full
+    // (resident databases); every secondary index gets its entry
+    RID insertRecord(const Record &record);
+
+    // full-table filter: RIDs of the live records matching every predicate,
+    // in RID order, from BlockView::select; on PAX pages only the columns
+    // the predicates name are read, and pages whose zone maps rule every
+    // predicate out are skipped after reading the header alone
+    std::vector<RID> selectWhere(const std::vector<ColumnPredicate> &where, ScanStats *stats = nullptr) const;
+
+    // secondary indexes over any key taken from a record; createIndex builds
+    // from a heap scan, saveIndexes writes every index under prefix stamped
+    // with this heap's state, and openIndex declares the same index and loads
+    // its file, which must carry the stamp of this heap (heapStamp)
+    template <typename Key, typename Compare = std::less<Key>>
+    const TypedIndex<Key, Compare> &createIndex(const std::string &name,
+                                                typename TypedIndex<Key, Compare>::Extractor extract,
+                                                Compare cmp = Compare()) {
+        auto index = std::make_unique<TypedIndex<Key, Compare>>(name, std::move(extract), blockSize, cmp);
+        index->build(*this);
+        return static_cast<const TypedIndex<Key, Compare> &>(catalog.add(std::move(index)));
+    }
+    template <typename Key, typename Compare = std::less<Key>>
+    const TypedIndex<Key, Compare> &openIndex(const std::string &name,
+                                              typename TypedIndex<Key, Compare>::Extractor extract,
+                                              const std::string &prefix, Compare cmp = Compare()) {
+        auto index = std::make_unique<TypedIndex<Key, Compare>>(name, std::move(extract), blockSize, cmp);
+        index->load(IndexCatalog::fileFor(prefix, name), heapStamp());
+        return static_cast<const TypedIndex<Key, Compare> &>(catalog.add(std::move(index)));
+    }
+    void saveIndexes(const std::string &prefix) const { catalog.saveAll(prefix, heapStamp()); }
+    bool dropIndex(const std::string &name) { return catalog.drop(name); }
+    const IndexCatalog &indexes() const { return catalog; }
+
     size_t getRecordSize() const;
     size_t getTotalRecords() const;
-    size_t getRecordsPerBlock() const; // average records per block
+    size_t getRecordsPerBlock() const; // records a full block holds
     size_t getNumBlocks() const;
-    const std::vector<Block>& getBlocks() const { 
+    HeapStamp heapStamp() const { return HeapStamp{getTotalRecords(), getNumBlocks()}; }
+    const TeamDictionary &getTeams() const { return teams; }
+    BlockView getBlock(size_t idx) const; // works in every open mode
+    const std::vector<Block>& getBlocks() const { // resident blocks only
         return blocks; 
     }
 };
@@ -0,0 +1,172 @@
+#include "extsort.h"
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+// smallest read buffer of one run while merging; it bounds the fan-in of a
+// merge pass, more runs than that are merged in several passes
+static const size_t MIN_READ_ENTRIES = 256;
+
+ExternalSorter::RunReader::RunReader(Run& run, size_t bufferEntries)
+    : file(run.file.get()), left(run.entries) {
+    buf.reserve(std::max<size_t>(1, std::min(bufferEntries, left)));
+    std::rewind(file);
+}
+
+bool ExternalSorter::RunReader::next(LeafEntry& out) {
+    if (pos == buf.size()) {
+        if (left == 0) return false;
+        const size_t n = std::min(buf.capacity(), left);
+        buf.resize(n);
+        if (std::fread(buf.data(), sizeof(LeafEntry), n, file) != n) {
+            throw std::runtime_error("Short read from an external sort run");
+        }
+        left -= n;
+        pos = 0;
+    }
+    out = buf[pos++];
+    return true;
+}
+
+ExternalSorter::LoserTree::LoserTree(std::vector<Run>& runs, size_t bufferEntries)
+    : heads(runs.size()), live(runs.size(), false), losers(runs.size(), 0) {
+    readers.reserve(runs.size());
+    for (Run& run : runs) readers.emplace_back(run, bufferEntries);
+    for (size_t i = 0; i < readers.size(); ++i) live[i] = readers[i].next(heads[i]);
+    if (!readers.empty()) winner = build(1);
+}
+
+// an exhausted run loses to every other; equal heads go to the lower run
+bool ExternalSorter::LoserTree::beats(size_t a, size_t b) const {
+    if (!live[a]) return false;
+    if (!live[b]) return true;
+    if (entry_less(heads[a], heads[b])) return true;
+    if (entry_less(heads[b], heads[a])) return false;
+    return a < b;
+}
+
+// nodes 1..k-1 are internal, node k + i is run i
+size_t ExternalSorter::LoserTree::build(size_t node) {
+    const size_t k = readers.size();
+    if (node >= k) return node - k;
+    const size_t a = build(2 * node);
+    const size_t b = build(2 * node + 1);
+    if (beats(a, b)) {
+        losers[node] = b;
+        return a;
+    }
+    losers[node] = a;
+    return b;
+}
+
+bool ExternalSorter::LoserTree::next(LeafEntry& out) {
+    if (readers.empty() || !live[winner]) return false;
+    out = heads[winner];
+    live[winner] = readers[winner].next(heads[winner]);
+
+    // replay the winner's path to the root against the stored losers
+    size_t w = winner;
+    for (size_t node = (w + readers.size()) / 2; node >= 1; node /= 2) {
+        if (beats(losers[node], w)) std::swap(losers[node], w);
+    }
+    winner = w;
+    return true;
+}
+
+ExternalSorter::ExternalSorter(size_t memoryBudget) : budget(memoryBudget) {
+    buffer.reserve(budgetEntries());
+}
+
+size_t ExternalSorter::budgetEntries() const {
+    return std::max(2 * MIN_READ_ENTRIES, budget / sizeof(LeafEntry));
+}
+
+ExternalSorter::Run ExternalSorter::newRun() {
+    Run run;
+    run.file.reset(std::tmpfile());
+    if (!run.file) throw std::runtime_error("Cannot create a temp file for an external sort run");
+    return run;
+}
+
+void ExternalSorter::write(Run& run, const LeafEntry* data, size_t n) {
+    if (std::fwrite(data, sizeof(LeafEntry), n, run.file.get()) != n) {
+        throw std::runtime_error("Cannot write an external sort run");
+    }
+    run.entries += n;
+    st.bytesSpilled += n * sizeof(LeafEntry);
+}
+
+// sort the buffer and write it out as one run
+void ExternalSorter::spill() {
+    std::sort(buffer.begin(), buffer.end(), entry_less);
+    Run run = newRun();
+    write(run, buffer.data(), buffer.size());
+    runs.push_back(std::move(run));
+    buffer.clear();
+    st.runs++;
+}
+
+void ExternalSorter::add(const LeafEntry& e) {
+    if (finished) throw std::logic_error("ExternalSorter::add after finish");
+    if (buffer.size() == budgetEntries()) spill();
+    buffer.push_back(e);
+    st.entries++;
+}
+
+void ExternalSorter::finish() {
+    if (finished) return;
+    finished = true;
+
+    // everything fit: the buffer is the result
+    if (runs.empty()) {
+        std::sort(buffer.begin(), buffer.end(), entry_less);
+        return;
+    }
+    if (!buffer.empty()) spill();
+    std::vector<LeafEntry>().swap(buffer);
+
+    // too many runs to give each a read buffer: merge groups of them into
+    // longer runs first; a group shares the budget with its write buffer
+    const size_t fanIn = std::max<size_t>(2, budgetEntries() / MIN_READ_ENTRIES - 1);
+    while (runs.size() > fanIn) {
+        std::vector<Run> merged;
+        for (size_t i = 0; i < runs.size(); i += fanIn) {
+            const size_t end = std::min(runs.size(), i + fanIn);
+            std::vector<Run> group(std::make_move_iterator(runs.begin() + static_cast<std::ptrdiff_t>(i)),
+                                   std::make_move_iterator(runs.begin() + static_cast<std::ptrdiff_t>(end)));
+            if (group.size() == 1) {
+                merged.push_back(std::move(group[0]));
+                continue;
+            }
+            const size_t share = budgetEntries() / (group.size() + 1);
+            LoserTree tree(group, share);
+            Run out = newRun();
+            std::vector<LeafEntry> wbuf;
+            wbuf.reserve(share);
+            LeafEntry e;
+            while (tree.next(e)) {
+                wbuf.push_back(e);
+                if (wbuf.size() == share) {
+                    write(out, wbuf.data(), wbuf.size());
+                    wbuf.clear();
+                }
+            }
+            write(out, wbuf.data(), wbuf.size());
+            merged.push_back(std::move(out));
+        }
+        runs = std::move(merged);
+        st.mergePasses++;
+    }
+
+    merge = std::make_unique<LoserTree>(runs, budgetEntries() / runs.size());
+    st.mergePasses++;
+}
+
+bool ExternalSorter::next(LeafEntry& out) {
+    if (!finished) finish();
+    if (merge) return merge->next(out);
+    if (bufferPos == buffer.size()) return false;
+    out = buffer[bufferPos++];
+    return true;
+}
@@ -0,0 +1,95 @@
+#ifndef EXTSORT_H
+#define EXTSORT_H
+
+#include "bplustree.h"
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+struct ExternalSortStats {
+    size_t entries = 0;
+    size_t runs = 0;          // sorted runs written to temp files
+    size_t mergePasses = 0;   // 0 when everything fit in memory
+    size_t bytesSpilled = 0;  // run bytes written, intermediate passes included
+};
+
+// a std::tmpfile, deleted when closed
+struct FileClose {
+    void operator()(std::FILE* f) const { std::fclose(f); }
+};
+using TempFile = std::unique_ptr<std::FILE, FileClose>;
+
+// sorts (key, RID) pairs in index order within a memory budget: the buffer
+// is sorted and spilled to a temp file as a run whenever it fills, and the
+// runs are k-way merged with a loser tree; runs are read and written
+// sequentially, and the merged stream is handed out by next()
+class ExternalSorter {
+private:
+    struct Run {
+        TempFile file; // deleted when closed
+        size_t entries = 0;
+    };
+
+    // buffered sequential reader of one run
+    class RunReader {
+    private:
+        std::FILE* file = nullptr;
+        size_t left = 0; // entries not read from the file yet
+        std::vector<LeafEntry> buf;
+        size_t pos = 0;
+
+    public:
+        RunReader(Run& run, size_t bufferEntries);
+        bool next(LeafEntry& out);
+    };
+
+    // k-way merge of runs; losers[n] holds the run that lost at internal
+    // node n of the tournament, winner the run whose head is smallest
+    class LoserTree {
+    private:
+        std::vector<RunReader> readers;
+        std::vector<LeafEntry> heads;
+        std::vector<bool> live;
+        std::vector<size_t> losers;
+        size_t winner = 0;
+
+        bool beats(size_t a, size_t b) const;
+        size_t build(size_t node);
+
+    public:
+        LoserTree(std::vector<Run>& runs, size_t bufferEntries);
+        bool next(LeafEntry& out);
+    };
+
+    size_t budget;
+    std::vector<LeafEntry> buffer;
+    size_t bufferPos = 0; // next buffered entry to hand out, when nothing spilled
+    std::vector<Run> runs;
+    std::unique_ptr<LoserTree> merge;
+    bool finished = false;
+    ExternalSortStats st;
+
+    size_t budgetEntries() const;
+    Run newRun();
+    void write(Run& run, const LeafEntry* data, size_t n);
+    void spill();
+
+public:
+    // memoryBudget bytes hold the run buffer while adding and the read
+    // buffers of the runs while merging
+    explicit ExternalSorter(size_t memoryBudget);
+
+    ExternalSorter(const ExternalSorter&) = delete;
+    ExternalSorter& operator=(const ExternalSorter&) = delete;
+
+    void add(const LeafEntry& e);
+    // sort what is left and prepare the merge; no add() after this
+    void finish();
+    // sorted stream, false once every entry was handed out
+    bool next(LeafEntry& out);
+
+    const ExternalSortStats& stats() const { return st; }
+};
+
+#endif
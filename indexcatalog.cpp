@@ -0,0 +1,52 @@
+#include "indexcatalog.h"
+#include "databasefile.h"
+#include <stdexcept>
+
+void forEachRecord(const Database& db, const std::function<void(const Record&, RID)>& fn) {
+    for (size_t b = 0; b < db.getNumBlocks(); ++b) {
+        const BlockView block = db.getBlock(b);
+        for (size_t s = 0; s < block.getNumSlots(); ++s) {
+            if (!block.isLive(s)) continue;
+            fn(block.getRecord(s), RID{static_cast<uint32_t>(b), static_cast<uint32_t>(s)});
+        }
+    }
+}
+
+SecondaryIndex& IndexCatalog::add(std::unique_ptr<SecondaryIndex> index) {
+    if (find(index->name())) throw std::invalid_argument("Index already exists: " + index->name());
+    indexes.push_back(std::move(index));
+    return *indexes.back();
+}
+
+bool IndexCatalog::drop(const std::string& name) {
+    for (auto it = indexes.begin(); it != indexes.end(); ++it) {
+        if ((*it)->name() == name) {
+            indexes.erase(it);
+            return true;
+        }
+    }
+    return false;
+}
+
+SecondaryIndex* IndexCatalog::find(const std::string& name) const {
+    for (const auto& index : indexes) {
+        if (index->name() == name) return index.get();
+    }
+    return nullptr;
+}
+
+void IndexCatalog::saveAll(const std::string& prefix, const HeapStamp& heap) const {
+    for (const auto& index : indexes) index->save(fileFor(prefix, index->name()), heap);
+}
+
+void IndexCatalog::rebuildAll(const Database& db) {
+    for (const auto& index : indexes) index->build(db);
+}
+
+void IndexCatalog::onInsert(const Record& record, RID rid) {
+    for (const auto& index : indexes) index->add(record, rid);
+}
+
+void IndexCatalog::onDelete(const Record& record, RID rid) {
+    for (const auto& index : indexes) index->remove(record, rid);
+}
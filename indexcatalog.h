@@ -0,0 +1,102 @@
+#ifndef INDEXCATALOG_H
+#define INDEXCATALOG_H
+
+#include "indextree.h"
+#include "record.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Database;
+
+// visit every live record of the heap file in RID order, in any open mode
+void forEachRecord(const Database& db, const std::function<void(const Record&, RID)>& fn);
+
+// one secondary index of a catalog; the key type is erased so a catalog can
+// hold indexes over different columns and keep every one in step with the
+// heap file
+class SecondaryIndex {
+private:
+    std::string indexName;
+
+public:
+    explicit SecondaryIndex(std::string name) : indexName(std::move(name)) {}
+    virtual ~SecondaryIndex() = default;
+    const std::string& name() const { return indexName; }
+
+    virtual void build(const Database& db) = 0; // replace the contents from a heap scan
+    virtual void add(const Record& record, RID rid) = 0;
+    virtual bool remove(const Record& record, RID rid) = 0;
+    // heap: the heap file the index is saved / opened against
+    virtual void save(const std::string& filename, const HeapStamp& heap) const = 0;
+    virtual void load(const std::string& filename, const HeapStamp& heap) = 0;
+    virtual size_t size() const = 0; // entries
+};
+
+// secondary index whose key is extracted from each record, e.g. a column
+// or a CompositeKey of two
+template <typename Key, typename Compare = std::less<Key>>
+class TypedIndex : public SecondaryIndex {
+public:
+    using Extractor = std::function<Key(const Record&)>;
+    using Tree = IndexTree<Key, Compare>;
+
+private:
+    Extractor extract;
+    Tree index;
+
+public:
+    TypedIndex(std::string name, Extractor fn, size_t pageSize, Compare cmp = Compare())
+        : SecondaryIndex(std::move(name)), extract(std::move(fn)), index(pageSize, cmp) {}
+
+    const Tree& tree() const { return index; }
+    Key keyOf(const Record& record) const { return extract(record); }
+
+    void build(const Database& db) override {
+        std::vector<typename Tree::Entry> entries;
+        forEachRecord(db, [&](const Record& r, RID rid) { entries.push_back({extract(r), rid}); });
+        index.bulkLoad(std::move(entries));
+    }
+    void add(const Record& record, RID rid) override { index.insert(extract(record), rid); }
+    bool remove(const Record& record, RID rid) override { return index.erase(extract(record), rid); }
+    void save(const std::string& filename, const HeapStamp& heap) const override { index.saveToBinaryFile(filename, heap); }
+    void load(const std::string& filename, const HeapStamp& heap) override { index.loadFromBinaryFile(filename, heap); }
+    size_t size() const override { return index.size(); }
+};
+
+// the secondary indexes of one heap file, by name. Database keeps them in
+// step with its inserts and deletes and rebuilds them when its contents are
+// replaced. An extractor is code, so a saved catalog is reopened by
+// declaring the same indexes and loading their files (Database::openIndex)
+// instead of scanning the heap; a file only opens over the heap state it
+// was saved against
+class IndexCatalog {
+private:
+    std::vector<std::unique_ptr<SecondaryIndex>> indexes;
+
+public:
+    // throws if the name is taken
+    SecondaryIndex& add(std::unique_ptr<SecondaryIndex> index);
+    bool drop(const std::string& name);
+    SecondaryIndex* find(const std::string& name) const;
+    // nullptr when there is no such index or it has another key type
+    template <typename Key, typename Compare = std::less<Key>>
+    const TypedIndex<Key, Compare>* get(const std::string& name) const {
+        return dynamic_cast<const TypedIndex<Key, Compare>*>(find(name));
+    }
+    size_t size() const { return indexes.size(); }
+    bool empty() const { return indexes.empty(); }
+    const std::vector<std::unique_ptr<SecondaryIndex>>& all() const { return indexes; }
+
+    // index `name` is kept in <prefix><name>.idx
+    static std::string fileFor(const std::string& prefix, const std::string& name) { return prefix + name + ".idx"; }
+    void saveAll(const std::string& prefix, const HeapStamp& heap) const;
+
+    void rebuildAll(const Database& db);
+    void onInsert(const Record& record, RID rid);
+    void onDelete(const Record& record, RID rid);
+};
+
+#endif
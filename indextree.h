@@ -0,0 +1,475 @@
+#ifndef INDEXTREE_H
+#define INDEXTREE_H
+
+#include "block.h"
+#include "bplustree.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// (key, RID) entry of a secondary index; entries are ordered by key, then
+// RID, so every entry is distinct even when keys repeat
+template <typename Key>
+struct IndexEntry {
+    Key key;
+    RID rid;
+};
+
+// two-column key ordered by first, then second, e.g.
+// (TEAM_ID_home, GAME_DATE_EST)
+template <typename A, typename B>
+struct CompositeKey {
+    A first;
+    B second;
+
+    bool operator<(const CompositeKey& o) const { return first < o.first || (!(o.first < first) && second < o.second); }
+    bool operator==(const CompositeKey& o) const { return first == o.first && second == o.second; }
+};
+
+// the heap file an index was saved against (Database::heapStamp): an index
+// file is only opened over a heap in the same state, a heap changed since
+// would leave it pointing at the wrong records
+struct HeapStamp {
+    uint64_t records = 0; // live records
+    uint64_t blocks = 0;
+
+    bool operator==(const HeapStamp& o) const { return records == o.records && blocks == o.blocks; }
+};
+
+#pragma pack(push, 1)
+// page 0 of a secondary index file; node i is stored in page i + 1
+struct IndexTreeSuperblock {
+    char magic[8]; // "DSPIDX"
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t key_size; // sizeof(Key), catches opening a file as the wrong key type
+    uint32_t internal_n;
+    uint32_t leaf_capacity;
+    uint32_t root_id;
+    uint32_t levels;
+    uint32_t node_count;
+    uint64_t entries;
+    uint64_t heap_records; // HeapStamp of the heap file
+    uint64_t heap_blocks;
+};
+#pragma pack(pop)
+
+// resident B+ tree over any trivially copyable key type and comparator, for
+// the secondary indexes of the catalog; BPTree stays the tuned float index.
+// Node pages live in a NodeArena like BPTree's:
+// internal: | header | separators[internal_n - 1] | children[internal_n] |
+// leaf:     | header | entries[leaf_capacity] |
+// a separator is the first entry of its right subtree, so duplicate keys
+// may span leaves. An erase does not rebalance: a leaf can run empty and
+// stays in the chain, the separators still bound their subtrees
+template <typename Key, typename Compare = std::less<Key>>
+class IndexTree {
+public:
+    using Entry = IndexEntry<Key>;
+    static_assert(std::is_trivially_copyable<Key>::value, "node pages hold keys by value");
+
+    // streaming lookup result, like LeafCursor; the tree must not change
+    // while a cursor is in use
+    class Cursor {
+    private:
+        const IndexTree* tree = nullptr;
+        uint32_t leaf = UINT32_MAX;
+        size_t pos = 0;
+        bool has_hi = false;
+        bool hi_inclusive = true;
+        Key hi{};
+
+        friend class IndexTree;
+
+    public:
+        Cursor() = default;
+        bool next(Entry& out) { // false once no entry is left
+            while (leaf != UINT32_MAX) {
+                if (pos < tree->size(leaf)) {
+                    out = tree->entryAt(leaf, pos);
+                    if (has_hi && (hi_inclusive ? tree->cmp(hi, out.key) : !tree->cmp(out.key, hi))) {
+                        leaf = UINT32_MAX;
+                        return false;
+                    }
+                    ++pos;
+                    return true;
+                }
+                leaf = tree->header(leaf).next_leaf_id;
+                pos = 0;
+            }
+            return false;
+        }
+    };
+
+    explicit IndexTree(size_t pageSize = 4096, Compare compare = Compare()) : cmp(compare) { reset(pageSize); }
+
+    size_t size() const { return count; } // entries
+    size_t nodeCount() const { return arena.size(); }
+    uint32_t getLevels() const { return levels; }
+    uint32_t fanout() const { return internal_n; }
+    uint32_t leafCapacity() const { return leaf_capacity; }
+
+    void clear() { reset(page_size); }
+
+    // replace the contents with `entries`, sorted here; leaves are filled
+    // completely and every level is built in one pass
+    void bulkLoad(std::vector<Entry> entries) {
+        reset(page_size);
+        std::sort(entries.begin(), entries.end(), [this](const Entry& a, const Entry& b) { return less(a, b); });
+        if (entries.empty()) return;
+
+        std::vector<uint32_t> ids;
+        std::vector<Entry> mins;
+        for (size_t begin = 0; begin < entries.size(); begin += leaf_capacity) {
+            const size_t take = std::min<size_t>(leaf_capacity, entries.size() - begin);
+            const uint32_t id = newNode(true);
+            std::memcpy(slots(id), &entries[begin], take * sizeof(Entry));
+            header(id).key_count = static_cast<uint16_t>(take);
+            if (!ids.empty()) header(ids.back()).next_leaf_id = id;
+            ids.push_back(id);
+            mins.push_back(entries[begin]);
+        }
+        count = entries.size();
+        levels = 1;
+
+        // separators are the min entry of each right child
+        while (ids.size() > 1) {
+            std::vector<uint32_t> up_ids;
+            std::vector<Entry> up_mins;
+            for (size_t begin = 0; begin < ids.size(); begin += internal_n) {
+                const size_t take = std::min<size_t>(internal_n, ids.size() - begin);
+                const uint32_t id = newNode(false);
+                for (size_t j = 0; j < take; ++j) setChild(id, j, ids[begin + j]);
+                for (size_t j = 1; j < take; ++j) setEntry(id, j - 1, mins[begin + j]);
+                header(id).key_count = static_cast<uint16_t>(take - 1);
+                up_ids.push_back(id);
+                up_mins.push_back(mins[begin]);
+            }
+            ids = std::move(up_ids);
+            mins = std::move(up_mins);
+            levels++;
+        }
+        root_id = ids.front();
+    }
+
+    // add one entry, splitting full nodes on the way back up
+    void insert(const Key& key, RID rid) {
+        const Entry e{key, rid};
+        if (root_id == UINT32_MAX) {
+            root_id = newNode(true);
+            levels = 1;
+        }
+        std::vector<uint32_t> path;
+        uint32_t id = root_id;
+        while (!isLeaf(id)) {
+            path.push_back(id);
+            id = child(id, entryBound(id, e));
+        }
+
+        const size_t n = size(id);
+        const size_t pos = leafPosition(id, e);
+        count++;
+        if (n < leaf_capacity) {
+            std::memmove(slots(id) + (pos + 1) * sizeof(Entry), slots(id) + pos * sizeof(Entry), (n - pos) * sizeof(Entry));
+            setEntry(id, pos, e);
+            header(id).key_count = static_cast<uint16_t>(n + 1);
+            return;
+        }
+
+        // split the full leaf: the lower half stays, the rest moves right
+        std::vector<Entry> all(n + 1);
+        std::memcpy(all.data(), slots(id), pos * sizeof(Entry));
+        all[pos] = e;
+        std::memcpy(all.data() + pos + 1, slots(id) + pos * sizeof(Entry), (n - pos) * sizeof(Entry));
+        const size_t mid = all.size() / 2;
+        const uint32_t right = newNode(true);
+        std::memcpy(slots(id), all.data(), mid * sizeof(Entry));
+        std::memcpy(slots(right), all.data() + mid, (all.size() - mid) * sizeof(Entry));
+        header(id).key_count = static_cast<uint16_t>(mid);
+        header(right).key_count = static_cast<uint16_t>(all.size() - mid);
+        header(right).next_leaf_id = header(id).next_leaf_id;
+        header(id).next_leaf_id = right;
+        insertIntoParent(path, id, all[mid], right);
+    }
+
+    // remove one entry; false if it is not in the tree
+    bool erase(const Key& key, RID rid) {
+        if (root_id == UINT32_MAX) return false;
+        const Entry e{key, rid};
+        uint32_t id = root_id;
+        while (!isLeaf(id)) id = child(id, entryBound(id, e));
+
+        const size_t n = size(id);
+        const size_t pos = leafPosition(id, e);
+        if (pos == n || less(e, entryAt(id, pos))) return false;
+        std::memmove(slots(id) + pos * sizeof(Entry), slots(id) + (pos + 1) * sizeof(Entry), (n - pos - 1) * sizeof(Entry));
+        header(id).key_count = static_cast<uint16_t>(n - 1);
+        count--;
+        return true;
+    }
+
+    // lookups, same predicates as BPTree
+    Cursor find(const Key& key) const { return search(CompareOp::EQ, key); }
+    Cursor range(const Key& lo, const Key& hi, bool lo_inclusive = true, bool hi_inclusive = true) const {
+        return seek(&lo, lo_inclusive, &hi, hi_inclusive);
+    }
+    Cursor search(CompareOp op, const Key& key) const {
+        switch (op) {
+        case CompareOp::EQ: return seek(&key, true, &key, true);
+        case CompareOp::LT: return seek(nullptr, true, &key, false);
+        case CompareOp::LE: return seek(nullptr, true, &key, true);
+        case CompareOp::GT: return seek(&key, false, nullptr, true);
+        case CompareOp::GE: return seek(&key, true, nullptr, true);
+        }
+        return Cursor();
+    }
+    Cursor all() const { return seek(nullptr, true, nullptr, true); }
+
+    // paged index file, superblock page then one page per node, the layout
+    // of BPTree's index file; heap is the heap file the entries point into
+    void saveToBinaryFile(const std::string& filename, const HeapStamp& heap) const {
+        std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("Cannot open file for writing: " + filename);
+        std::vector<char> page(page_size, 0);
+        IndexTreeSuperblock sb{};
+        std::memcpy(sb.magic, MAGIC, sizeof(sb.magic));
+        sb.version = VERSION;
+        sb.page_size = page_size;
+        sb.key_size = sizeof(Key);
+        sb.internal_n = internal_n;
+        sb.leaf_capacity = leaf_capacity;
+        sb.root_id = root_id;
+        sb.levels = levels;
+        sb.node_count = static_cast<uint32_t>(arena.size());
+        sb.entries = count;
+        sb.heap_records = heap.records;
+        sb.heap_blocks = heap.blocks;
+        std::memcpy(page.data(), &sb, sizeof(sb));
+        out.write(page.data(), page_size);
+        for (uint32_t id = 0; id < arena.size(); ++id) {
+            out.write(reinterpret_cast<const char*>(arena.at(id)), page_size);
+        }
+        if (!out) throw std::runtime_error("Cannot write index file: " + filename);
+    }
+
+    // throws unless the file was saved against a heap stamped `heap` and its
+    // superblock and node ids hang together, so a foreign, truncated or
+    // stale file is never walked
+    void loadFromBinaryFile(const std::string& filename, const HeapStamp& heap) {
+        std::ifstream in(filename, std::ios::binary | std::ios::ate);
+        if (!in) throw std::runtime_error("Cannot open file for reading: " + filename);
+        const uint64_t bytes = static_cast<uint64_t>(in.tellg());
+        in.seekg(0);
+        IndexTreeSuperblock sb{};
+        if (!in.read(reinterpret_cast<char*>(&sb), sizeof(sb)) || std::memcmp(sb.magic, MAGIC, sizeof(sb.magic)) != 0) {
+            throw std::runtime_error("Not a secondary index file: " + filename);
+        }
+        if (sb.version != VERSION || sb.key_size != sizeof(Key)) {
+            throw std::runtime_error("Unsupported secondary index file: " + filename);
+        }
+        reset(sb.page_size);
+        if (sb.internal_n != internal_n || sb.leaf_capacity != leaf_capacity) {
+            throw std::runtime_error("Node layout of " + filename + " does not match the key type");
+        }
+        if (!(HeapStamp{sb.heap_records, sb.heap_blocks} == heap)) {
+            throw std::runtime_error(filename + " was saved against another state of the heap file");
+        }
+        const bool empty = sb.node_count == 0;
+        if (empty ? sb.root_id != UINT32_MAX || sb.levels != 0
+                  : sb.root_id >= sb.node_count || sb.levels == 0 || sb.levels > sb.node_count) {
+            throw std::runtime_error("Corrupt secondary index superblock: " + filename);
+        }
+        if (bytes / page_size < static_cast<uint64_t>(sb.node_count) + 1) {
+            throw std::runtime_error("Truncated index file: " + filename);
+        }
+        in.seekg(static_cast<std::streamoff>(page_size));
+        for (uint32_t i = 0; i < sb.node_count; ++i) {
+            const uint32_t id = arena.append();
+            if (!in.read(reinterpret_cast<char*>(arena.at(id)), page_size)) {
+                throw std::runtime_error("Truncated index file: " + filename);
+            }
+            const NodeHeader& h = header(id);
+            if (h.self_id != id || (h.next_leaf_id != UINT32_MAX && h.next_leaf_id >= sb.node_count)) {
+                throw std::runtime_error("Corrupt node " + std::to_string(id) + " in " + filename);
+            }
+        }
+        root_id = sb.root_id;
+        levels = sb.levels;
+        count = static_cast<size_t>(sb.entries);
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'D', 'S', 'P', 'I', 'D', 'X', '\0', '\0'};
+    static const uint32_t VERSION = 2;
+
+    Compare cmp;
+    uint32_t page_size = 0;
+    uint32_t internal_n = 0;    // max number of children
+    uint32_t leaf_capacity = 0; // max number of entries
+    uint32_t root_id = UINT32_MAX;
+    uint32_t levels = 0;
+    size_t count = 0;
+    NodeArena arena;
+
+    void reset(size_t pageSize) {
+        if (pageSize < sizeof(NodeHeader) + 2 * sizeof(Entry) + 3 * sizeof(uint32_t)) {
+            throw std::invalid_argument("Page too small for this index key");
+        }
+        page_size = static_cast<uint32_t>(pageSize);
+        internal_n = static_cast<uint32_t>((pageSize - sizeof(NodeHeader) + sizeof(Entry)) / (sizeof(Entry) + sizeof(uint32_t)));
+        leaf_capacity = static_cast<uint32_t>(std::min<size_t>(UINT16_MAX, (pageSize - sizeof(NodeHeader)) / sizeof(Entry)));
+        root_id = UINT32_MAX;
+        levels = 0;
+        count = 0;
+        arena.reset(pageSize);
+    }
+
+    bool less(const Entry& a, const Entry& b) const {
+        if (cmp(a.key, b.key)) return true;
+        if (cmp(b.key, a.key)) return false;
+        return a.rid < b.rid;
+    }
+
+    NodeHeader& header(uint32_t id) { return *reinterpret_cast<NodeHeader*>(arena.at(id)); }
+    const NodeHeader& header(uint32_t id) const { return *reinterpret_cast<const NodeHeader*>(arena.at(id)); }
+    bool isLeaf(uint32_t id) const { return header(id).is_leaf != 0; }
+    size_t size(uint32_t id) const { return header(id).key_count; }
+
+    // entries of a leaf, separators of an internal node
+    uint8_t* slots(uint32_t id) { return arena.at(id) + sizeof(NodeHeader); }
+    const uint8_t* slots(uint32_t id) const { return arena.at(id) + sizeof(NodeHeader); }
+    Entry entryAt(uint32_t id, size_t i) const {
+        Entry e;
+        std::memcpy(&e, slots(id) + i * sizeof(Entry), sizeof(e));
+        return e;
+    }
+    void setEntry(uint32_t id, size_t i, const Entry& e) { std::memcpy(slots(id) + i * sizeof(Entry), &e, sizeof(e)); }
+
+    size_t childrenOffset() const { return sizeof(NodeHeader) + (internal_n - 1) * sizeof(Entry); }
+    uint32_t child(uint32_t id, size_t i) const {
+        uint32_t c;
+        std::memcpy(&c, arena.at(id) + childrenOffset() + i * sizeof(uint32_t), sizeof(c));
+        return c;
+    }
+    void setChild(uint32_t id, size_t i, uint32_t c) { std::memcpy(arena.at(id) + childrenOffset() + i * sizeof(uint32_t), &c, sizeof(c)); }
+
+    uint32_t newNode(bool leaf) {
+        const uint32_t id = arena.append();
+        NodeHeader& h = header(id);
+        h.is_leaf = leaf ? 1 : 0;
+        h.self_id = id;
+        h.parent_id = UINT32_MAX;
+        h.next_leaf_id = UINT32_MAX;
+        return id;
+    }
+
+    // child of an internal node that holds entry e: separators <= e go left
+    size_t entryBound(uint32_t id, const Entry& e) const {
+        size_t lo = 0, hi = size(id);
+        while (lo < hi) {
+            const size_t mid = (lo + hi) / 2;
+            if (less(e, entryAt(id, mid))) hi = mid;
+            else lo = mid + 1;
+        }
+        return lo;
+    }
+
+    // first entry of a leaf that is not below e
+    size_t leafPosition(uint32_t id, const Entry& e) const {
+        size_t lo = 0, hi = size(id);
+        while (lo < hi) {
+            const size_t mid = (lo + hi) / 2;
+            if (less(entryAt(id, mid), e)) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    // first slot whose key is >= key (> key when upper); in an internal node
+    // that is the leftmost child that can hold such a key
+    size_t keyBound(uint32_t id, const Key& key, bool upper) const {
+        size_t lo = 0, hi = size(id);
+        while (lo < hi) {
+            const size_t mid = (lo + hi) / 2;
+            const Key k = entryAt(id, mid).key;
+            if (upper ? !cmp(key, k) : cmp(k, key)) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    Cursor seek(const Key* lo, bool lo_inclusive, const Key* hi, bool hi_inclusive) const {
+        Cursor c;
+        c.tree = this;
+        if (hi) {
+            c.has_hi = true;
+            c.hi = *hi;
+            c.hi_inclusive = hi_inclusive;
+        }
+        if (root_id == UINT32_MAX) return c;
+        uint32_t id = root_id;
+        while (!isLeaf(id)) id = child(id, lo ? keyBound(id, *lo, !lo_inclusive) : 0);
+        c.leaf = id;
+        c.pos = lo ? keyBound(id, *lo, !lo_inclusive) : 0;
+        return c;
+    }
+
+    // add separator sep between left and its new sibling right, splitting
+    // full parents up to the root; path holds the ancestors of left
+    void insertIntoParent(std::vector<uint32_t>& path, uint32_t left, Entry sep, uint32_t right) {
+        for (;;) {
+            if (path.empty()) {
+                const uint32_t root = newNode(false);
+                setEntry(root, 0, sep);
+                setChild(root, 0, left);
+                setChild(root, 1, right);
+                header(root).key_count = 1;
+                root_id = root;
+                levels++;
+                return;
+            }
+            const uint32_t parent = path.back();
+            path.pop_back();
+            const size_t n = size(parent);
+            const size_t i = entryBound(parent, sep);
+
+            std::vector<Entry> seps(n + 1);
+            std::vector<uint32_t> kids(n + 2);
+            for (size_t j = 0; j < n; ++j) seps[j + (j >= i)] = entryAt(parent, j);
+            for (size_t j = 0; j <= n; ++j) kids[j + (j > i)] = child(parent, j);
+            seps[i] = sep;
+            kids[i + 1] = right;
+
+            if (n + 1 < internal_n) {
+                for (size_t j = 0; j <= n; ++j) setEntry(parent, j, seps[j]);
+                for (size_t j = 0; j <= n + 1; ++j) setChild(parent, j, kids[j]);
+                header(parent).key_count = static_cast<uint16_t>(n + 1);
+                return;
+            }
+
+            // split: the middle separator moves up, its right side moves out
+            const size_t mid = seps.size() / 2;
+            const uint32_t sibling = newNode(false);
+            for (size_t j = 0; j < mid; ++j) setEntry(parent, j, seps[j]);
+            for (size_t j = 0; j <= mid; ++j) setChild(parent, j, kids[j]);
+            header(parent).key_count = static_cast<uint16_t>(mid);
+            for (size_t j = mid + 1; j < seps.size(); ++j) setEntry(sibling, j - mid - 1, seps[j]);
+            for (size_t j = mid + 1; j < kids.size(); ++j) setChild(sibling, j - mid - 1, kids[j]);
+            header(sibling).key_count = static_cast<uint16_t>(seps.size() - mid - 1);
+            left = parent;
+            sep = seps[mid];
+            right = sibling;
+        }
+    }
+};
+
+template <typename Key, typename Compare>
+constexpr char IndexTree<Key, Compare>::MAGIC[8];
+
+#endif
@@ -0,0 +1,222 @@
+#include "keysearch.h"
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KEYSEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+// branch-free binary search: the loop runs a fixed log2(n) steps and the
+// compare turns into a conditional move, so there is nothing to mispredict.
+// It stops once the candidate window is at most `window` keys and returns
+// the window start, the answer then lies in [base, base + n]
+template <bool Upper, typename T>
+static inline const T* narrow(const T* base, size_t& n, T key, size_t window) {
+    while (n > window) {
+        const size_t half = n / 2;
+        const T probe = base[half];
+        base = (Upper ? probe <= key : probe < key) ? base + half : base;
+        n -= half;
+    }
+    return base;
+}
+
+template <bool Upper, typename T>
+static size_t scalarSearch(const T* keys, size_t n, T key) {
+    if (n == 0) return 0;
+    const T* base = narrow<Upper>(keys, n, key, 1);
+    return static_cast<size_t>(base - keys) + (Upper ? *base <= key : *base < key);
+}
+
+// v - lo wraps around for v < lo, so one unsigned compare against the span
+// tests both bounds
+static void scalarSelect16(const uint16_t* col, size_t n, uint16_t lo, uint16_t hi, uint64_t* bits) {
+    const uint16_t span = static_cast<uint16_t>(hi - lo);
+    for (size_t w = 0; w * 64 < n; ++w) {
+        const size_t end = std::min(n, w * 64 + 64);
+        uint64_t word = 0;
+        for (size_t i = w * 64; i < end; ++i) {
+            word |= static_cast<uint64_t>(static_cast<uint16_t>(col[i] - lo) <= span) << (i & 63);
+        }
+        bits[w] = word;
+    }
+}
+
+#ifdef KEYSEARCH_X86
+// narrow down to a few vectors, then count the keys below the bound with
+// compare + movemask; sorted keys make the count the insert position
+static const size_t SIMD_WINDOW = 32;
+
+template <bool Upper>
+static size_t sse2Search(const float* keys, size_t n, float key) {
+    const float* base = narrow<Upper>(keys, n, key, SIMD_WINDOW);
+    const __m128 k = _mm_set1_ps(key);
+    size_t count = 0, i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const __m128 v = _mm_loadu_ps(base + i);
+        const __m128 m = Upper ? _mm_cmple_ps(v, k) : _mm_cmplt_ps(v, k);
+        count += static_cast<size_t>(__builtin_popcount(static_cast<unsigned>(_mm_movemask_ps(m))));
+    }
+    for (; i < n; ++i) count += Upper ? base[i] <= key : base[i] < key;
+    return static_cast<size_t>(base - keys) + count;
+}
+
+template <bool Upper>
+__attribute__((target("avx2"))) static size_t avx2Search(const float* keys, size_t n, float key) {
+    const float* base = narrow<Upper>(keys, n, key, SIMD_WINDOW);
+    const __m256 k = _mm256_set1_ps(key);
+    size_t count = 0, i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 v = _mm256_loadu_ps(base + i);
+        const __m256 m = _mm256_cmp_ps(v, k, Upper ? _CMP_LE_OQ : _CMP_LT_OQ);
+        count += static_cast<size_t>(__builtin_popcount(static_cast<unsigned>(_mm256_movemask_ps(m))));
+    }
+    for (; i < n; ++i) count += Upper ? base[i] <= key : base[i] < key;
+    return static_cast<size_t>(base - keys) + count;
+}
+
+// 16-bit codes: there is no unsigned 16-bit compare before AVX-512, so both
+// sides get the sign bit flipped and are compared signed; each lane sets
+// two movemask bits
+static size_t sse2CodeSearch(const uint16_t* keys, size_t n, uint16_t code) {
+    const uint16_t* base = narrow<false>(keys, n, code, SIMD_WINDOW);
+    const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+    const __m128i k = _mm_xor_si128(_mm_set1_epi16(static_cast<short>(code)), bias);
+    size_t count = 0, i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(base + i)), bias);
+        count += static_cast<size_t>(__builtin_popcount(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmplt_epi16(v, k)))));
+    }
+    count /= 2;
+    for (; i < n; ++i) count += base[i] < code;
+    return static_cast<size_t>(base - keys) + count;
+}
+
+__attribute__((target("avx2"))) static size_t avx2CodeSearch(const uint16_t* keys, size_t n, uint16_t code) {
+    const uint16_t* base = narrow<false>(keys, n, code, SIMD_WINDOW);
+    const __m256i bias = _mm256_set1_epi16(static_cast<short>(0x8000));
+    const __m256i k = _mm256_xor_si256(_mm256_set1_epi16(static_cast<short>(code)), bias);
+    size_t count = 0, i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(base + i)), bias);
+        count += static_cast<size_t>(__builtin_popcount(static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpgt_epi16(k, v)))));
+    }
+    count /= 2;
+    for (; i < n; ++i) count += base[i] < code;
+    return static_cast<size_t>(base - keys) + count;
+}
+
+// column selection a 64-row word at a time: the compare masks of two vectors
+// are packed to bytes, so one movemask gives a bit per row; a set bit marks
+// a row outside the range
+static void sse2Select16(const uint16_t* col, size_t n, uint16_t lo, uint16_t hi, uint64_t* bits) {
+    const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+    const __m128i low = _mm_set1_epi16(static_cast<short>(lo));
+    const __m128i span = _mm_xor_si128(_mm_set1_epi16(static_cast<short>(hi - lo)), bias);
+    size_t w = 0;
+    for (; (w + 1) * 64 <= n; ++w) {
+        uint64_t outside = 0;
+        for (size_t k = 0; k < 4; ++k) {
+            const uint16_t* p = col + w * 64 + k * 16;
+            const __m128i a = _mm_xor_si128(_mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), low), bias);
+            const __m128i b = _mm_xor_si128(_mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8)), low), bias);
+            const __m128i m = _mm_packs_epi16(_mm_cmpgt_epi16(a, span), _mm_cmpgt_epi16(b, span));
+            outside |= static_cast<uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(m))) << (k * 16);
+        }
+        bits[w] = ~outside;
+    }
+    scalarSelect16(col + w * 64, n - w * 64, lo, hi, bits + w);
+}
+
+// the 256-bit pack works per 128-bit lane, a 64-bit permute puts the rows
+// back in order
+__attribute__((target("avx2"))) static void avx2Select16(const uint16_t* col, size_t n, uint16_t lo, uint16_t hi, uint64_t* bits) {
+    const __m256i bias = _mm256_set1_epi16(static_cast<short>(0x8000));
+    const __m256i low = _mm256_set1_epi16(static_cast<short>(lo));
+    const __m256i span = _mm256_xor_si256(_mm256_set1_epi16(static_cast<short>(hi - lo)), bias);
+    size_t w = 0;
+    for (; (w + 1) * 64 <= n; ++w) {
+        uint64_t outside = 0;
+        for (size_t k = 0; k < 2; ++k) {
+            const uint16_t* p = col + w * 64 + k * 32;
+            const __m256i a = _mm256_xor_si256(_mm256_sub_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), low), bias);
+            const __m256i b = _mm256_xor_si256(_mm256_sub_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 16)), low), bias);
+            const __m256i m = _mm256_permute4x64_epi64(_mm256_packs_epi16(_mm256_cmpgt_epi16(a, span), _mm256_cmpgt_epi16(b, span)), 0xD8);
+            outside |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(m))) << (k * 32);
+        }
+        bits[w] = ~outside;
+    }
+    scalarSelect16(col + w * 64, n - w * 64, lo, hi, bits + w);
+}
+#endif
+
+typedef size_t (*SearchFn)(const float*, size_t, float);
+typedef size_t (*CodeSearchFn)(const uint16_t*, size_t, uint16_t);
+typedef void (*SelectFn)(const uint16_t*, size_t, uint16_t, uint16_t, uint64_t*);
+
+struct KernelTable {
+    SearchFn lower;
+    SearchFn upper;
+    CodeSearchFn code;
+    SelectFn select;
+};
+
+static KernelTable tableFor(SearchKernel kernel) {
+    switch (kernel) {
+#ifdef KEYSEARCH_X86
+        case SearchKernel::AVX2: return {avx2Search<false>, avx2Search<true>, avx2CodeSearch, avx2Select16};
+        case SearchKernel::SSE2: return {sse2Search<false>, sse2Search<true>, sse2CodeSearch, sse2Select16};
+#endif
+        default: return {scalarSearch<false, float>, scalarSearch<true, float>, scalarSearch<false, uint16_t>, scalarSelect16};
+    }
+}
+
+static SearchKernel bestKernel() {
+    if (searchKernelSupported(SearchKernel::AVX2)) return SearchKernel::AVX2;
+    if (searchKernelSupported(SearchKernel::SSE2)) return SearchKernel::SSE2;
+    return SearchKernel::Scalar;
+}
+
+static SearchKernel active = bestKernel();
+static KernelTable table = tableFor(active);
+
+const char* searchKernelName(SearchKernel kernel) {
+    switch (kernel) {
+        case SearchKernel::Scalar: return "scalar";
+        case SearchKernel::SSE2: return "SSE2";
+        case SearchKernel::AVX2: return "AVX2";
+    }
+    return "?";
+}
+
+bool searchKernelSupported(SearchKernel kernel) {
+#ifdef KEYSEARCH_X86
+    __builtin_cpu_init(); // may run from a static initializer
+#endif
+    switch (kernel) {
+        case SearchKernel::Scalar: return true;
+#ifdef KEYSEARCH_X86
+        case SearchKernel::SSE2: return __builtin_cpu_supports("sse2");
+        case SearchKernel::AVX2: return __builtin_cpu_supports("avx2");
+#endif
+        default: return false;
+    }
+}
+
+SearchKernel activeSearchKernel() { return active; }
+
+bool setSearchKernel(SearchKernel kernel) {
+    if (!searchKernelSupported(kernel)) return false;
+    active = kernel;
+    table = tableFor(kernel);
+    return true;
+}
+
+size_t keyLowerBound(const float* keys, size_t n, float key) { return table.lower(keys, n, key); }
+size_t keyUpperBound(const float* keys, size_t n, float key) { return table.upper(keys, n, key); }
+size_t codeLowerBound(const uint16_t* keys, size_t n, uint32_t code) {
+    return code > UINT16_MAX ? n : table.code(keys, n, static_cast<uint16_t>(code));
+}
+void columnSelect16(const uint16_t* col, size_t n, uint16_t lo, uint16_t hi, uint64_t* bits) {
+    table.select(col, n, lo, hi, bits);
+}
@@ -0,0 +1,28 @@
+#ifndef KEYSEARCH_H
+#define KEYSEARCH_H
+
+#include <cstddef>
+#include <cstdint>
+
+// search over a sorted, contiguous float key array (node keys); the kernel is
+// picked once at startup from what the CPU supports
+enum class SearchKernel { Scalar, SSE2, AVX2 };
+
+const char* searchKernelName(SearchKernel kernel);
+bool searchKernelSupported(SearchKernel kernel);
+SearchKernel activeSearchKernel();
+// force a kernel, e.g. to compare them; false (and no change) if unsupported
+bool setSearchKernel(SearchKernel kernel);
+
+size_t keyLowerBound(const float* keys, size_t n, float key); // first i with keys[i] >= key
+size_t keyUpperBound(const float* keys, size_t n, float key); // first i with keys[i] > key
+// the same over 16-bit key codes (quantized trees); code may be
+// UINT16_MAX + 1, past every key
+size_t codeLowerBound(const uint16_t* keys, size_t n, uint32_t code); // first i with keys[i] >= code
+
+// selection over a 16-bit column (PAX minipages): bit i % 64 of bits[i / 64]
+// is set when lo <= col[i] <= hi, for every i < n; the words are
+// overwritten, bits past n in the last one cleared
+void columnSelect16(const uint16_t* col, size_t n, uint16_t lo, uint16_t hi, uint64_t* bits);
+
+#endif
@@ -2,12 +2,26 @@
 #include "bplustree.h"
 #include "record.h"
 #include "block.h"
+#include "bufferpool.h"
+#include "keysearch.h"
+#include "extsort.h"
+#include "indexcatalog.h"
+#include "scan.h"
+#include "query.h"
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <string>
 #include <vector>
 #include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <cmath>
+#include <random>
+#include <unordered_map>
 
 
 void task1(Database &db) {
@@ -25,10 +39,12 @@ void task1(Database &db) {
     int printed = 0;
 
     // show that data is parsed correctly
-    for (const auto &block : db.getBlocks()) {  
-        for (size_t i = 0; i < block.getNumRecords() && printed < 5; ++i) {
+    for (size_t b = 0; b < db.getNumBlocks(); ++b) {
+        const BlockView block = db.getBlock(b);
+        for (size_t i = 0; i < block.getNumSlots() && printed < 5; ++i) {
+            if (!block.isLive(i)) continue;
             const Record r = block.getRecord(i);
-            std::cout << "GameDate: " << r.GAME_DATE_EST
+            std::cout << "GameDate: " << formatDate(r.GAME_DATE_EST)
                       << ", TeamID: " << r.TEAM_ID_home
                       << ", PTS: " << r.PTS_home
                       << ", FG%: " << r.FG_PCT_home
@@ -59,39 +75,29 @@ BPTree task2(Database& db, size_t blockSize) {
     BPTree tree;
     tree.compute_capacities(blockSize);
 
-    // build leaves
-    auto leaves = build_leaves(tree, pairs);
-
-    // build internal levels bottom-up until a single root remains
-    std::vector<uint32_t> level = leaves;
-    uint32_t height = 1; 
-    while (level.size() > 1) {
-        level = build_internal_level(tree, level);
-        height++;
-    }
-    tree.root_id = level.front();
-    tree.levels  = height;
+    // build leaves, then internal levels bottom-up until a single root remains
+    bulk_load(tree, pairs);
 
     //report
     std::cout << "\nB+ Tree (key = FT_PCT_home)\n";
     std::cout << "Order n: " << tree.internal_n << "\n";
-    std::cout << "Total nodes: " << tree.nodes.size() << "\n";
+    std::cout << "Total nodes: " << tree.liveNodeCount() << "\n";
     std::cout << "Levels: " << tree.levels << "\n";
 
     // root keys
-    const BPTNode& root = tree.nodes[tree.root_id];
+    const NodeRef root = tree.node(tree.root_id);
     std::cout << std::fixed << std::setprecision(4);
     std::cout << "Root keys: ";
-    if (root.header.is_leaf) {
-        for (size_t i = 0; i < root.leaf.size(); ++i) {
+    if (root.isLeaf()) {
+        for (size_t i = 0; i < root.size(); ++i) {
             if (i) std::cout << ", ";
-            std::cout << root.leaf[i].key;
-            if (i >= 19 && i + 1 < root.leaf.size()) { std::cout << ", ..."; break; }
+            std::cout << root.key(i);
+            if (i >= 19 && i + 1 < root.size()) { std::cout << ", ..."; break; }
         }
     } else {
-        for (size_t i = 0; i < root.keys.size(); ++i) {
+        for (size_t i = 0; i < root.size(); ++i) {
             if (i) std::cout << ", ";
-            std::cout << root.keys[i];
+            std::cout << root.key(i);
         }
     }
     std::cout << "\n";
@@ -104,7 +110,7 @@ void task3(BPTree& tree, Database& db) {
     std::cout << "=====================================================" << std::endl;
     
     // Get tree stats before deletion
-    size_t initial_nodes = tree.nodes.size();
+    size_t initial_nodes = tree.liveNodeCount();
     uint32_t initial_levels = tree.levels;
     
     std::cout << "\nB+ Tree Statistics Before Deletion:" << std::endl;
@@ -113,22 +119,22 @@ void task3(BPTree& tree, Database& db) {
     std::cout << "Number of levels: " << initial_levels << std::endl;
     
     // Root node content before deletion
-    const BPTNode& root_before = tree.nodes[tree.root_id];
+    const NodeRef root_before = tree.node(tree.root_id);
     std::cout << "Root node keys (before): ";
-    if (root_before.header.is_leaf) {
-        for (size_t i = 0; i < root_before.leaf.size(); ++i) {
+    if (root_before.isLeaf()) {
+        for (size_t i = 0; i < root_before.size(); ++i) {
             if (i > 0) std::cout << ", ";
-            std::cout << std::fixed << std::setprecision(4) << root_before.leaf[i].key;
-            if (i >= 9 && i + 1 < root_before.leaf.size()) {
+            std::cout << std::fixed << std::setprecision(4) << root_before.key(i);
+            if (i >= 9 && i + 1 < root_before.size()) {
                 std::cout << ", ...";
                 break;
             }
         }
     } else {
-        for (size_t i = 0; i < root_before.keys.size(); ++i) {
+        for (size_t i = 0; i < root_before.size(); ++i) {
             if (i > 0) std::cout << ", ";
-            std::cout << std::fixed << std::setprecision(4) << root_before.keys[i];
-            if (i >= 9 && i + 1 < root_before.keys.size()) {
+            std::cout << std::fixed << std::setprecision(4) << root_before.key(i);
+            if (i >= 9 && i + 1 < root_before.size()) {
                 std::cout << ", ...";
                 break;
             }
@@ -137,10 +143,10 @@ void task3(BPTree& tree, Database& db) {
     std::cout << std::endl;
 
     // Perform deletion
-    auto stats = tree.deleteHighFTPCT(db, 0.9f);
+    auto stats = tree.deleteHighFTPCT(db, 0.9);
     
     // Get tree stats after deletion
-    size_t final_nodes = tree.nodes.size();
+    size_t final_nodes = tree.liveNodeCount();
     uint32_t final_levels = tree.levels;
     
     // Report statistics
@@ -148,6 +154,7 @@ void task3(BPTree& tree, Database& db) {
     std::cout << "--------------------" << std::endl;
     std::cout << "Number of index nodes accessed: " << stats.index_nodes_accessed << std::endl;
     std::cout << "Number of data blocks accessed: " << stats.data_blocks_accessed << std::endl;
+    std::cout << "Bytes freed in data blocks: " << stats.bytes_freed << std::endl;
     std::cout << "Number of games deleted: " << stats.games_deleted << std::endl;
     std::cout << "Average FT_PCT_home of deleted records: " 
               << std::fixed << std::setprecision(4) << stats.average_ft_pct << std::endl;
@@ -156,6 +163,10 @@ void task3(BPTree& tree, Database& db) {
     std::cout << "Number of data blocks accessed (linear scan): " << stats.linear_scan_blocks << std::endl;
     std::cout << "Running time (linear scan): " << std::fixed << std::setprecision(2) 
               << stats.linear_scan_time_ms << " ms" << std::endl;
+    std::cout << "Rows found (linear scan): " << stats.linear_scan_matches << " ("
+              << (stats.linear_scan_agrees ? "same" : "MISMATCH") << ")" << std::endl;
+    
+    std::cout << "Records left in the heap file: " << db.getTotalRecords() << std::endl;
     
     std::cout << "\nB+ Tree Statistics After Deletion:" << std::endl;
     std::cout << "----------------------------------" << std::endl;
@@ -163,22 +174,22 @@ void task3(BPTree& tree, Database& db) {
     std::cout << "Number of levels: " << final_levels << std::endl;
     
     // Root node content after deletion
-    const BPTNode& root_after = tree.nodes[tree.root_id];
+    const NodeRef root_after = tree.node(tree.root_id);
     std::cout << "Root node keys (after): ";
-    if (root_after.header.is_leaf) {
-        for (size_t i = 0; i < root_after.leaf.size(); ++i) {
+    if (root_after.isLeaf()) {
+        for (size_t i = 0; i < root_after.size(); ++i) {
             if (i > 0) std::cout << ", ";
-            std::cout << std::fixed << std::setprecision(4) << root_after.leaf[i].key;
-            if (i >= 9 && i + 1 < root_after.leaf.size()) {
+            std::cout << std::fixed << std::setprecision(4) << root_after.key(i);
+            if (i >= 9 && i + 1 < root_after.size()) {
                 std::cout << ", ...";
                 break;
             }
         }
     } else {
-        for (size_t i = 0; i < root_after.keys.size(); ++i) {
+        for (size_t i = 0; i < root_after.size(); ++i) {
             if (i > 0) std::cout << ", ";
-            std::cout << std::fixed << std::setprecision(4) << root_after.keys[i];
-            if (i >= 9 && i + 1 < root_after.keys.size()) {
+            std::cout << std::fixed << std::setprecision(4) << root_after.key(i);
+            if (i >= 9 && i + 1 < root_after.size()) {
                 std::cout << ", ...";
                 break;
             }
@@ -212,14 +223,1042 @@ void task3(BPTree& tree, Database& db) {
     std::cout << "=====================================================" << std::endl;
 }
 
-int main() {
+// replay the same mixed workload (index point lookups on a hot key range with
+// two full heap scans in between) through a small buffer pool under each policy
+void bufferPoolReport(size_t blockSize, size_t frames) {
+    std::cout << "Buffer Pool Report (" << frames << " frames of " << blockSize << " B):" << std::endl;
+    std::cout << "---------------------------------" << std::endl;
+    const ReplacementPolicy policies[] = {ReplacementPolicy::LRU, ReplacementPolicy::CLOCK, ReplacementPolicy::LRU_K};
+    for (ReplacementPolicy policy : policies) {
+        BufferPool pool(blockSize, frames, policy);
+        Database db(blockSize);
+        db.openBuffered("games.bin", pool);
+        BPTree tree;
+        tree.openBuffered("bplustree.bin", pool);
+
+        for (int round = 0; round < 3; ++round) {
+            for (int i = 0; i < 2000; ++i) {
+                LeafCursor hit = tree.find(0.75f + 0.05f * static_cast<float>((i * 37) % 1000) / 1000.0f);
+                LeafEntry e;
+                hit.next(e);
+            }
+            if (round < 2) {
+                std::vector<LeafEntry> pairs;
+                collect_pairs_ft_pct(db, pairs, 1); // one thread keeps the access order fixed
+            }
+        }
+
+        const BufferPoolStats st = pool.stats();
+        std::cout << std::left << std::setw(6) << policyName(policy) << std::right
+                  << " hits: " << st.hits
+                  << ", misses: " << st.misses
+                  << ", evictions: " << st.evictions
+                  << ", write-backs: " << st.write_backs
+                  << ", hit ratio: " << std::fixed << std::setprecision(4) << st.hitRatio() << std::endl;
+    }
+    std::cout << "---------------------------------" << std::endl;
+}
+
+// time the bulk load on one thread and on every core, and check both give
+// the same node pages as the index built for task 2
+void bulkLoadReport(const Database& db, const BPTree& built, size_t blockSize) {
+    std::cout << "Parallel Bulk Load Report:" << std::endl;
+    std::cout << "--------------------------" << std::endl;
+
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads : {1u, cores}) {
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<LeafEntry> pairs;
+        collect_pairs_ft_pct(db, pairs, threads);
+        auto sorted = std::chrono::high_resolution_clock::now();
+        BPTree tree;
+        tree.compute_capacities(blockSize);
+        bulk_load(tree, pairs, threads);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        bool same = tree.nodeCount() == built.nodeCount() && tree.root_id == built.root_id;
+        for (uint32_t id = 0; same && id < tree.nodeCount(); ++id) {
+            same = std::memcmp(tree.node(id).data(), built.node(id).data(), tree.page_size) == 0;
+        }
+        std::cout << std::setw(2) << threads << " thread(s): collect + sort "
+                  << std::fixed << std::setprecision(2)
+                  << std::chrono::duration<double, std::milli>(sorted - start).count() << " ms, build "
+                  << std::chrono::duration<double, std::milli>(end - sorted).count() << " ms, same pages: "
+                  << (same ? "Yes" : "No") << std::endl;
+        if (cores == 1) break;
+    }
+    std::cout << "--------------------------" << std::endl;
+}
+
+// bulk load through an external sort with a deliberately small memory
+// budget, so the pairs are spilled to runs and merged in more than one pass
+void externalSortReport(const Database& db, const BPTree& built, size_t blockSize, size_t budget) {
+    std::cout << "External Sort Report (" << budget / 1024 << " KiB budget):" << std::endl;
+    std::cout << "--------------------------" << std::endl;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    ExternalSorter sorter(budget);
+    collect_pairs_ft_pct(db, sorter);
+    BPTree tree;
+    tree.compute_capacities(blockSize);
+    bulk_load(tree, sorter);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    bool same = tree.nodeCount() == built.nodeCount() && tree.root_id == built.root_id;
+    for (uint32_t id = 0; same && id < tree.nodeCount(); ++id) {
+        same = std::memcmp(tree.node(id).data(), built.node(id).data(), tree.page_size) == 0;
+    }
+    const ExternalSortStats& st = sorter.stats();
+    std::cout << "Entries: " << st.entries << ", runs: " << st.runs
+              << ", merge passes: " << st.mergePasses
+              << ", bytes spilled: " << st.bytesSpilled << std::endl;
+    std::cout << "Build time: " << std::fixed << std::setprecision(2)
+              << std::chrono::duration<double, std::milli>(end - start).count() << " ms, same pages: "
+              << (same ? "Yes" : "No") << std::endl;
+
+    // the same stream written straight to an index file, so memory stays at
+    // the sort budget and a page; read back through a small pool
+    start = std::chrono::high_resolution_clock::now();
+    ExternalSorter fileSorter(budget);
+    collect_pairs_ft_pct(db, fileSorter);
+    BPTree layout;
+    layout.compute_capacities(blockSize);
+    bulk_load_file(layout, fileSorter, "bplustree_external.bin");
+    end = std::chrono::high_resolution_clock::now();
+    BufferPool pool(blockSize, 8);
+    BPTree onDisk;
+    onDisk.openBuffered("bplustree_external.bin", pool);
+    same = onDisk.nodeCount() == built.nodeCount() && onDisk.root_id == built.root_id && onDisk.levels == built.levels;
+    for (uint32_t id = 0; same && id < onDisk.nodeCount(); ++id) {
+        same = std::memcmp(onDisk.node(id).data(), built.node(id).data(), built.page_size) == 0;
+    }
+    std::cout << "Built into an index file: " << std::fixed << std::setprecision(2)
+              << std::chrono::duration<double, std::milli>(end - start).count() << " ms, " << onDisk.nodeCount()
+              << " pages read back through an 8-frame pool, same pages: " << (same ? "Yes" : "No") << std::endl;
+    std::cout << "--------------------------" << std::endl;
+}
+
+// mixed lookups, inserts and erases from several threads on one concurrent
+// tree; every thread erases what it inserted, so the tree ends where it began
+void concurrencyReport(const Database& db, size_t blockSize) {
+    std::cout << "Concurrent Access Report (80% lookups, 10% inserts, 10% erases):" << std::endl;
+    std::cout << "---------------------------------" << std::endl;
+
+    std::vector<LeafEntry> pairs;
+    collect_pairs_ft_pct(db, pairs);
+    const int opsPerThread = 20000;
+    for (unsigned threads : {1u, 2u, 4u, 8u}) {
+        BPTree tree;
+        tree.compute_capacities(blockSize);
+        bulk_load(tree, pairs);
+        tree.setConcurrent(true);
+
+        std::vector<size_t> misses(threads, 0);
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t]() {
+                std::vector<LeafEntry> mine;
+                uint32_t seed = 2654435761u * (t + 1);
+                for (int i = 0; i < opsPerThread; ++i) {
+                    seed = seed * 1664525u + 1013904223u;
+                    const float key = static_cast<float>((seed >> 8) % 1000) / 1000.0f;
+                    const unsigned kind = (seed >> 4) % 10;
+                    if (kind == 0) {
+                        // RIDs past the heap, so they never collide with real entries
+                        const LeafEntry e{key, RID{0x80000000u + t, static_cast<uint32_t>(i)}};
+                        tree.insert(e.key, e.rid);
+                        mine.push_back(e);
+                    } else if (kind == 1 && !mine.empty()) {
+                        if (!tree.erase(mine.back().key, mine.back().rid)) misses[t]++;
+                        mine.pop_back();
+                    } else {
+                        LeafCursor hit = tree.find(key);
+                        LeafEntry e;
+                        hit.next(e);
+                    }
+                }
+                for (const LeafEntry& e : mine) {
+                    if (!tree.erase(e.key, e.rid)) misses[t]++;
+                }
+            });
+        }
+        for (auto& w : workers) w.join();
+        auto end = std::chrono::high_resolution_clock::now();
+        tree.setConcurrent(false);
+
+        size_t left = 0;
+        LeafCursor all = tree.search(CompareOp::GE, 0.0f);
+        LeafEntry e;
+        while (all.next(e)) left++;
+        size_t lost = 0;
+        for (size_t m : misses) lost += m;
+
+        const double secs = std::chrono::duration<double>(end - start).count();
+        std::cout << threads << " thread(s): " << std::fixed << std::setprecision(0)
+                  << threads * opsPerThread / secs << " ops/sec, entries after: " << left
+                  << (left == pairs.size() && lost == 0 ? " (unchanged)" : " (MISMATCH)") << std::endl;
+    }
+    std::cout << "---------------------------------" << std::endl;
+}
+
+// the same index with posting-list leaves: page counts, and the time of an
+// equality and a range scan over the duplicates against the plain tree
+void postingReport(const Database& db, const BPTree& plain, size_t blockSize) {
+    std::cout << "Posting List Report:" << std::endl;
+    std::cout << "--------------------" << std::endl;
+
+    std::vector<LeafEntry> pairs;
+    collect_pairs_ft_pct(db, pairs);
+    BPTree posting;
+    posting.compute_capacities(blockSize);
+    bulk_load_postings(posting, pairs);
+
+    auto pages = [](const BPTree& t, uint8_t kind) {
+        size_t n = 0;
+        for (uint32_t id = 0; id < t.nodeCount(); ++id) {
+            const uint8_t k = t.node(id).header().is_leaf;
+            if (k == kind || (kind == 1 && k == NODE_POSTING)) n++;
+        }
+        return n;
+    };
+    std::cout << "Plain   - leaf pages: " << pages(plain, 1) << ", levels: " << plain.levels << std::endl;
+    std::cout << "Posting - leaf pages: " << pages(posting, 1) << " (+" << pages(posting, NODE_OVERFLOW)
+              << " overflow), levels: " << posting.levels << std::endl;
+
+    auto scan = [](const BPTree& t, bool eq, size_t& n) {
+        const int rounds = 200;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int r = 0; r < rounds; ++r) {
+            LeafCursor c = eq ? t.find(0.75f) : t.range(0.6f, 0.7f);
+            LeafEntry e;
+            n = 0;
+            while (c.next(e)) n++;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::micro>(end - start).count() / rounds;
+    };
+    for (bool eq : {true, false}) {
+        size_t a = 0, b = 0;
+        const double plainUs = scan(plain, eq, a);
+        const double postingUs = scan(posting, eq, b);
+        std::cout << (eq ? "FT_PCT_home = 0.750:         " : "0.600 <= FT_PCT_home <= 0.700: ")
+                  << std::fixed << std::setprecision(1) << plainUs << " us plain, " << postingUs
+                  << " us posting (" << b << " entries, " << (a == b ? "same" : "MISMATCH") << ")" << std::endl;
+    }
+    std::cout << "--------------------" << std::endl;
+}
+
+// the same index with 16-bit key codes and packed leaves: fanout, page
+// counts, and the time of an equality and a range lookup against the plain
+// tree
+void packedReport(const Database& db, const BPTree& plain, size_t blockSize) {
+    std::cout << "Packed Key Report:" << std::endl;
+    std::cout << "------------------" << std::endl;
+
+    std::vector<LeafEntry> pairs;
+    collect_pairs_ft_pct(db, pairs);
+    BPTree packed;
+    packed.compute_capacities(blockSize);
+    bulk_load_packed(packed, pairs);
+
+    auto leaves = [](const BPTree& t) {
+        size_t n = 0;
+        for (uint32_t id = 0; id < t.nodeCount(); ++id) n += t.node(id).isLeaf();
+        return n;
+    };
+    std::cout << "Plain  - fanout: " << plain.internal_n << ", leaf pages: " << leaves(plain)
+              << ", nodes: " << plain.nodeCount() << ", levels: " << plain.levels << std::endl;
+    std::cout << "Packed - fanout: " << packed.internal_n << ", leaf pages: " << leaves(packed)
+              << ", nodes: " << packed.nodeCount() << ", levels: " << packed.levels << std::endl;
+
+    auto scan = [](const BPTree& t, bool eq, size_t& n) {
+        const int rounds = 200;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int r = 0; r < rounds; ++r) {
+            LeafCursor c = eq ? t.find(0.75f) : t.range(0.6f, 0.7f);
+            LeafEntry e;
+            n = 0;
+            while (c.next(e)) n++;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::micro>(end - start).count() / rounds;
+    };
+    for (bool eq : {true, false}) {
+        size_t a = 0, b = 0;
+        const double plainUs = scan(plain, eq, a);
+        const double packedUs = scan(packed, eq, b);
+        std::cout << (eq ? "FT_PCT_home = 0.750:         " : "0.600 <= FT_PCT_home <= 0.700: ")
+                  << std::fixed << std::setprecision(1) << plainUs << " us plain, " << packedUs
+                  << " us packed (" << b << " entries, " << (a == b ? "same" : "MISMATCH") << ")" << std::endl;
+    }
+    std::cout << "------------------" << std::endl;
+}
+
+// range COUNT / SUM / AVG from subtree aggregates against summing the
+// entries a cursor returns, then the aggregates after inserts and erases
+void aggregateReport(const Database& db, size_t blockSize) {
+    std::cout << "Range Aggregate Report:" << std::endl;
+    std::cout << "-----------------------" << std::endl;
+
+    std::vector<LeafEntry> pairs;
+    collect_pairs_ft_pct(db, pairs);
+    BPTree tree;
+    tree.compute_capacities(blockSize);
+    tree.setAggregates(true);
+    bulk_load(tree, pairs);
+    std::cout << "Fanout: " << tree.internal_n << ", nodes: " << tree.nodeCount() << ", levels: " << tree.levels
+              << std::endl;
+
+    auto scan = [&](float lo, float hi) {
+        BPTree::RangeAggregate agg;
+        LeafCursor c = tree.range(lo, hi);
+        LeafEntry e;
+        while (c.next(e)) {
+            agg.count++;
+            agg.sum += e.key;
+        }
+        return agg;
+    };
+    auto same = [](const BPTree::RangeAggregate& a, const BPTree::RangeAggregate& b) {
+        return a.count == b.count && std::fabs(a.sum - b.sum) <= 1e-6 * (1.0 + std::fabs(b.sum));
+    };
+    const std::pair<float, float> ranges[] = {{0.6f, 0.7f}, {0.9f, 1.0f}, {0.0f, 1.0f}};
+    for (const auto& r : ranges) {
+        const int rounds = 200;
+        BPTree::RangeAggregate fast, slow;
+        auto t0 = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < rounds; ++i) fast = tree.rangeAggregate(r.first, r.second);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < rounds; ++i) slow = scan(r.first, r.second);
+        auto t2 = std::chrono::high_resolution_clock::now();
+        std::cout << std::fixed << std::setprecision(3) << r.first << " <= FT_PCT_home <= " << r.second << ": count "
+                  << fast.count << ", avg " << std::setprecision(6) << fast.average() << std::setprecision(2)
+                  << ", aggregates " << std::chrono::duration<double, std::micro>(t1 - t0).count() / rounds
+                  << " us, scan " << std::chrono::duration<double, std::micro>(t2 - t1).count() / rounds << " us ("
+                  << (same(fast, slow) ? "same" : "MISMATCH") << ")" << std::endl;
+    }
+
+    for (double p : {0.5, 0.9, 0.99}) {
+        const size_t k = static_cast<size_t>(std::ceil(p * pairs.size())) - 1;
+        const float q = tree.percentile(p);
+        std::cout << "p" << static_cast<int>(p * 100) << " FT_PCT_home: " << std::setprecision(3) << q
+                  << " (" << (q == pairs[k].key ? "same" : "MISMATCH") << " as the sorted pairs)" << std::endl;
+    }
+
+    // aggregates follow inserts and erases, splits and merges included
+    std::mt19937 rng(20);
+    std::vector<LeafEntry> added;
+    for (uint32_t i = 0; i < 5000; ++i) {
+        const LeafEntry e{static_cast<float>(rng() % 1001) / 1000.0f, RID{1000000 + i, 0}};
+        tree.insert(e.key, e.rid);
+        added.push_back(e);
+    }
+    for (size_t i = 0; i < added.size(); i += 2) tree.erase(added[i].key, added[i].rid);
+    for (size_t i = 0; i < pairs.size(); i += 3) tree.erase(pairs[i].key, pairs[i].rid);
+    const BPTree::RangeAggregate after = tree.rangeAggregate(0.0f, 1.0f);
+    std::cout << "After 5000 inserts and " << added.size() / 2 + (pairs.size() + 2) / 3 << " erases: count "
+              << after.count << " (" << (same(after, scan(0.0f, 1.0f)) ? "same" : "MISMATCH") << " as a scan)"
+              << std::endl;
+    std::cout << "-----------------------" << std::endl;
+}
+
+// full-table filters: a row-by-row scan against the column filter on the
+// slotted heap and on the same rows in PAX pages, with the bytes each reads
+// RIDs of the index entries a predicate on FT_PCT_home matches, in RID
+// order like a heap scan's
+static std::vector<RID> indexRids(const BPTree& tree, const ColumnPredicate& pred) {
+    std::vector<RID> rids;
+    LeafCursor c = tree.search(pred);
+    LeafEntry e;
+    while (c.next(e)) rids.push_back(e.rid);
+    std::sort(rids.begin(), rids.end());
+    return rids;
+}
+
+void paxReport(const Database& db, const BPTree& tree, size_t blockSize) {
+    std::cout << "PAX Layout Report:" << std::endl;
+    std::cout << "------------------" << std::endl;
+
+    Database pax(blockSize);
+    pax.setPageLayout(PageLayout::PAX);
+    pax.bulkLoadFromFile("games.txt");
+    pax.saveToBinaryFile("games_pax.bin");
+    Database mappedPax(blockSize);
+    mappedPax.openMapped("games_pax.bin");
+    std::cout << "Slotted - records per page: " << db.getRecordsPerBlock() << ", pages: " << db.getNumBlocks()
+              << std::endl;
+    std::cout << "PAX     - records per page: " << pax.getRecordsPerBlock() << ", pages: " << pax.getNumBlocks()
+              << " (reopened mapped: " << mappedPax.getTotalRecords() << " records)" << std::endl;
+
+    const PaxGeometry geometry = paxGeometry(blockSize);
+    auto columnBytes = [&](const std::vector<ColumnPredicate>& where) {
+        size_t bytes = (geometry.capacity + 63) / 64 * 8; // live bitmap
+        for (const ColumnPredicate& p : where) bytes += columnWidth(p.column) * geometry.capacity;
+        return bytes;
+    };
+    auto rowScan = [](const Database& d, const std::vector<ColumnPredicate>& where) {
+        std::vector<RID> out;
+        forEachRecord(d, [&](const Record& r, RID rid) {
+            const double values[] = {static_cast<double>(r.GAME_DATE_EST), static_cast<double>(r.TEAM_ID_home),
+                                     static_cast<double>(r.PTS_home), r.FG_PCT_home, r.FT_PCT_home, r.FG3_PCT_home,
+                                     static_cast<double>(r.AST_home), static_cast<double>(r.REB_home),
+                                     static_cast<double>(r.HOME_TEAM_WINS)};
+            for (const ColumnPredicate& p : where) {
+                if (!predicateMatches(p, values[static_cast<size_t>(p.column)])) return;
+            }
+            out.push_back(rid);
+        });
+        return out;
+    };
+    auto time = [](auto fn, std::vector<RID>& out) {
+        const int rounds = 20;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int r = 0; r < rounds; ++r) out = fn();
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::micro>(end - start).count() / rounds;
+    };
+
+    const int team = db.getBlock(0).getRecord(0).TEAM_ID_home;
+    const struct { std::string label; std::vector<ColumnPredicate> where; } filters[] = {
+        {"FT_PCT_home > 0.9", {{Column::FT_PCT_home, CompareOp::GT, 0.9}}},
+        {"PTS_home >= 120 AND FG_PCT_home > 0.5",
+         {{Column::PTS_home, CompareOp::GE, 120}, {Column::FG_PCT_home, CompareOp::GT, 0.5}}},
+        {"TEAM_ID_home = " + std::to_string(team) + " AND HOME_TEAM_WINS = 1",
+         {{Column::TEAM_ID_home, CompareOp::EQ, static_cast<double>(team)}, {Column::HOME_TEAM_WINS, CompareOp::EQ, 1}}},
+    };
+    for (const auto& f : filters) {
+        std::vector<RID> rows, slotted, paxRows, paxScan, mappedRows;
+        const double rowUs = time([&] { return rowScan(db, f.where); }, rows);
+        const double slottedUs = time([&] { return db.selectWhere(f.where); }, slotted);
+        const double paxUs = time([&] { return pax.selectWhere(f.where); }, paxRows);
+        paxScan = rowScan(pax, f.where);
+        mappedRows = mappedPax.selectWhere(f.where);
+        // a lone FT_PCT_home predicate is also answered by the index
+        const bool indexed = f.where.size() == 1 && f.where[0].column == Column::FT_PCT_home;
+        const bool same = slotted == rows && paxRows == paxScan && mappedRows == paxRows &&
+                          paxRows.size() == rows.size() && (!indexed || indexRids(tree, f.where[0]) == rows);
+        std::cout << f.label << ": " << rows.size() << " rows, row scan " << std::fixed << std::setprecision(1)
+                  << rowUs << " us, slotted filter " << slottedUs << " us, PAX filter " << paxUs << " us ("
+                  << (same ? "same" : "MISMATCH") << ")" << std::endl;
+        std::cout << "  bytes read: slotted " << db.getNumBlocks() * blockSize << ", PAX "
+                  << pax.getNumBlocks() * columnBytes(f.where) << std::endl;
+    }
+
+    // deletes clear live bits, an insert takes the lowest freed slot
+    const std::vector<RID> high = pax.selectWhere({{Column::FT_PCT_home, CompareOp::GT, 0.9}});
+    const HeapDeleteStats deleted = pax.deleteRecords(high);
+    const Record back = db.getBlock(0).getRecord(0);
+    const RID reused = pax.insertRecord(back); // goes to the last page
+    const RID lowest = *std::find_if(high.begin(), high.end(), [&](const RID& r) { return r.block == reused.block; });
+    const size_t left = pax.selectWhere({{Column::FT_PCT_home, CompareOp::GT, 0.9}}).size();
+    std::cout << "Deleted " << deleted.records << " rows on " << deleted.pages_touched << " pages, reinserted one at ("
+              << reused.block << ", " << reused.slot << "), " << left << " left above 0.9 ("
+              << (left == (back.FT_PCT_home > 0.9 ? 1u : 0u) && reused == lowest ? "Yes" : "No") << ")"
+              << std::endl;
+    std::cout << "------------------" << std::endl;
+}
+
+// filters on the date-clustered columns against one that is not: pages read
+// by the zone-map scan, checked against a row-by-row scan
+void zoneMapReport(const Database& db, size_t blockSize) {
+    std::cout << "Zone Map Report:" << std::endl;
+    std::cout << "----------------" << std::endl;
+
+    Database pax(blockSize);
+    pax.setPageLayout(PageLayout::PAX);
+    pax.bulkLoadFromFile("games.txt");
+
+    auto day = [](const std::string& text) {
+        int d = 0;
+        parseDate(text.data(), text.data() + text.size(), d);
+        return static_cast<double>(d);
+    };
+    auto rowCount = [](const Database& d, const std::vector<ColumnPredicate>& where) {
+        size_t n = 0;
+        forEachRecord(d, [&](const Record& r, RID) {
+            const double values[] = {static_cast<double>(r.GAME_DATE_EST), static_cast<double>(r.TEAM_ID_home),
+                                     static_cast<double>(r.PTS_home), r.FG_PCT_home, r.FT_PCT_home, r.FG3_PCT_home,
+                                     static_cast<double>(r.AST_home), static_cast<double>(r.REB_home),
+                                     static_cast<double>(r.HOME_TEAM_WINS)};
+            for (const ColumnPredicate& p : where) {
+                if (!predicateMatches(p, values[static_cast<size_t>(p.column)])) return;
+            }
+            n++;
+        });
+        return n;
+    };
+
+    const int team = db.getBlock(0).getRecord(0).TEAM_ID_home;
+    const std::vector<ColumnPredicate> season = {{Column::GAME_DATE_EST, CompareOp::GE, day("1/10/2019")},
+                                                 {Column::GAME_DATE_EST, CompareOp::LE, day("31/3/2020")}};
+    std::vector<ColumnPredicate> seasonTeam = season;
+    seasonTeam.push_back({Column::TEAM_ID_home, CompareOp::EQ, static_cast<double>(team)});
+    const struct { std::string label; std::vector<ColumnPredicate> where; } filters[] = {
+        {"GAME_DATE_EST in the 2019-20 season", season},
+        {"... AND TEAM_ID_home = " + std::to_string(team), seasonTeam},
+        {"GAME_DATE_EST = 1/1/2000", {{Column::GAME_DATE_EST, CompareOp::EQ, day("1/1/2000")}}},
+        {"PTS_home >= 120 (not clustered)", {{Column::PTS_home, CompareOp::GE, 120}}},
+    };
+    for (const auto& f : filters) {
+        const size_t expected = rowCount(db, f.where);
+        for (const Database* d : {static_cast<const Database*>(&db), static_cast<const Database*>(&pax)}) {
+            ScanStats stats;
+            auto start = std::chrono::high_resolution_clock::now();
+            const size_t rows = d->selectWhere(f.where, &stats).size();
+            auto end = std::chrono::high_resolution_clock::now();
+            std::cout << std::left << std::setw(44) << (d == &db ? f.label : "  PAX") << std::right << std::setw(6)
+                      << rows << " rows, read " << std::setw(4) << stats.pages - stats.pages_skipped << " of "
+                      << stats.pages << " pages, " << std::fixed << std::setprecision(1)
+                      << std::chrono::duration<double, std::micro>(end - start).count() << " us ("
+                      << (rows == expected ? "same" : "MISMATCH") << ")" << std::endl;
+        }
+    }
+
+    // an insert widens the last page's zone map, deleting it narrows it again
+    Record future = db.getBlock(0).getRecord(0);
+    future.GAME_DATE_EST = static_cast<int>(day("1/1/2030"));
+    const std::vector<ColumnPredicate> after2025 = {{Column::GAME_DATE_EST, CompareOp::GT, day("1/1/2025")}};
+    const RID rid = pax.insertRecord(future);
+    ScanStats inserted, deleted;
+    const size_t found = pax.selectWhere(after2025, &inserted).size();
+    pax.deleteRecords({rid});
+    const size_t gone = pax.selectWhere(after2025, &deleted).size();
+    std::cout << "PAX: inserted a 1/1/2030 game: found " << found << " reading " << inserted.pages - inserted.pages_skipped
+              << " page, deleted it: found " << gone << " reading " << deleted.pages - deleted.pages_skipped
+              << " pages (" << (found == 1 && gone == 0 && deleted.pages_skipped == deleted.pages ? "Yes" : "No")
+              << ")" << std::endl;
+    std::cout << "----------------" << std::endl;
+}
+
+// the morsel scan at several thread counts on the resident, mapped and
+// buffered heap, against the serial filter and the index
+void parallelScanReport(const Database& db, const BPTree& tree, size_t blockSize) {
+    std::cout << "Parallel Scan Report (" << std::max(1u, std::thread::hardware_concurrency()) << " cores):" << std::endl;
+    std::cout << "--------------------" << std::endl;
+
+    Database mapped(blockSize);
+    mapped.openMapped("games.bin");
+    BufferPool pool(blockSize, 64);
+    Database buffered(blockSize);
+    buffered.openBuffered("games.bin", pool);
+
+    const std::vector<ColumnPredicate> where = {{Column::FT_PCT_home, CompareOp::GT, 0.9}};
+    const std::vector<RID> serial = db.selectWhere(where);
+    const bool indexAgrees = indexRids(tree, where[0]) == serial;
+    // a row filter no column predicate can express
+    auto blowout = [](const RecordView& r) { return r.PTS_home() >= 130 && r.HOME_TEAM_WINS() == 1; };
+    size_t blowouts = 0;
+    forEachRecord(db, [&](const Record& r, RID) { blowouts += r.PTS_home >= 130 && r.HOME_TEAM_WINS == 1; });
+
+    const struct { const char* label; const Database* d; } tables[] = {
+        {"resident", &db}, {"mapped", &mapped}, {"buffered", &buffered}};
+    for (const auto& table : tables) {
+        for (unsigned threads : {1u, 2u, 4u, 0u}) {
+            ParallelScan scan(*table.d, threads, 8);
+            auto start = std::chrono::high_resolution_clock::now();
+            const std::vector<RID> rows = scan.where(where).collect();
+            auto end = std::chrono::high_resolution_clock::now();
+            const ParallelScan::Stats st = scan.stats();
+            const size_t counted = ParallelScan(*table.d, threads, 8).filter(blowout).count();
+            const std::vector<float> pts = ParallelScan(*table.d, threads, 8).where(where).collect<float>(
+                [](const RecordView& r, RID) { return static_cast<float>(r.PTS_home()); });
+            bool same = indexAgrees && rows == serial && counted == blowouts && pts.size() == serial.size();
+            for (size_t i = 0; same && i < pts.size(); ++i) {
+                same = pts[i] == static_cast<float>(table.d->getBlock(serial[i].block).getRecord(serial[i].slot).PTS_home);
+            }
+            std::cout << std::left << std::setw(9) << table.label << std::right << std::setw(2) << st.threads
+                      << " threads, " << st.morsels << " morsels, " << st.steals << " steals: " << rows.size()
+                      << " rows in " << std::fixed << std::setprecision(1)
+                      << std::chrono::duration<double, std::micro>(end - start).count() << " us ("
+                      << (same ? "same" : "MISMATCH") << ")" << std::endl;
+        }
+    }
+    std::cout << "PTS_home >= 130 AND HOME_TEAM_WINS = 1: " << blowouts << " rows" << std::endl;
+
+    // buffered scans from a cold pool smaller than the table, so every
+    // thread keeps missing: page reads run outside the pool latch
+    auto coldScan = [&](unsigned threads, size_t& rows) {
+        BufferPool cold(blockSize, 16);
+        Database table(blockSize);
+        table.openBuffered("games.bin", cold);
+        auto start = std::chrono::high_resolution_clock::now();
+        rows = ParallelScan(table, threads, 2).where(where).count();
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::micro>(end - start).count();
+    };
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    size_t oneRows = 0, allRows = 0;
+    const double oneUs = coldScan(1, oneRows);
+    const double allUs = coldScan(0, allRows);
+    std::cout << "buffered, cold 16-frame pool: 1 thread " << std::fixed << std::setprecision(1) << oneUs << " us, "
+              << cores << " threads " << allUs << " us (" << std::setprecision(2) << oneUs / allUs << "x, "
+              << (oneRows == serial.size() && allRows == serial.size() ? "same" : "MISMATCH") << ")" << std::endl;
+    std::cout << "--------------------" << std::endl;
+}
+
+// plans for the batch engine against the same queries written by hand
+void queryReport(const Database& db, const BPTree& tree) {
+    std::cout << "Query Engine Report:" << std::endl;
+    std::cout << "--------------------" << std::endl;
+    auto ms = [](auto start, auto end) { return std::chrono::duration<double, std::milli>(end - start).count(); };
+
+    // average PTS_home per team where FT_PCT_home > 0.8, best five
+    auto t0 = std::chrono::high_resolution_clock::now();
+    const QueryResult perTeam = Plan::scan(db, {Column::TEAM_ID_home, Column::PTS_home, Column::FT_PCT_home})
+                                    .filter("FT_PCT_home", CompareOp::GT, 0.8)
+                                    .aggregate({"TEAM_ID_home"}, {{AggOp::Avg, "PTS_home", "avg_pts"},
+                                                                {AggOp::Count, "", "games"}})
+                                    .sort("avg_pts", true, 5)
+                                    .run();
+    auto t1 = std::chrono::high_resolution_clock::now();
+    std::vector<std::pair<int, std::pair<double, size_t>>> byTeam; // team -> (points, games), first-seen order
+    forEachRecord(db, [&](const Record& r, RID) {
+        if (!(r.FT_PCT_home > 0.8)) return;
+        auto it = std::find_if(byTeam.begin(), byTeam.end(), [&](const auto& e) { return e.first == r.TEAM_ID_home; });
+        if (it == byTeam.end()) it = byTeam.insert(byTeam.end(), {r.TEAM_ID_home, {0.0, 0}});
+        it->second.first += r.PTS_home;
+        it->second.second++;
+    });
+    std::stable_sort(byTeam.begin(), byTeam.end(), [](const auto& a, const auto& b) {
+        return a.second.first / a.second.second > b.second.first / b.second.second;
+    });
+    auto t2 = std::chrono::high_resolution_clock::now();
+    bool same = perTeam.rows() == std::min<size_t>(5, byTeam.size());
+    std::cout << "Average PTS_home per team where FT_PCT_home > 0.8, top " << perTeam.rows() << ":" << std::endl;
+    for (size_t i = 0; i < perTeam.rows(); ++i) {
+        const int team = static_cast<int>(perTeam.column("TEAM_ID_home")[i]);
+        const double avg = perTeam.column("avg_pts")[i];
+        same = same && team == byTeam[i].first &&
+               std::fabs(avg - byTeam[i].second.first / byTeam[i].second.second) < 1e-9;
+        std::cout << "  " << team << ": " << std::fixed << std::setprecision(2) << avg << " over "
+                  << static_cast<size_t>(perTeam.column("games")[i]) << " games" << std::endl;
+    }
+    std::cout << "  plan " << std::setprecision(3) << ms(t0, t1) << " ms, by hand " << ms(t1, t2) << " ms ("
+              << (same ? "same" : "MISMATCH") << ")" << std::endl;
+
+    // index range scan feeding an ungrouped aggregate
+    const QueryResult band = Plan::indexRange(tree, db, 0.6f, 0.65f, {Column::PTS_home, Column::REB_home})
+                                 .aggregate({}, {{AggOp::Count, "", "games"},
+                                                 {AggOp::Avg, "PTS_home", "avg_pts"},
+                                                 {AggOp::Max, "REB_home", "max_reb"}})
+                                 .run();
+    size_t games = 0;
+    double points = 0.0;
+    int maxReb = 0;
+    forEachRecord(db, [&](const Record& r, RID) {
+        if (static_cast<float>(r.FT_PCT_home) < 0.6f || static_cast<float>(r.FT_PCT_home) > 0.65f) return;
+        games++;
+        points += r.PTS_home;
+        maxReb = std::max(maxReb, r.REB_home);
+    });
+    same = band.rows() == 1 && band.column("games")[0] == games && band.column("max_reb")[0] == maxReb &&
+           std::fabs(band.column("avg_pts")[0] - points / games) < 1e-9;
+    std::cout << "0.60 <= FT_PCT_home <= 0.65 by index: " << games << " games, avg PTS_home " << std::setprecision(2)
+              << band.column("avg_pts")[0] << ", max REB_home " << static_cast<int>(band.column("max_reb")[0]) << " ("
+              << (same ? "same" : "MISMATCH") << ")" << std::endl;
+
+    // projection into a top-K sort
+    const QueryResult top = Plan::scan(db, {Column::GAME_DATE_EST, Column::TEAM_ID_home, Column::PTS_home,
+                                            Column::AST_home})
+                                .project({Expr::column("GAME_DATE_EST"), Expr::column("TEAM_ID_home"),
+                                          Expr::binary("pts_plus_ast", "PTS_home", ArithOp::Add, "AST_home")})
+                                .sort("pts_plus_ast", true, 3)
+                                .run();
+    std::vector<std::pair<int, int>> sums; // (PTS + AST, date), RID order
+    forEachRecord(db, [&](const Record& r, RID) { sums.push_back({r.PTS_home + r.AST_home, r.GAME_DATE_EST}); });
+    std::stable_sort(sums.begin(), sums.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    same = top.rows() == 3;
+    std::cout << "Top 3 PTS_home + AST_home:";
+    for (size_t i = 0; i < top.rows(); ++i) {
+        same = same && top.column("pts_plus_ast")[i] == sums[i].first && top.column("GAME_DATE_EST")[i] == sums[i].second;
+        std::cout << " " << static_cast<int>(top.column("pts_plus_ast")[i]) << " on " << formatDate(static_cast<int>(top.column("GAME_DATE_EST")[i]))
+                  << " (team " << static_cast<int>(top.column("TEAM_ID_home")[i]) << ")";
+    }
+    std::cout << " (" << (same ? "same" : "MISMATCH") << ")" << std::endl;
+
+    // limit stops pulling from the scan
+    const QueryResult firstWins = Plan::scan(db, {Column::GAME_DATE_EST}, {{Column::HOME_TEAM_WINS, CompareOp::EQ, 1}})
+                                      .limit(5)
+                                      .run();
+    std::cout << "First " << firstWins.rows() << " home wins:";
+    for (double day : firstWins.column("GAME_DATE_EST")) std::cout << " " << formatDate(static_cast<int>(day));
+    std::cout << std::endl;
+    std::cout << "--------------------" << std::endl;
+}
+
+// per-team, per-season and per-game groupings of PTS_home, AST_home,
+// REB_home and the win rate: a plain std::unordered_map loop against the
+// serial HashAggregate plan and the parallel pre-aggregating one
+void groupByReport(const Database& db) {
+    std::cout << "GROUP BY Report:" << std::endl;
+    std::cout << "----------------" << std::endl;
+    auto ms = [](auto start, auto end) { return std::chrono::duration<double, std::milli>(end - start).count(); };
+
+    const std::vector<Column> columns = {Column::GAME_DATE_EST, Column::TEAM_ID_home, Column::PTS_home,
+                                         Column::AST_home, Column::REB_home, Column::HOME_TEAM_WINS};
+    const std::vector<Aggregate> aggregates = {
+        {AggOp::Count, "", "games"},           {AggOp::Sum, "PTS_home", "pts_sum"},
+        {AggOp::Avg, "PTS_home", "pts_avg"},   {AggOp::Min, "PTS_home", "pts_min"},
+        {AggOp::Max, "PTS_home", "pts_max"},   {AggOp::Avg, "AST_home", "ast_avg"},
+        {AggOp::Avg, "REB_home", "reb_avg"},   {AggOp::Avg, "HOME_TEAM_WINS", "win_rate"}};
+    // the season is derived, so only a query that groups by it pays for the projection
+    auto inputOf = [&](bool season) {
+        return [&db, &columns, season](size_t first, size_t last) {
+            Plan p = Plan::scan(db, columns, {}, first, last);
+            if (season) {
+                p.project({Expr::column("GAME_DATE_EST"), Expr::column("TEAM_ID_home"),
+                           Expr::season("season", "GAME_DATE_EST"), Expr::column("PTS_home"),
+                           Expr::column("AST_home"), Expr::column("REB_home"), Expr::column("HOME_TEAM_WINS")});
+            }
+            return p;
+        };
+    };
+
+    // the naive version: one node per group, key packed into 64 bits
+    struct Totals {
+        size_t games = 0;
+        double pts = 0, ast = 0, reb = 0, wins = 0;
+        int ptsMin = INT32_MAX, ptsMax = INT32_MIN;
+    };
+    auto naive = [&](auto keyOf) {
+        std::unordered_map<uint64_t, Totals> groups;
+        for (size_t b = 0; b < db.getNumBlocks(); ++b) {
+            const BlockView block = db.getBlock(b);
+            for (size_t s = 0; s < block.getNumSlots(); ++s) {
+                if (!block.isLive(s)) continue;
+                const RecordView r = block.getRecordView(s);
+                Totals& t = groups[keyOf(r)];
+                t.games++;
+                t.pts += r.PTS_home();
+                t.ast += r.AST_home();
+                t.reb += r.REB_home();
+                t.wins += r.HOME_TEAM_WINS();
+                t.ptsMin = std::min(t.ptsMin, r.PTS_home());
+                t.ptsMax = std::max(t.ptsMax, r.PTS_home());
+            }
+        }
+        return groups;
+    };
+    auto pack = [](double a, double b) { return static_cast<uint64_t>(a) << 32 | static_cast<uint32_t>(b); };
+
+    const struct {
+        std::string label;
+        std::vector<std::string> groupBy;
+        size_t localGroups;
+    } queries[] = {
+        {"TEAM_ID_home", {"TEAM_ID_home"}, 4096},
+        {"TEAM_ID_home, season", {"TEAM_ID_home", "season"}, 4096},
+        {"GAME_DATE_EST, TEAM_ID_home", {"GAME_DATE_EST", "TEAM_ID_home"}, 512}, // about one row per group
+    };
+    for (const auto& q : queries) {
+        const bool two = q.groupBy.size() == 2;
+        const auto input = inputOf(std::find(q.groupBy.begin(), q.groupBy.end(), "season") != q.groupBy.end());
+        auto t0 = std::chrono::high_resolution_clock::now();
+        const auto hashed = naive([&](const RecordView& r) -> uint64_t {
+            if (q.groupBy[0] == "GAME_DATE_EST") return pack(r.GAME_DATE_EST(), r.TEAM_ID_home());
+            return two ? pack(r.TEAM_ID_home(), seasonOf(r.GAME_DATE_EST())) : static_cast<uint64_t>(r.TEAM_ID_home());
+        });
+        auto t1 = std::chrono::high_resolution_clock::now();
+        Plan serialPlan = input(0, SIZE_MAX);
+        const QueryResult serial = serialPlan.aggregate(q.groupBy, aggregates).run();
+        auto t2 = std::chrono::high_resolution_clock::now();
+        const QueryResult one = Plan::parallelAggregate(db, input, q.groupBy, aggregates, 1, q.localGroups).run();
+        auto t3 = std::chrono::high_resolution_clock::now();
+        Plan parallelPlan = Plan::parallelAggregate(db, input, q.groupBy, aggregates, 0, q.localGroups);
+        const QueryResult all = parallelPlan.run();
+        auto t4 = std::chrono::high_resolution_clock::now();
+        const auto& st = static_cast<const ParallelHashAggregate&>(parallelPlan.op()).stats();
+
+        // every method against the map, group by group
+        auto agrees = [&](const QueryResult& r) {
+            if (r.rows() != hashed.size()) return false;
+            for (size_t i = 0; i < r.rows(); ++i) {
+                const double a = r.column(q.groupBy[0])[i];
+                const uint64_t key = two ? pack(a, r.column(q.groupBy[1])[i]) : static_cast<uint64_t>(a);
+                const auto it = hashed.find(key);
+                if (it == hashed.end()) return false;
+                const Totals& t = it->second;
+                if (r.column("games")[i] != t.games || r.column("pts_sum")[i] != t.pts ||
+                    r.column("pts_min")[i] != t.ptsMin || r.column("pts_max")[i] != t.ptsMax ||
+                    std::fabs(r.column("pts_avg")[i] - t.pts / t.games) > 1e-9 ||
+                    std::fabs(r.column("ast_avg")[i] - t.ast / t.games) > 1e-9 ||
+                    std::fabs(r.column("reb_avg")[i] - t.reb / t.games) > 1e-9 ||
+                    std::fabs(r.column("win_rate")[i] - t.wins / t.games) > 1e-9) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        const bool same = agrees(serial) && agrees(one) && agrees(all) && one.columns == all.columns;
+        std::cout << "GROUP BY " << q.label << ": " << hashed.size() << " groups (" << (same ? "same" : "MISMATCH")
+                  << ")" << std::endl;
+        std::cout << std::fixed << std::setprecision(2) << "  unordered_map " << ms(t0, t1) << " ms, plan "
+                  << ms(t1, t2) << " ms, parallel 1 thread " << ms(t2, t3) << " ms, " << st.threads << " threads "
+                  << ms(t3, t4) << " ms; " << st.spills << " spills of " << st.spilled_rows << " partial rows ("
+                  << st.spilled_bytes / 1024 << " KiB)" << std::endl;
+        if (q.groupBy.size() == 1) {
+            const std::vector<double>& rate = all.column("win_rate");
+            const size_t best = static_cast<size_t>(std::max_element(rate.begin(), rate.end()) - rate.begin());
+            std::cout << "  best home win rate: " << static_cast<int>(all.column("TEAM_ID_home")[best]) << " "
+                      << std::setprecision(3) << rate[best] << " over " << static_cast<size_t>(all.column("games")[best])
+                      << " games, " << std::setprecision(1) << all.column("pts_avg")[best] << " PTS, "
+                      << all.column("ast_avg")[best] << " AST, " << all.column("reb_avg")[best] << " REB" << std::endl;
+        }
+    }
+    std::cout << "----------------" << std::endl;
+}
+
+// time an index lookup against a heap scan with the same predicate
+template <typename Tree, typename Seek>
+static void compareLookup(const std::string& label, const Database& db, const Tree& tree, Seek seek,
+                          const std::function<bool(const Record&)>& match) {
+    auto t0 = std::chrono::high_resolution_clock::now();
+    typename Tree::Cursor c = seek(tree);
+    typename Tree::Entry e;
+    size_t hits = 0;
+    while (c.next(e)) hits++;
+    auto t1 = std::chrono::high_resolution_clock::now();
+    size_t scanned = 0;
+    forEachRecord(db, [&](const Record& r, RID) { scanned += match(r); });
+    auto t2 = std::chrono::high_resolution_clock::now();
+    std::cout << std::left << std::setw(42) << label << std::right << std::setw(6) << hits << " records, index "
+              << std::fixed << std::setprecision(1) << std::chrono::duration<double, std::micro>(t1 - t0).count()
+              << " us, scan " << std::chrono::duration<double, std::micro>(t2 - t1).count() << " us ("
+              << (hits == scanned ? "same" : "MISMATCH") << ")" << std::endl;
+}
+
+// secondary indexes from the catalog on a copy of the heap file: each query
+// against a full scan, then the indexes are saved, reopened without a scan,
+// and kept in step with an insert and a delete
+void catalogReport(size_t blockSize) {
+    using TeamDate = CompositeKey<int, int>;
+    std::cout << "Index Catalog Report:" << std::endl;
+    std::cout << "---------------------" << std::endl;
+
+    Database db(blockSize);
+    db.loadFromBinaryFile("games.bin");
+    auto teamOf = [](const Record& r) { return r.TEAM_ID_home; };
+    auto ptsOf = [](const Record& r) { return r.PTS_home; };
+    auto dateOf = [](const Record& r) { return r.GAME_DATE_EST; };
+    auto teamDateOf = [](const Record& r) { return TeamDate{r.TEAM_ID_home, r.GAME_DATE_EST}; };
+
+    auto start = std::chrono::high_resolution_clock::now();
+    const auto& team = db.createIndex<int>("team", teamOf);
+    const auto& pts = db.createIndex<int>("pts", ptsOf);
+    const auto& date = db.createIndex<int>("date", dateOf);
+    const auto& teamDate = db.createIndex<TeamDate>("team_date", teamDateOf);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "Built " << db.indexes().size() << " indexes in " << std::fixed << std::setprecision(2)
+              << std::chrono::duration<double, std::milli>(end - start).count() << " ms:";
+    for (const auto& index : db.indexes().all()) std::cout << " " << index->name() << " (" << index->size() << ")";
+    std::cout << std::endl;
+
+    const Record first = db.getBlock(0).getRecord(0);
+    const int someTeam = first.TEAM_ID_home;
+    const int someDay = first.GAME_DATE_EST;
+    int seasonStart = 0, seasonEnd = 0;
+    const std::string from = "1/10/2019", to = "31/3/2020";
+    parseDate(from.data(), from.data() + from.size(), seasonStart);
+    parseDate(to.data(), to.data() + to.size(), seasonEnd);
+
+    compareLookup("TEAM_ID_home = " + std::to_string(someTeam), db, team.tree(), [&](const auto& t) { return t.find(someTeam); },
+                  [&](const Record& r) { return r.TEAM_ID_home == someTeam; });
+    compareLookup("PTS_home >= 140", db, pts.tree(), [](const auto& t) { return t.search(CompareOp::GE, 140); },
+                  [](const Record& r) { return r.PTS_home >= 140; });
+    compareLookup("GAME_DATE_EST = " + formatDate(someDay), db, date.tree(),
+                  [&](const auto& t) { return t.find(someDay); },
+                  [&](const Record& r) { return r.GAME_DATE_EST == someDay; });
+    compareLookup("(TEAM_ID_home, date) in the 2019-20 season", db, teamDate.tree(),
+                  [&](const auto& t) { return t.range(TeamDate{someTeam, seasonStart}, TeamDate{someTeam, seasonEnd}); },
+                  [&](const Record& r) {
+                      return r.TEAM_ID_home == someTeam && r.GAME_DATE_EST >= seasonStart && r.GAME_DATE_EST <= seasonEnd;
+                  });
+
+    // persist, then declare the same indexes on a second copy and load them
+    db.saveIndexes("games.");
+    Database reopened(blockSize);
+    reopened.loadFromBinaryFile("games.bin");
+    start = std::chrono::high_resolution_clock::now();
+    reopened.openIndex<int>("team", teamOf, "games.");
+    reopened.openIndex<int>("pts", ptsOf, "games.");
+    reopened.openIndex<int>("date", dateOf, "games.");
+    reopened.openIndex<TeamDate>("team_date", teamDateOf, "games.");
+    end = std::chrono::high_resolution_clock::now();
+    bool same = true;
+    for (const auto& index : db.indexes().all()) same = same && reopened.indexes().find(index->name())->size() == index->size();
+    std::cout << "Reopened from games.<name>.idx in " << std::chrono::duration<double, std::milli>(end - start).count()
+              << " ms, " << (same ? "same sizes" : "SIZE MISMATCH") << std::endl;
+
+    // the files are stamped with the heap they were saved against, a heap
+    // that has changed since refuses them
+    Database changed(blockSize);
+    changed.loadFromBinaryFile("games.bin");
+    changed.insertRecord(first);
+    bool refused = false;
+    try {
+        changed.openIndex<int>("pts", ptsOf, "games.");
+    } catch (const std::runtime_error&) {
+        refused = true;
+    }
+    std::cout << "Opened over a changed heap file: " << (refused ? "refused" : "ACCEPTED A STALE INDEX") << std::endl;
+
+    // maintenance: an inserted record shows up in every index, a deleted one
+    // leaves all of them
+    Record added = first;
+    added.PTS_home = 200;
+    const RID rid = db.insertRecord(added);
+    auto found = [&](const char* name) {
+        const auto* index = db.indexes().get<int>(name);
+        auto c = index->tree().find(index->keyOf(added));
+        IndexEntry<int> e;
+        while (c.next(e)) {
+            if (e.rid == rid) return true;
+        }
+        return false;
+    };
+    const bool inserted = found("team") && found("pts") && found("date");
+    db.deleteRecords({rid});
+    const bool deleted = !found("team") && !found("pts") && !found("date");
+    bool inStep = true;
+    for (const auto& index : db.indexes().all()) inStep = inStep && index->size() == db.getTotalRecords();
+    std::cout << "Insert reached every index: " << (inserted ? "Yes" : "No") << ", delete removed it: "
+              << (deleted ? "Yes" : "No") << ", sizes match the heap: " << (inStep ? "Yes" : "No") << std::endl;
+    std::cout << "---------------------" << std::endl;
+}
+
+// build the same index one insert at a time, in heap order, and check it
+// holds exactly the entries of the bulk-loaded tree
+void insertReport(const Database& db, const BPTree& bulk, size_t blockSize) {
+    std::cout << "Incremental Insert Report:" << std::endl;
+    std::cout << "--------------------------" << std::endl;
+
+    BPTree tree;
+    tree.compute_capacities(blockSize);
+    size_t inserted = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t b = 0; b < db.getNumBlocks(); ++b) {
+        const BlockView blk = db.getBlock(b);
+        for (size_t i = 0; i < blk.getNumSlots(); ++i) {
+            if (!blk.isLive(i)) continue;
+            tree.insert(static_cast<float>(blk.getRecordView(i).FT_PCT_home()),
+                        RID{static_cast<uint32_t>(b), static_cast<uint32_t>(i)});
+            inserted++;
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    const double ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    // leaf level of both trees, left to right
+    auto leaf_entries = [](const BPTree& t) {
+        std::vector<LeafEntry> out;
+        uint32_t id = t.root_id;
+        while (!t.node(id).isLeaf()) id = t.node(id).child(0);
+        for (; id != UINT32_MAX; id = t.node(id).nextLeaf()) {
+            const NodeRef leaf = t.node(id);
+            for (size_t i = 0; i < leaf.size(); ++i) out.push_back(leaf.entry(i));
+        }
+        std::sort(out.begin(), out.end(), [](const LeafEntry& a, const LeafEntry& b) {
+            return a.key < b.key || (a.key == b.key && a.rid < b.rid);
+        });
+        return out;
+    };
+    const auto a = leaf_entries(tree);
+    const auto b = leaf_entries(bulk);
+    const bool same = a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(),
+        [](const LeafEntry& x, const LeafEntry& y) { return x.key == y.key && x.rid == y.rid; });
+
+    std::cout << "Inserted " << inserted << " entries in " << std::fixed << std::setprecision(2) << ms
+              << " ms (" << (inserted ? ms * 1000.0 / inserted : 0.0) << " us per insert)" << std::endl;
+    std::cout << "Nodes: " << tree.liveNodeCount() << " (bulk: " << bulk.liveNodeCount() << ")"
+              << ", Levels: " << tree.levels << " (bulk: " << bulk.levels << ")" << std::endl;
+    std::cout << "Same entries as the bulk-loaded tree: " << (same ? "Yes" : "No") << std::endl;
+    std::cout << "--------------------------" << std::endl;
+}
+
+// nanoseconds per root-to-leaf descent (find + first entry) under each node
+// search kernel the CPU supports, on the resident and the mapped tree
+void searchReport(const BPTree& tree, const BPTree& mappedTree) {
+    std::cout << "Node Search Report:" << std::endl;
+    std::cout << "-------------------" << std::endl;
+    const size_t lookups = 200000;
+    std::vector<float> keys(lookups);
+    uint32_t seed = 12345;
+    for (float& k : keys) {
+        seed = seed * 1664525u + 1013904223u;
+        k = 0.3f + 0.7f * static_cast<float>(seed >> 8) / static_cast<float>(1u << 24);
+    }
+
+    auto time_descents = [&keys](const BPTree& t, size_t& sink) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (float k : keys) {
+            LeafCursor c = t.search(CompareOp::GE, k);
+            LeafEntry e;
+            if (c.next(e)) sink += e.rid.slot;
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count() / keys.size();
+    };
+
+    const SearchKernel best = activeSearchKernel();
+    const SearchKernel kernels[] = {SearchKernel::Scalar, SearchKernel::SSE2, SearchKernel::AVX2};
+    size_t sink = 0;
+    for (SearchKernel k : kernels) {
+        if (!setSearchKernel(k)) {
+            std::cout << std::left << std::setw(7) << searchKernelName(k) << std::right << "not supported" << std::endl;
+            continue;
+        }
+        const double resident = time_descents(tree, sink);
+        const double mapped = time_descents(mappedTree, sink);
+        std::cout << std::left << std::setw(7) << searchKernelName(k) << std::right
+                  << "resident: " << std::fixed << std::setprecision(1) << resident << " ns/descent"
+                  << ", mapped: " << mapped << " ns/descent" << std::endl;
+    }
+    setSearchKernel(best);
+    std::cout << "Active kernel: " << searchKernelName(best) << " (checksum " << sink << ")" << std::endl;
+    std::cout << "-------------------" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
     size_t blockSize = 4096; 
+
+    // optional: --export-text <file> also writes the old pipe-delimited dump
+    std::string exportTextFile;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--export-text" && i + 1 < argc) {
+            exportTextFile = argv[++i];
+        }
+    }
     
     // Load the main database
     Database db(blockSize);
     std::cout << "Loading data from games.txt..." << std::endl;
-    db.loadFromFile("games.txt");
+    IngestStats ingest = db.bulkLoadFromFile("games.txt");
+    std::cout << "Ingested " << ingest.rows << " rows (" << ingest.skipped << " skipped) in "
+              << std::fixed << std::setprecision(2) << ingest.seconds * 1000.0 << " ms on "
+              << ingest.threads << " thread(s), " << static_cast<size_t>(ingest.rowsPerSec())
+              << " rows/sec" << std::defaultfloat << std::setprecision(6) << std::endl;
     db.saveToBinaryFile("games.bin");
+    if (!exportTextFile.empty()) {
+        db.exportToTextFile(exportTextFile);
+        std::cout << "Text dump written to: " << exportTextFile << std::endl;
+    }
+
+    // Test binary file loading for the heap file
+    Database loadedDb(blockSize);
+    loadedDb.loadFromBinaryFile("games.bin");
+    std::cout << "\n[Heap File Verification]" << std::endl;
+    std::cout << "Original DB - Records: " << db.getTotalRecords()
+              << ", Blocks: " << db.getNumBlocks() << std::endl;
+    std::cout << "Loaded DB   - Records: " << loadedDb.getTotalRecords()
+              << ", Blocks: " << loadedDb.getNumBlocks() << std::endl;
+
+    // read-only mapped open: nothing but the header page is read up front
+    Database mappedDb(blockSize);
+    mappedDb.openMapped("games.bin");
+    std::cout << "Mapped DB   - Records: " << mappedDb.getTotalRecords()
+              << ", Blocks: " << mappedDb.getNumBlocks() << std::endl;
     
     // Use the same database instance for all tasks to ensure consistency
     std::cout << "\n";
@@ -235,13 +1274,90 @@ int main() {
     loadedTree.loadFromBinaryFile("bplustree.bin");
     
     std::cout << "\n[Tree Verification]" << std::endl;
-    std::cout << "Original Tree - Nodes: " << tree.nodes.size() 
+    std::cout << "Original Tree - Nodes: " << tree.nodeCount() 
               << ", Root: " << tree.root_id 
               << ", Levels: " << tree.levels << std::endl;
-    std::cout << "Loaded Tree  - Nodes: " << loadedTree.nodes.size() 
+    std::cout << "Loaded Tree  - Nodes: " << loadedTree.nodeCount() 
               << ", Root: " << loadedTree.root_id 
               << ", Levels: " << loadedTree.levels << std::endl;
 
+    BPTree mappedTree;
+    mappedTree.openMapped("bplustree.bin");
+    std::cout << "Mapped Tree  - Nodes: " << mappedTree.nodeCount()
+              << ", Root: " << mappedTree.root_id
+              << ", Levels: " << mappedTree.levels << std::endl;
+
+    // the same predicates through cursors on the resident and the mapped tree
+    std::cout << "\n[Lookup Verification]" << std::endl;
+    const struct { const char* name; CompareOp op; float key; } lookups[] = {
+        {"FT_PCT_home =  0.750", CompareOp::EQ, 0.75f},
+        {"FT_PCT_home <  0.500", CompareOp::LT, 0.5f},
+        {"FT_PCT_home <= 0.500", CompareOp::LE, 0.5f},
+        {"FT_PCT_home >  0.900", CompareOp::GT, 0.9f},
+        {"FT_PCT_home >= 0.900", CompareOp::GE, 0.9f},
+    };
+    auto count = [](LeafCursor c) {
+        size_t n = 0;
+        LeafEntry e;
+        while (c.next(e)) n++;
+        return n;
+    };
+    for (const auto& q : lookups) {
+        std::cout << q.name << ": " << count(loadedTree.search(q.op, q.key))
+                  << " (mapped: " << count(mappedTree.search(q.op, q.key)) << ")" << std::endl;
+    }
+    std::cout << "0.600 <= FT_PCT_home < 0.700: " << count(loadedTree.range(0.6f, 0.7f, true, false))
+              << " (mapped: " << count(mappedTree.range(0.6f, 0.7f, true, false)) << ")" << std::endl;
+
+    // opening reads only the superblock, so a cold point lookup reads one
+    // node page per level
+    BPTree coldTree;
+    coldTree.loadFromBinaryFile("bplustree.bin");
+    LeafCursor cold = coldTree.find(0.75f);
+    const size_t descentReads = coldTree.pagesRead();
+    const size_t coldHits = count(std::move(cold));
+    std::cout << "Cold point lookup: descent read " << descentReads << " pages (levels: " << coldTree.levels
+              << "), " << coldHits << " entries read " << coldTree.pagesRead() << " pages of "
+              << coldTree.nodeCount() << std::endl;
+
+    std::cout << "\n";
+    bulkLoadReport(db, tree, blockSize);
+
+    std::cout << "\n";
+    externalSortReport(db, tree, blockSize, 16 * 1024);
+
+    std::cout << "\n";
+    postingReport(db, tree, blockSize);
+    std::cout << "\n";
+    packedReport(db, tree, blockSize);
+    std::cout << "\n";
+    aggregateReport(db, blockSize);
+    std::cout << "\n";
+    paxReport(db, tree, blockSize);
+    std::cout << "\n";
+    zoneMapReport(db, blockSize);
+    std::cout << "\n";
+    parallelScanReport(db, tree, blockSize);
+    std::cout << "\n";
+    queryReport(db, tree);
+    std::cout << "\n";
+    groupByReport(db);
+
+    std::cout << "\n";
+    insertReport(db, tree, blockSize);
+
+    std::cout << "\n";
+    searchReport(loadedTree, mappedTree);
+
+    std::cout << "\n";
+    bufferPoolReport(blockSize, 32);
+
+    std::cout << "\n";
+    concurrencyReport(db, blockSize);
+
+    std::cout << "\n";
+    catalogReport(blockSize);
+
     // Perform Task 3 - Delete records with FT_PCT_home > 0.9
     // Use the same database instance that was used to build the tree
     std::cout << "\n";
@@ -0,0 +1,93 @@
+#include "pagefile.h"
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static std::out_of_range pastEnd(uint64_t pageNo, const std::string& path) {
+    return std::out_of_range("Page " + std::to_string(pageNo) + " past end of " + path);
+}
+
+#ifdef _WIN32
+
+PageFile::PageFile(const std::string& filename, size_t size)
+    : file(filename, std::ios::in | std::ios::out | std::ios::binary), path(filename), pageSize(size) {
+    if (!file) {
+        throw std::runtime_error("Cannot open page file: " + filename);
+    }
+    file.seekg(0, std::ios::end);
+    pages = static_cast<uint64_t>(file.tellg()) / pageSize;
+}
+
+PageFile::~PageFile() = default;
+
+void PageFile::readPage(uint64_t pageNo, uint8_t* dst) {
+    if (pageNo >= pages) throw pastEnd(pageNo, path);
+    std::lock_guard<std::mutex> lock(streamLock);
+    file.seekg(static_cast<std::streamoff>(pageNo * pageSize));
+    if (!file.read(reinterpret_cast<char*>(dst), static_cast<std::streamsize>(pageSize))) {
+        throw std::runtime_error("Short read from " + path);
+    }
+}
+
+void PageFile::writePage(uint64_t pageNo, const uint8_t* src) {
+    std::lock_guard<std::mutex> lock(streamLock);
+    file.seekp(static_cast<std::streamoff>(pageNo * pageSize));
+    if (!file.write(reinterpret_cast<const char*>(src), static_cast<std::streamsize>(pageSize))) {
+        throw std::runtime_error("Short write to " + path);
+    }
+    if (pageNo >= pages) pages = pageNo + 1;
+}
+
+void PageFile::sync() {
+    std::lock_guard<std::mutex> lock(streamLock);
+    file.flush();
+}
+
+#else
+
+PageFile::PageFile(const std::string& filename, size_t size) : path(filename), pageSize(size) {
+    fd = ::open(filename.c_str(), O_RDWR);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) ::close(fd);
+        throw std::runtime_error("Cannot open page file: " + filename);
+    }
+    pages = static_cast<uint64_t>(st.st_size) / pageSize;
+}
+
+PageFile::~PageFile() {
+    ::close(fd);
+}
+
+void PageFile::readPage(uint64_t pageNo, uint8_t* dst) {
+    if (pageNo >= pages) throw pastEnd(pageNo, path);
+    size_t done = 0;
+    while (done < pageSize) {
+        const ssize_t n = ::pread(fd, dst + done, pageSize - done, static_cast<off_t>(pageNo * pageSize + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) throw std::runtime_error("Short read from " + path);
+        done += static_cast<size_t>(n);
+    }
+}
+
+void PageFile::writePage(uint64_t pageNo, const uint8_t* src) {
+    size_t done = 0;
+    while (done < pageSize) {
+        const ssize_t n = ::pwrite(fd, src + done, pageSize - done, static_cast<off_t>(pageNo * pageSize + done));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) throw std::runtime_error("Short write to " + path);
+        done += static_cast<size_t>(n);
+    }
+    if (pageNo >= pages) pages = pageNo + 1;
+}
+
+void PageFile::sync() {
+    // pwrite hands every page to the OS at once, nothing is buffered here
+}
+
+#endif
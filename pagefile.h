@@ -0,0 +1,44 @@
+#ifndef PAGEFILE_H
+#define PAGEFILE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#ifdef _WIN32
+#include <fstream>
+#include <mutex>
+#endif
+
+// a file accessed as an array of fixed-size pages, used as the backing store
+// of the buffer pool; pages may be read by several threads at once (pread,
+// a locked stream on Windows)
+class PageFile {
+private:
+#ifdef _WIN32
+    std::fstream file;
+    std::mutex streamLock; // seek + read is one step
+#else
+    int fd = -1;
+#endif
+    std::string path;
+    size_t pageSize;
+    std::atomic<uint64_t> pages{0};
+
+public:
+    PageFile(const std::string& filename, size_t pageSize);
+    ~PageFile();
+
+    PageFile(const PageFile&) = delete;
+    PageFile& operator=(const PageFile&) = delete;
+
+    void readPage(uint64_t pageNo, uint8_t* dst);
+    void writePage(uint64_t pageNo, const uint8_t* src);
+    void sync();
+
+    size_t getPageSize() const { return pageSize; }
+    uint64_t numPages() const { return pages; }
+    const std::string& getPath() const { return path; }
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// run fn(t) for t in [0, n) on n threads, the calling thread takes t = 0.
+// Every thread is joined before anything propagates: an exception thrown by
+// fn on any thread is rethrown here once all of them are done, the lowest
+// t first
+template <typename Fn>
+void runParallel(unsigned n, Fn fn) {
+    std::vector<std::exception_ptr> errors(std::max(1u, n));
+    auto guarded = [&](unsigned t) {
+        try {
+            fn(t);
+        } catch (...) {
+            errors[t] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> workers;
+    workers.reserve(n > 0 ? n - 1 : 0);
+    try {
+        for (unsigned t = 1; t < n; ++t) workers.emplace_back(guarded, t);
+    } catch (...) { // no thread to spare: let the started ones finish first
+        for (auto &w : workers) w.join();
+        throw;
+    }
+    guarded(0u);
+    for (auto &w : workers) w.join();
+    for (const std::exception_ptr &e : errors) {
+        if (e) std::rethrow_exception(e);
+    }
+}
+
+// morsel-driven loop with work stealing: [0, items) is cut into morsels of
+// `morsel` items and each of n threads starts on an equal contiguous share
+// of them, front to back. A thread whose share runs dry takes the back half
+// of the largest share left, so one slow stretch (pages that miss in the
+// buffer pool, filters that match a lot) is finished by every thread.
+// fn(t, m, first, last) runs once per morsel m, items [first, last), on
+// thread t; returns how many steals there were. Once fn throws, no thread
+// starts another morsel and the exception reaches the caller (runParallel)
+template <typename Fn>
+size_t runMorsels(unsigned n, size_t items, size_t morsel, Fn fn) {
+    struct alignas(64) Share {
+        std::mutex m;
+        size_t next = 0, end = 0; // morsels not taken yet
+    };
+    const size_t morsels = (items + morsel - 1) / morsel;
+    n = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(n, morsels)));
+    std::vector<Share> shares(n);
+    for (unsigned t = 0; t < n; ++t) {
+        shares[t].next = morsels * t / n;
+        shares[t].end = morsels * (t + 1) / n;
+    }
+    std::atomic<size_t> steals{0};
+    std::atomic<bool> failed{false};
+    runParallel(n, [&](unsigned t) {
+        Share &own = shares[t];
+        for (;;) {
+            if (failed.load(std::memory_order_relaxed)) return;
+            size_t m = morsels;
+            {
+                std::lock_guard<std::mutex> lock(own.m);
+                if (own.next < own.end) m = own.next++;
+            }
+            if (m < morsels) {
+                try {
+                    fn(t, m, m * morsel, std::min(items, (m + 1) * morsel));
+                } catch (...) {
+                    failed = true;
+                    throw;
+                }
+                continue;
+            }
+            // work only ever moves between shares, so once every share is
+            // empty the thread is done
+            unsigned victim = t;
+            size_t most = 0;
+            for (unsigned v = 0; v < n; ++v) {
+                std::lock_guard<std::mutex> lock(shares[v].m);
+                if (shares[v].end - shares[v].next > most) {
+                    most = shares[v].end - shares[v].next;
+                    victim = v;
+                }
+            }
+            if (most == 0) return;
+            size_t first, last;
+            {
+                std::lock_guard<std::mutex> lock(shares[victim].m);
+                const size_t left = shares[victim].end - shares[victim].next;
+                if (left == 0) continue; // taken meanwhile, look again
+                last = shares[victim].end;
+                first = last - (left + 1) / 2;
+                shares[victim].end = first;
+            }
+            std::lock_guard<std::mutex> lock(own.m);
+            own.next = first;
+            own.end = last;
+            steals++;
+        }
+    });
+    return steals;
+}
+
+// threads to use for `work` items with at least `minPerThread` each;
+// numThreads = 0 means all cores
+inline unsigned threadsFor(size_t work, size_t minPerThread, unsigned numThreads) {
+    if (numThreads == 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    return static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(numThreads, work / minPerThread)));
+}
+
+#endif
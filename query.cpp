@@ -0,0 +1,764 @@
+#include "query.h"
+#include "extsort.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+void Batch::reset(size_t width) {
+    columns.resize(width);
+    for (auto &c : columns) c.resize(CAPACITY);
+    sel.resize(CAPACITY);
+    count = 0;
+}
+
+void Batch::selectAll(size_t rows) {
+    for (size_t i = 0; i < rows; ++i) sel[i] = static_cast<uint16_t>(i);
+    count = rows;
+}
+
+size_t Operator::column(const std::string &name) const {
+    const auto it = std::find(names.begin(), names.end(), name);
+    if (it == names.end()) throw std::invalid_argument("No column named " + name);
+    return static_cast<size_t>(it - names.begin());
+}
+
+template <typename Value>
+static void decodeLoop(size_t n, double *dst, Value value) {
+    for (size_t i = 0; i < n; ++i) dst[i] = value(i);
+}
+
+// codes of one column as values; the switch is per column, not per value
+template <typename Code>
+static void decodeColumn(Column column, size_t n, const TeamDictionary &teams, double *dst, Code code) {
+    switch (column) {
+        case Column::TEAM_ID_home:
+            decodeLoop(n, dst, [&](size_t i) { return teams.decode(static_cast<uint8_t>(code(i))); });
+            break;
+        case Column::FG_PCT_home:
+        case Column::FT_PCT_home:
+        case Column::FG3_PCT_home: decodeLoop(n, dst, [&](size_t i) { return code(i) / 1000.0; }); break;
+        default: decodeLoop(n, dst, [&](size_t i) { return static_cast<double>(code(i)); }); break;
+    }
+}
+
+// decode the records in `slots` of one page into out rows [at, at + n)
+static void decodeRows(const BlockView &page, const uint16_t *slots, size_t n, const std::vector<Column> &cols,
+                       const TeamDictionary &teams, Batch &out, size_t at) {
+    if (page.isPax()) {
+        // straight down each minipage
+        for (size_t j = 0; j < cols.size(); ++j) {
+            const uint8_t *data = page.columnData(cols[j]);
+            double *dst = out.columns[j].data() + at;
+            if (columnWidth(cols[j]) == 2) {
+                decodeColumn(cols[j], n, teams, dst, [&](size_t i) {
+                    uint16_t code;
+                    std::memcpy(&code, data + slots[i] * 2, 2);
+                    return code;
+                });
+            } else {
+                decodeColumn(cols[j], n, teams, dst, [&](size_t i) { return data[slots[i]]; });
+            }
+        }
+        return;
+    }
+    // one copy of each record, then column by column
+    PackedRecord recs[Batch::CAPACITY];
+    for (size_t i = 0; i < n; ++i) recs[i] = page.getPacked(slots[i]);
+    for (size_t j = 0; j < cols.size(); ++j) {
+        double *dst = out.columns[j].data() + at;
+        switch (cols[j]) {
+            case Column::GAME_DATE_EST: decodeColumn(cols[j], n, teams, dst, [&](size_t i) { return recs[i].game_date; }); break;
+            case Column::TEAM_ID_home: decodeColumn(cols[j], n, teams, dst, [&](size_t i) { return recs[i].team_code; }); break;
+            case Column::PTS_home: decodeColumn(cols[j], n, teams, dst, [&](size_t i) { return recs[i].pts; }); break;
+            case Column::FG_PCT_home: decodeColumn(cols[j], n, teams, dst, [&](size_t i) { return recs[i].fg_pct; }); break;
+            case Column::FT_PCT_home: decodeColumn(cols[j], n, teams, dst, [&](size_t i) { return recs[i].ft_pct; }); break;
+            case Column::FG3_PCT_home: decodeColumn(cols[j], n, teams, dst, [&](size_t i) { return recs[i].fg3_pct; }); break;
+            case Column::AST_home: decodeColumn(cols[j], n, teams, dst, [&](size_t i) { return recs[i].ast; }); break;
+            case Column::REB_home: decodeColumn(cols[j], n, teams, dst, [&](size_t i) { return recs[i].reb; }); break;
+            case Column::HOME_TEAM_WINS: decodeColumn(cols[j], n, teams, dst, [&](size_t i) { return recs[i].home_team_wins; }); break;
+        }
+    }
+}
+
+static Schema columnNames(const std::vector<Column> &columns) {
+    Schema names;
+    for (Column c : columns) names.push_back(columnName(c));
+    return names;
+}
+
+// TableScan
+
+TableScan::TableScan(const Database &d, const std::vector<Column> &columns, std::vector<ColumnPredicate> where,
+                     size_t first, size_t last)
+    : db(d), cols(columns), filter(where, d.getTeams()), block(first), end(std::min(last, d.getNumBlocks())),
+      slots(Batch::CAPACITY) {
+    names = columnNames(columns);
+}
+
+bool TableScan::nextPage() {
+    while (!filter.never() && block < end) {
+        page.emplace(db.getBlock(block++));
+        if (!page->mayMatch(filter) || page->select(filter, bits) == 0) continue;
+        word = 0;
+        pending = bits[0];
+        return true;
+    }
+    page.reset();
+    return false;
+}
+
+bool TableScan::next(Batch &out) {
+    size_t n = 0;
+    while (n < Batch::CAPACITY) {
+        if (pending == 0 && (!page || word + 1 >= bits.size())) {
+            if (!nextPage()) break;
+        }
+        // this page's next matches, up to a full batch
+        size_t taken = 0;
+        while (n + taken < Batch::CAPACITY) {
+            while (pending == 0 && word + 1 < bits.size()) pending = bits[++word];
+            if (pending == 0) break;
+            slots[taken++] = static_cast<uint16_t>(word * 64 + static_cast<size_t>(__builtin_ctzll(pending)));
+            pending &= pending - 1;
+        }
+        decodeRows(*page, slots.data(), taken, cols, db.getTeams(), out, n);
+        n += taken;
+    }
+    out.selectAll(n);
+    return n > 0;
+}
+
+// IndexRangeScan
+
+IndexRangeScan::IndexRangeScan(const BPTree &tree, const Database &d, float lo, float hi,
+                               const std::vector<Column> &columns, bool loInclusive, bool hiInclusive)
+    : db(d), cols(columns), cursor(tree.range(lo, hi, loInclusive, hiInclusive)) {
+    names = columnNames(columns);
+    rids.reserve(Batch::CAPACITY);
+}
+
+bool IndexRangeScan::next(Batch &out) {
+    rids.clear();
+    LeafEntry e;
+    while (!done && rids.size() < Batch::CAPACITY) {
+        if (cursor.next(e)) rids.push_back(e.rid);
+        else done = true;
+    }
+    // runs of RIDs on one page decode together
+    uint16_t slots[Batch::CAPACITY];
+    for (size_t i = 0; i < rids.size();) {
+        size_t j = i;
+        while (j < rids.size() && rids[j].block == rids[i].block) {
+            slots[j - i] = static_cast<uint16_t>(rids[j].slot);
+            ++j;
+        }
+        if (!page || pageBlock != rids[i].block) {
+            page.emplace(db.getBlock(rids[i].block));
+            pageBlock = rids[i].block;
+        }
+        decodeRows(*page, slots, j - i, cols, db.getTeams(), out, i);
+        i = j;
+    }
+    out.selectAll(rids.size());
+    return !rids.empty();
+}
+
+// Filter
+
+Filter::Filter(std::unique_ptr<Operator> input, const std::string &column, CompareOp o, double v)
+    : child(std::move(input)), col(child->column(column)), op(o), value(v) {
+    names = child->schema();
+}
+
+template <typename Keep>
+static size_t narrow(Batch &b, const double *v, Keep keep) {
+    size_t k = 0;
+    for (size_t i = 0; i < b.count; ++i) {
+        const uint16_t s = b.sel[i];
+        b.sel[k] = s;
+        k += keep(v[s]);
+    }
+    return k;
+}
+
+bool Filter::next(Batch &out) {
+    if (!child->next(out)) return false;
+    const double *v = out.columns[col].data();
+    const double t = value;
+    switch (op) {
+        case CompareOp::EQ: out.count = narrow(out, v, [t](double x) { return x == t; }); break;
+        case CompareOp::LT: out.count = narrow(out, v, [t](double x) { return x < t; }); break;
+        case CompareOp::LE: out.count = narrow(out, v, [t](double x) { return x <= t; }); break;
+        case CompareOp::GT: out.count = narrow(out, v, [t](double x) { return x > t; }); break;
+        case CompareOp::GE: out.count = narrow(out, v, [t](double x) { return x >= t; }); break;
+    }
+    return true;
+}
+
+// Project
+
+Project::Project(std::unique_ptr<Operator> input, std::vector<Expr> list) : child(std::move(input)) {
+    for (const Expr &e : list) {
+        Compiled c{child->column(e.left), 0, e.op, e.constant, e.kind, e.right.empty()};
+        if (e.kind == Expr::Binary && !e.right.empty()) c.right = child->column(e.right);
+        exprs.push_back(c);
+        names.push_back(e.name);
+    }
+    in.reset(child->schema().size());
+}
+
+template <typename Fn>
+static void applyArith(const Batch &in, const double *l, const double *r, double constant, double *dst, Fn fn) {
+    if (r) {
+        for (size_t i = 0; i < in.count; ++i) dst[i] = fn(l[in.sel[i]], r[in.sel[i]]);
+    } else {
+        for (size_t i = 0; i < in.count; ++i) dst[i] = fn(l[in.sel[i]], constant);
+    }
+}
+
+bool Project::next(Batch &out) {
+    if (!child->next(in)) return false;
+    for (size_t j = 0; j < exprs.size(); ++j) {
+        const Compiled &e = exprs[j];
+        const double *l = in.columns[e.left].data();
+        const double *r = e.constantRight ? nullptr : in.columns[e.right].data();
+        double *dst = out.columns[j].data();
+        if (e.kind == Expr::Ref) {
+            for (size_t i = 0; i < in.count; ++i) dst[i] = l[in.sel[i]];
+            continue;
+        }
+        if (e.kind == Expr::Season) {
+            for (size_t i = 0; i < in.count; ++i) dst[i] = seasonOf(static_cast<int>(l[in.sel[i]]));
+            continue;
+        }
+        switch (e.op) {
+            case ArithOp::Add: applyArith(in, l, r, e.constant, dst, [](double a, double b) { return a + b; }); break;
+            case ArithOp::Sub: applyArith(in, l, r, e.constant, dst, [](double a, double b) { return a - b; }); break;
+            case ArithOp::Mul: applyArith(in, l, r, e.constant, dst, [](double a, double b) { return a * b; }); break;
+            case ArithOp::Div: applyArith(in, l, r, e.constant, dst, [](double a, double b) { return a / b; }); break;
+        }
+    }
+    out.selectAll(in.count);
+    return true;
+}
+
+// AggregateTable
+
+AggregateTable::AggregateTable(size_t keyWidth, std::vector<AggOp> aggregates)
+    : width(keyWidth), ops(std::move(aggregates)), stateOf(ops.size(), -1), groupOf(Batch::CAPACITY), key(keyWidth) {
+    for (size_t a = 0; a < ops.size(); ++a) {
+        if (ops[a] == AggOp::Count) continue; // the row count is all it needs
+        stateOf[a] = static_cast<int>(states.size());
+        states.emplace_back();
+    }
+    grow();
+}
+
+static double normalKey(double v) { return v == 0.0 ? 0.0 : v; } // -0.0 -> 0.0
+
+static uint64_t keyBits(double v) {
+    uint64_t bits;
+    v = normalKey(v);
+    std::memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+uint64_t AggregateTable::hashKey(const double *key, size_t width) {
+    uint64_t h = 0x2545f4914f6cdd1dULL;
+    for (size_t j = 0; j < width; ++j) h = (h ^ keyBits(key[j])) * 0x9e3779b97f4a7c15ULL;
+    // integral values leave the low mantissa bits zero, and slots are picked
+    // by the low bits: fold the well-mixed high half down
+    h ^= h >> 32;
+    return h ? h : 1; // 0 marks an empty slot
+}
+
+double AggregateTable::initial(AggOp op) {
+    switch (op) {
+        case AggOp::Min: return std::numeric_limits<double>::infinity();
+        case AggOp::Max: return -std::numeric_limits<double>::infinity();
+        default: return 0.0;
+    }
+}
+
+uint32_t AggregateTable::insert(const double *k, uint64_t hash) {
+    const uint32_t g = static_cast<uint32_t>(hashes.size());
+    for (size_t j = 0; j < width; ++j) keys.push_back(normalKey(k[j]));
+    hashes.push_back(hash);
+    if (hashes.size() * 2 > slotHash.size()) grow();
+    return g;
+}
+
+// doubles the slots and sizes the states for as many groups as fit at half
+// load, already reset, so adding a group writes no state
+void AggregateTable::grow() {
+    const size_t slots = std::max<size_t>(64, slotHash.size() * 2);
+    rows.resize(slots / 2, 0.0);
+    for (size_t a = 0; a < ops.size(); ++a) {
+        if (stateOf[a] >= 0) states[stateOf[a]].resize(slots / 2, initial(ops[a]));
+    }
+    slotHash.assign(slots, 0);
+    slotGroup.assign(slots, 0);
+    for (uint32_t g = 0; g < hashes.size(); ++g) {
+        size_t s = hashes[g] & (slots - 1);
+        while (slotHash[s] != 0) s = (s + 1) & (slots - 1);
+        slotHash[s] = hashes[g];
+        slotGroup[s] = g;
+    }
+}
+
+uint32_t AggregateTable::group(const double *k) {
+    const uint64_t hash = hashKey(k, width);
+    const size_t mask = slotHash.size() - 1;
+    for (size_t s = hash & mask;; s = (s + 1) & mask) {
+        if (slotHash[s] == hash) {
+            const double *stored = keys.data() + slotGroup[s] * width;
+            size_t j = 0;
+            while (j < width && keyBits(stored[j]) == keyBits(k[j])) ++j; // NaN keys group too
+            if (j == width) return slotGroup[s];
+        } else if (slotHash[s] == 0) {
+            const uint32_t g = insert(k, hash);
+            if (slotHash.size() == mask + 1) { // not regrown, the slot is still free
+                slotHash[s] = hash;
+                slotGroup[s] = g;
+            }
+            return g;
+        }
+    }
+}
+
+void AggregateTable::add(const Batch &in, const std::vector<size_t> &keyCols, const std::vector<size_t> &valueCols) {
+    if (width == 1) {
+        const double *k = in.columns[keyCols[0]].data();
+        for (size_t i = 0; i < in.count; ++i) groupOf[i] = group(&k[in.sel[i]]);
+    } else {
+        for (size_t i = 0; i < in.count; ++i) {
+            for (size_t j = 0; j < width; ++j) key[j] = in.columns[keyCols[j]][in.sel[i]];
+            groupOf[i] = group(key.data());
+        }
+    }
+    const uint32_t *g = groupOf.data();
+    const uint16_t *sel = in.sel.data();
+    for (size_t i = 0; i < in.count; ++i) rows[g[i]] += 1.0;
+    // then one pass per aggregate that keeps a state, touching only that
+    for (size_t a = 0; a < ops.size(); ++a) {
+        if (stateOf[a] < 0) continue;
+        const double *v = in.columns[valueCols[a]].data();
+        double *st = states[stateOf[a]].data();
+        switch (ops[a]) {
+            case AggOp::Count:
+                break;
+            case AggOp::Sum:
+            case AggOp::Avg:
+                for (size_t i = 0; i < in.count; ++i) st[g[i]] += v[sel[i]];
+                break;
+            case AggOp::Min:
+                for (size_t i = 0; i < in.count; ++i) st[g[i]] = std::min(st[g[i]], v[sel[i]]);
+                break;
+            case AggOp::Max:
+                for (size_t i = 0; i < in.count; ++i) st[g[i]] = std::max(st[g[i]], v[sel[i]]);
+                break;
+        }
+    }
+}
+
+void AggregateTable::partialRow(uint32_t g, double *row) const {
+    std::copy_n(keys.data() + g * width, width, row);
+    row += width;
+    *row++ = rows[g];
+    for (const std::vector<double> &st : states) *row++ = st[g];
+}
+
+void AggregateTable::mergePartial(const double *row) {
+    const uint32_t g = group(row);
+    row += width;
+    rows[g] += *row++;
+    for (size_t a = 0; a < ops.size(); ++a) {
+        if (stateOf[a] < 0) continue;
+        double &st = states[stateOf[a]][g];
+        const double v = row[stateOf[a]];
+        switch (ops[a]) {
+            case AggOp::Count: break;
+            case AggOp::Sum:
+            case AggOp::Avg: st += v; break;
+            case AggOp::Min: st = std::min(st, v); break;
+            case AggOp::Max: st = std::max(st, v); break;
+        }
+    }
+}
+
+void AggregateTable::result(uint32_t g, double *out) const {
+    for (size_t c = 0; c < width + ops.size(); ++c) resultColumn(c, g, 1, out + c);
+}
+
+void AggregateTable::resultColumn(size_t c, size_t first, size_t n, double *out) const {
+    if (c < width) {
+        for (size_t i = 0; i < n; ++i) out[i] = keys[(first + i) * width + c];
+        return;
+    }
+    const size_t a = c - width;
+    const double *cnt = rows.data() + first;
+    const double *st = stateOf[a] < 0 ? nullptr : states[stateOf[a]].data() + first;
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    switch (ops[a]) {
+        case AggOp::Count: std::copy_n(cnt, n, out); break;
+        case AggOp::Sum: std::copy_n(st, n, out); break;
+        case AggOp::Avg:
+            for (size_t i = 0; i < n; ++i) out[i] = cnt[i] == 0.0 ? nan : st[i] / cnt[i];
+            break;
+        case AggOp::Min:
+        case AggOp::Max:
+            for (size_t i = 0; i < n; ++i) out[i] = cnt[i] == 0.0 ? nan : st[i];
+            break;
+    }
+}
+
+void AggregateTable::clear() {
+    std::fill(slotHash.begin(), slotHash.end(), 0);
+    std::fill_n(rows.begin(), hashes.size(), 0.0);
+    for (size_t a = 0; a < ops.size(); ++a) {
+        if (stateOf[a] >= 0) std::fill_n(states[stateOf[a]].begin(), hashes.size(), initial(ops[a]));
+    }
+    keys.clear();
+    hashes.clear();
+}
+
+// HashAggregate
+
+static std::vector<AggOp> opsOf(const std::vector<Aggregate> &aggregates) {
+    std::vector<AggOp> ops;
+    for (const Aggregate &a : aggregates) ops.push_back(a.op);
+    return ops;
+}
+
+// resolve group and aggregate input columns against an input schema, and
+// name the output columns
+static void bindAggregate(const Operator &input, const std::vector<std::string> &groupBy,
+                          const std::vector<Aggregate> &aggregates, std::vector<size_t> &keyCols,
+                          std::vector<size_t> &valueCols, Schema &names) {
+    for (const std::string &g : groupBy) {
+        keyCols.push_back(input.column(g));
+        names.push_back(g);
+    }
+    for (const Aggregate &a : aggregates) {
+        valueCols.push_back(a.op == AggOp::Count ? 0 : input.column(a.column));
+        names.push_back(a.name);
+    }
+}
+
+HashAggregate::HashAggregate(std::unique_ptr<Operator> input, const std::vector<std::string> &groupBy,
+                             std::vector<Aggregate> aggregates)
+    : child(std::move(input)), table(groupBy.size(), opsOf(aggregates)) {
+    bindAggregate(*child, groupBy, aggregates, keyCols, valueCols, names);
+    in.reset(child->schema().size());
+}
+
+bool HashAggregate::next(Batch &out) {
+    if (!built) {
+        while (child->next(in)) table.add(in, keyCols, valueCols);
+        if (keyCols.empty()) table.group(nullptr); // the one row, even for no input
+        built = true;
+    }
+    if (emitted >= table.size()) return false;
+    const size_t n = std::min(Batch::CAPACITY, table.size() - emitted);
+    for (size_t j = 0; j < names.size(); ++j) table.resultColumn(j, emitted, n, out.columns[j].data());
+    emitted += n;
+    out.selectAll(n);
+    return true;
+}
+
+// ParallelHashAggregate
+
+ParallelHashAggregate::ParallelHashAggregate(const Database &d, Input in, const std::vector<std::string> &groupBy,
+                                             std::vector<Aggregate> aggregates, unsigned threads, size_t groups,
+                                             size_t pages)
+    : db(d), input(std::move(in)), ops(opsOf(aggregates)), numThreads(threads),
+      localGroups(std::max<size_t>(1, groups)), morselPages(std::max<size_t>(1, pages)) {
+    const std::unique_ptr<Operator> probe = input(0, 0).release(); // for the schema
+    inputWidth = probe->schema().size();
+    bindAggregate(*probe, groupBy, aggregates, keyCols, valueCols, names);
+}
+
+// partial rows read back from a partition file at a time
+static const size_t SPILL_READ_ROWS = 256;
+
+void ParallelHashAggregate::build() {
+    const size_t blocks = db.getNumBlocks();
+    const size_t morsels = (blocks + morselPages - 1) / morselPages;
+    unsigned n = threadsFor(morsels, 1, numThreads);
+    if (const BufferPool *pool = db.getBufferPool()) {
+        n = static_cast<unsigned>(std::min<size_t>(n, pool->getNumFrames()));
+    }
+    const size_t width = keyCols.size();
+    const size_t partialWidth = AggregateTable(width, ops).partialWidth();
+
+    // phase 1: thread-local pre-aggregation; a full table is written out to
+    // the thread's partition files by key hash and starts over
+    struct Local {
+        AggregateTable table;
+        Batch in;
+        TempFile files[PARTITIONS]; // created on the first row of the partition
+        std::vector<double> out[PARTITIONS]; // one spill's rows, written at once
+        size_t spills = 0, spilledRows = 0;
+        bool failed = false; // no temp file, or a short write
+    };
+    std::vector<std::unique_ptr<Local>> locals(n);
+    for (auto &l : locals) {
+        l.reset(new Local{AggregateTable(width, ops), Batch{}, {}, {}, 0, 0, false});
+        l->in.reset(inputWidth);
+    }
+    auto spill = [&](Local &l) {
+        for (uint32_t g = 0; g < l.table.size(); ++g) {
+            std::vector<double> &part = l.out[l.table.hashOf(g) >> 60];
+            part.resize(part.size() + partialWidth);
+            l.table.partialRow(g, part.data() + part.size() - partialWidth);
+        }
+        for (size_t p = 0; p < PARTITIONS; ++p) {
+            std::vector<double> &part = l.out[p];
+            if (part.empty()) continue;
+            if (!l.files[p]) l.files[p].reset(std::tmpfile());
+            if (!l.files[p] || std::fwrite(part.data(), sizeof(double), part.size(), l.files[p].get()) != part.size()) {
+                l.failed = true;
+            }
+            part.clear();
+        }
+        l.spills++;
+        l.spilledRows += l.table.size();
+        l.table.clear();
+    };
+    st = Stats{};
+    st.threads = n;
+    st.morsels = morsels;
+    st.steals = runMorsels(n, blocks, morselPages, [&](unsigned t, size_t, size_t first, size_t last) {
+        Local &l = *locals[t];
+        const std::unique_ptr<Operator> source = input(first, last).release();
+        while (source->next(l.in)) {
+            l.table.add(l.in, keyCols, valueCols);
+            if (l.table.size() > localGroups) spill(l);
+        }
+    });
+    for (auto &l : locals) {
+        if (l->failed) throw std::runtime_error("Cannot write a group by spill file");
+        for (auto &part : l->out) std::vector<double>().swap(part);
+        st.spills += l->spills;
+        st.spilled_rows += l->spilledRows;
+    }
+    st.spilled_bytes = st.spilled_rows * partialWidth * sizeof(double);
+
+    // phase 2: one partition at a time per thread; its table merges what the
+    // thread tables still hold of it and every thread's file of it
+    std::vector<std::vector<double>> merged(PARTITIONS);
+    std::vector<char> readFailed(PARTITIONS, 0);
+    runMorsels(n, PARTITIONS, 1, [&](unsigned, size_t p, size_t, size_t) {
+        AggregateTable table(width, ops);
+        std::vector<double> buf(partialWidth * SPILL_READ_ROWS);
+        for (const auto &l : locals) {
+            for (uint32_t g = 0; g < l->table.size(); ++g) {
+                if (l->table.hashOf(g) >> 60 != p) continue;
+                l->table.partialRow(g, buf.data());
+                table.mergePartial(buf.data());
+            }
+            std::FILE *file = l->files[p].get();
+            if (!file) continue;
+            std::rewind(file);
+            size_t got;
+            while ((got = std::fread(buf.data(), sizeof(double) * partialWidth, SPILL_READ_ROWS, file)) > 0) {
+                for (size_t r = 0; r < got; ++r) table.mergePartial(buf.data() + r * partialWidth);
+            }
+            if (std::ferror(file)) readFailed[p] = 1;
+        }
+        merged[p].resize(table.size() * names.size());
+        for (uint32_t g = 0; g < table.size(); ++g) table.result(g, merged[p].data() + g * names.size());
+    });
+    if (std::find(readFailed.begin(), readFailed.end(), 1) != readFailed.end()) {
+        throw std::runtime_error("Cannot read a group by spill file");
+    }
+    locals.clear(); // closes and deletes the files
+
+    // groups ordered by key (NaN last) so the output does not depend on
+    // which thread saw a group first
+    const size_t rowWidth = names.size();
+    std::vector<const double *> order;
+    for (const auto &part : merged) {
+        for (size_t r = 0; r < part.size(); r += rowWidth) order.push_back(part.data() + r);
+    }
+    std::sort(order.begin(), order.end(), [width](const double *a, const double *b) {
+        for (size_t j = 0; j < width; ++j) {
+            if (std::isnan(a[j]) || std::isnan(b[j])) {
+                if (std::isnan(a[j]) != std::isnan(b[j])) return std::isnan(b[j]);
+            } else if (a[j] != b[j]) {
+                return a[j] < b[j];
+            }
+        }
+        return false;
+    });
+    if (width == 0 && order.empty()) {
+        // no input at all: still the one row
+        AggregateTable table(0, ops);
+        merged.emplace_back(rowWidth);
+        table.result(table.group(nullptr), merged.back().data());
+        order.push_back(merged.back().data());
+    }
+    rows.clear();
+    rows.reserve(order.size() * rowWidth);
+    for (const double *r : order) rows.insert(rows.end(), r, r + rowWidth);
+    built = true;
+}
+
+bool ParallelHashAggregate::next(Batch &out) {
+    if (!built) build();
+    const size_t rowWidth = names.size();
+    const size_t total = rowWidth ? rows.size() / rowWidth : 0;
+    if (emitted >= total) return false;
+    const size_t n = std::min(Batch::CAPACITY, total - emitted);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < rowWidth; ++j) out.columns[j][i] = rows[(emitted + i) * rowWidth + j];
+    }
+    emitted += n;
+    out.selectAll(n);
+    return true;
+}
+
+// Sort
+
+Sort::Sort(std::unique_ptr<Operator> input, const std::string &column, bool desc, size_t k)
+    : child(std::move(input)), col(child->column(column)), descending(desc), limit(k) {
+    names = child->schema();
+    data.resize(names.size());
+}
+
+void Sort::keepTop(size_t k) {
+    const std::vector<double> &key = data[col];
+    // NaN keys go last either way, ties keep input order
+    auto before = [&](uint32_t a, uint32_t b) {
+        const double x = key[a], y = key[b];
+        if (std::isnan(x) || std::isnan(y)) {
+            if (std::isnan(x) != std::isnan(y)) return std::isnan(y);
+        } else if (x != y) {
+            return descending ? x > y : x < y;
+        }
+        return seq[a] < seq[b];
+    };
+    std::vector<uint32_t> order(seq.size());
+    std::iota(order.begin(), order.end(), 0u);
+    k = std::min(k, order.size());
+    std::partial_sort(order.begin(), order.begin() + static_cast<std::ptrdiff_t>(k), order.end(), before);
+    order.resize(k);
+    for (auto &c : data) {
+        std::vector<double> kept(k);
+        for (size_t i = 0; i < k; ++i) kept[i] = c[order[i]];
+        c.swap(kept);
+    }
+    std::vector<uint64_t> keptSeq(k);
+    for (size_t i = 0; i < k; ++i) keptSeq[i] = seq[order[i]];
+    seq.swap(keptSeq);
+}
+
+void Sort::build() {
+    Batch in;
+    in.reset(names.size());
+    uint64_t position = 0;
+    while (child->next(in)) {
+        for (size_t j = 0; j < data.size(); ++j) {
+            const double *v = in.columns[j].data();
+            for (size_t i = 0; i < in.count; ++i) data[j].push_back(v[in.sel[i]]);
+        }
+        for (size_t i = 0; i < in.count; ++i) seq.push_back(position++);
+        // top-K: drop what can no longer make it once the buffer is full
+        if (limit > 0 && seq.size() > 2 * limit + Batch::CAPACITY) keepTop(limit);
+    }
+    keepTop(limit > 0 ? limit : seq.size());
+    built = true;
+}
+
+bool Sort::next(Batch &out) {
+    if (!built) build();
+    if (emitted >= seq.size()) return false;
+    const size_t n = std::min(Batch::CAPACITY, seq.size() - emitted);
+    for (size_t j = 0; j < data.size(); ++j) {
+        std::copy_n(data[j].begin() + static_cast<std::ptrdiff_t>(emitted), n, out.columns[j].begin());
+    }
+    emitted += n;
+    out.selectAll(n);
+    return true;
+}
+
+// Limit
+
+Limit::Limit(std::unique_ptr<Operator> input, size_t n) : child(std::move(input)), left(n) {
+    names = child->schema();
+}
+
+bool Limit::next(Batch &out) {
+    if (left == 0 || !child->next(out)) return false;
+    out.count = std::min(out.count, left);
+    left -= out.count;
+    return true;
+}
+
+// QueryResult / Plan
+
+const std::vector<double> &QueryResult::column(const std::string &name) const {
+    const auto it = std::find(names.begin(), names.end(), name);
+    if (it == names.end()) throw std::invalid_argument("No column named " + name);
+    return columns[static_cast<size_t>(it - names.begin())];
+}
+
+Plan Plan::scan(const Database &db, const std::vector<Column> &columns, std::vector<ColumnPredicate> where,
+                size_t firstBlock, size_t lastBlock) {
+    return Plan(std::make_unique<TableScan>(db, columns, std::move(where), firstBlock, lastBlock));
+}
+
+Plan Plan::indexRange(const BPTree &tree, const Database &db, float lo, float hi, const std::vector<Column> &columns,
+                      bool loInclusive, bool hiInclusive) {
+    return Plan(std::make_unique<IndexRangeScan>(tree, db, lo, hi, columns, loInclusive, hiInclusive));
+}
+
+Plan Plan::parallelAggregate(const Database &db, ParallelHashAggregate::Input input,
+                             const std::vector<std::string> &groupBy, std::vector<Aggregate> aggregates,
+                             unsigned numThreads, size_t localGroups) {
+    return Plan(std::make_unique<ParallelHashAggregate>(db, std::move(input), groupBy, std::move(aggregates),
+                                                        numThreads, localGroups));
+}
+
+Plan &Plan::filter(const std::string &column, CompareOp op, double value) {
+    root = std::make_unique<Filter>(std::move(root), column, op, value);
+    return *this;
+}
+
+Plan &Plan::project(std::vector<Expr> exprs) {
+    root = std::make_unique<Project>(std::move(root), std::move(exprs));
+    return *this;
+}
+
+Plan &Plan::aggregate(const std::vector<std::string> &groupBy, std::vector<Aggregate> aggregates) {
+    root = std::make_unique<HashAggregate>(std::move(root), groupBy, std::move(aggregates));
+    return *this;
+}
+
+Plan &Plan::sort(const std::string &column, bool descending, size_t limit) {
+    root = std::make_unique<Sort>(std::move(root), column, descending, limit);
+    return *this;
+}
+
+Plan &Plan::limit(size_t n) {
+    root = std::make_unique<Limit>(std::move(root), n);
+    return *this;
+}
+
+QueryResult Plan::run() {
+    QueryResult result;
+    result.names = root->schema();
+    result.columns.resize(result.names.size());
+    Batch b;
+    b.reset(result.names.size());
+    while (root->next(b)) {
+        for (size_t j = 0; j < b.columns.size(); ++j) {
+            for (size_t i = 0; i < b.count; ++i) result.columns[j].push_back(b.columns[j][b.sel[i]]);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,355 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "databasefile.h"
+#include "bplustree.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// batch-at-a-time query execution. Operators hand each other column batches
+// of up to Batch::CAPACITY rows and do their per-row work in loops over
+// column arrays and a selection vector, so a plan pays one virtual call per
+// batch and allocates nothing per row. Every value is a double, which holds
+// each record field exactly
+
+// one batch, column-major; rows sel[0, count) of the filled ones are live
+struct Batch {
+    static constexpr size_t CAPACITY = 2048;
+
+    size_t count = 0;
+    std::vector<uint16_t> sel;
+    std::vector<std::vector<double>> columns;
+
+    // width columns of CAPACITY values; storage is kept across calls
+    void reset(size_t width);
+    void selectAll(size_t rows); // rows [0, rows) filled, all live
+};
+
+typedef std::vector<std::string> Schema;
+
+// a node of a plan; plans are trees of operators built bottom up, each
+// owning its input, and run once
+class Operator {
+public:
+    virtual ~Operator() = default;
+
+    const Schema &schema() const { return names; }
+    size_t column(const std::string &name) const; // throws std::invalid_argument if absent
+
+    // refill out (already reset to schema().size() columns) with the next
+    // batch; false once the input is exhausted. A returned batch may have
+    // no live rows
+    virtual bool next(Batch &out) = 0;
+
+protected:
+    Schema names;
+};
+
+// the live records of blocks [first, last) of the heap, in RID order; the
+// predicates go to BlockView::select, so zone maps skip pages and PAX pages
+// only read the minipages they name
+class TableScan : public Operator {
+public:
+    TableScan(const Database &db, const std::vector<Column> &columns, std::vector<ColumnPredicate> where = {},
+              size_t first = 0, size_t last = SIZE_MAX);
+    bool next(Batch &out) override;
+
+private:
+    const Database &db;
+    std::vector<Column> cols;
+    ColumnFilter filter;
+    size_t block;                   // next page to select from
+    size_t end;
+    std::optional<BlockView> page;  // current page, its matches in bits
+    std::vector<uint64_t> bits;
+    size_t word = 0;                // bits word being emitted
+    uint64_t pending = 0;           // bits of that word not emitted yet
+    std::vector<uint16_t> slots;    // of the rows going into a batch
+
+    bool nextPage();
+};
+
+// records whose FT_PCT_home key is in [lo, hi] (bounds optionally open), in
+// index order, fetched by RID from the heap
+class IndexRangeScan : public Operator {
+public:
+    IndexRangeScan(const BPTree &tree, const Database &db, float lo, float hi, const std::vector<Column> &columns,
+                   bool loInclusive = true, bool hiInclusive = true);
+    bool next(Batch &out) override;
+
+private:
+    const Database &db;
+    std::vector<Column> cols;
+    LeafCursor cursor;
+    std::vector<RID> rids;
+    std::optional<BlockView> page; // of the last RID fetched
+    uint32_t pageBlock = 0;
+    bool done = false;
+};
+
+// live rows where column OP value; narrows the selection vector in place
+class Filter : public Operator {
+public:
+    Filter(std::unique_ptr<Operator> input, const std::string &column, CompareOp op, double value);
+    bool next(Batch &out) override;
+
+private:
+    std::unique_ptr<Operator> child;
+    size_t col;
+    CompareOp op;
+    double value;
+};
+
+enum class ArithOp { Add, Sub, Mul, Div };
+
+// an output column of a projection: an input column, left OP right where
+// right is a column or a constant, or the season (seasonOf) of a day column
+struct Expr {
+    enum Kind { Ref, Binary, Season };
+
+    std::string name;
+    std::string left;
+    ArithOp op = ArithOp::Add;
+    std::string right; // empty: the constant
+    double constant = 0.0;
+    Kind kind = Ref;
+
+    static Expr column(const std::string &name) { return Expr{name, name, ArithOp::Add, "", 0.0, Ref}; }
+    static Expr binary(const std::string &name, const std::string &left, ArithOp op, const std::string &right) {
+        return Expr{name, left, op, right, 0.0, Binary};
+    }
+    static Expr binary(const std::string &name, const std::string &left, ArithOp op, double constant) {
+        return Expr{name, left, op, "", constant, Binary};
+    }
+    static Expr season(const std::string &name, const std::string &day) {
+        return Expr{name, day, ArithOp::Add, "", 0.0, Season};
+    }
+};
+
+// one output column per expression, live rows only (the output batch is
+// dense)
+class Project : public Operator {
+public:
+    Project(std::unique_ptr<Operator> input, std::vector<Expr> exprs);
+    bool next(Batch &out) override;
+
+private:
+    struct Compiled {
+        size_t left, right;
+        ArithOp op;
+        double constant;
+        Expr::Kind kind;
+        bool constantRight;
+    };
+    std::unique_ptr<Operator> child;
+    std::vector<Compiled> exprs;
+    Batch in;
+};
+
+enum class AggOp { Count, Sum, Avg, Min, Max };
+
+// one aggregate of HashAggregate; Count ignores the column
+struct Aggregate {
+    AggOp op;
+    std::string column;
+    std::string name;
+};
+
+// the groups of an aggregation and their running states. A group key is
+// `width` doubles (-0.0 stored as 0.0, compared bitwise). Slots of a
+// power-of-two table hold a key hash and a group id and are probed
+// linearly, so a lookup mostly reads one cache line of hashes. Every group
+// has one row count, shared by its aggregates, and each aggregate other
+// than Count one state array (sum, min or max) indexed by group, so folding
+// a batch into an aggregate streams through one array
+class AggregateTable {
+public:
+    AggregateTable(size_t keyWidth, std::vector<AggOp> ops);
+
+    size_t size() const { return hashes.size(); }
+    size_t keyWidth() const { return width; }
+    const std::vector<AggOp> &aggregates() const { return ops; }
+
+    static uint64_t hashKey(const double *key, size_t width);
+    uint64_t hashOf(uint32_t g) const { return hashes[g]; }
+    uint32_t group(const double *key); // found or added
+
+    // fold the live rows of a batch in; keyCols name the key columns,
+    // valueCols the input of each aggregate (ignored for Count)
+    void add(const Batch &in, const std::vector<size_t> &keyCols, const std::vector<size_t> &valueCols);
+
+    // partial state of a group as a flat row: the key, the row count, then
+    // the state of every aggregate but Count; what mergePartial folds back in
+    size_t partialWidth() const { return width + 1 + states.size(); }
+    void partialRow(uint32_t g, double *row) const;
+    void mergePartial(const double *row);
+
+    // the key of group g, then the value of every aggregate
+    void result(uint32_t g, double *out) const;
+    // output column c (keys first, then aggregates) of groups [first, first + n)
+    void resultColumn(size_t c, size_t first, size_t n, double *out) const;
+
+    void clear(); // forget every group, keep the storage
+
+private:
+    size_t width;
+    std::vector<AggOp> ops;
+    std::vector<uint64_t> slotHash;  // 0 when empty
+    std::vector<uint32_t> slotGroup;
+    std::vector<double> keys;        // width per group
+    std::vector<uint64_t> hashes;    // per group
+    std::vector<double> rows;        // per group
+    std::vector<int> stateOf;        // per aggregate: its states index, -1 for Count
+    std::vector<std::vector<double>> states; // per non-Count aggregate, per group
+    std::vector<uint32_t> groupOf;   // per batch row
+    std::vector<double> key;         // scratch
+
+    uint32_t insert(const double *key, uint64_t hash);
+    void grow();
+    static double initial(AggOp op); // state of a group that saw no row
+};
+
+// GROUP BY any number of columns, groups in the order they first appear;
+// with no group column there is exactly one output row
+class HashAggregate : public Operator {
+public:
+    HashAggregate(std::unique_ptr<Operator> input, const std::vector<std::string> &groupBy,
+                  std::vector<Aggregate> aggregates);
+    bool next(Batch &out) override;
+
+private:
+    std::unique_ptr<Operator> child;
+    std::vector<size_t> keyCols, valueCols;
+    AggregateTable table;
+    Batch in;
+    size_t emitted = 0;
+    bool built = false;
+};
+
+class Plan;
+
+// GROUP BY over the whole heap on every core. The block range is cut into
+// morsels (runMorsels); input(first, last) builds the plan feeding blocks
+// [first, last), and each thread pre-aggregates what its morsels produce in
+// a table of at most about localGroups groups. A table that outgrows that
+// (high-cardinality keys) is spilled: its partial rows go to one of
+// PARTITIONS temp files by key hash and the table starts over, so memory
+// stays at a table per thread. The merge phase then builds one partition at
+// a time per thread, from its file and the groups left in the thread
+// tables. Groups come out ordered by key, whatever the thread count; sums
+// of fractional values may differ in the last bits between thread counts
+class ParallelHashAggregate : public Operator {
+public:
+    typedef std::function<Plan(size_t firstBlock, size_t lastBlock)> Input;
+    static constexpr size_t PARTITIONS = 16;
+
+    struct Stats {
+        unsigned threads = 0;
+        size_t morsels = 0;
+        size_t steals = 0;
+        size_t spills = 0;         // thread tables spilled for outgrowing localGroups
+        size_t spilled_rows = 0;   // partial rows written to the partition files
+        size_t spilled_bytes = 0;
+    };
+
+    ParallelHashAggregate(const Database &db, Input input, const std::vector<std::string> &groupBy,
+                          std::vector<Aggregate> aggregates, unsigned numThreads = 0, size_t localGroups = 4096,
+                          size_t morselPages = 16);
+    bool next(Batch &out) override;
+    const Stats &stats() const { return st; }
+
+private:
+    const Database &db;
+    Input input;
+    size_t inputWidth;
+    std::vector<size_t> keyCols, valueCols;
+    std::vector<AggOp> ops;
+    unsigned numThreads;
+    size_t localGroups;
+    size_t morselPages;
+    Stats st;
+    std::vector<double> rows; // results, schema().size() per row, by key
+    size_t emitted = 0;
+    bool built = false;
+
+    void build();
+};
+
+// rows ordered by one column (ties keep input order); with a limit only the
+// top `limit` rows are kept, in about 2 * limit + a batch of memory
+class Sort : public Operator {
+public:
+    Sort(std::unique_ptr<Operator> input, const std::string &column, bool descending = false, size_t limit = 0);
+    bool next(Batch &out) override;
+
+private:
+    std::unique_ptr<Operator> child;
+    size_t col;
+    bool descending;
+    size_t limit;
+    std::vector<std::vector<double>> data; // column-major, kept rows
+    std::vector<uint64_t> seq;             // input position of each kept row
+    size_t emitted = 0;
+    bool built = false;
+
+    void build();
+    void keepTop(size_t k); // data = its best k rows, in order
+};
+
+// the first n live rows
+class Limit : public Operator {
+public:
+    Limit(std::unique_ptr<Operator> input, size_t n);
+    bool next(Batch &out) override;
+
+private:
+    std::unique_ptr<Operator> child;
+    size_t left;
+};
+
+// what running a plan produced, column-major
+struct QueryResult {
+    Schema names;
+    std::vector<std::vector<double>> columns;
+
+    size_t rows() const { return columns.empty() ? 0 : columns[0].size(); }
+    const std::vector<double> &column(const std::string &name) const;
+};
+
+// composes a plan in code:
+//   Plan::scan(db, {Column::TEAM_ID_home, Column::PTS_home, Column::FT_PCT_home})
+//       .filter("FT_PCT_home", CompareOp::GT, 0.8)
+//       .aggregate({"TEAM_ID_home"}, {{AggOp::Avg, "PTS_home", "avg_pts"}})
+//       .sort("avg_pts", true).limit(5).run();
+class Plan {
+public:
+    static Plan scan(const Database &db, const std::vector<Column> &columns, std::vector<ColumnPredicate> where = {},
+                     size_t firstBlock = 0, size_t lastBlock = SIZE_MAX);
+    static Plan indexRange(const BPTree &tree, const Database &db, float lo, float hi,
+                           const std::vector<Column> &columns, bool loInclusive = true, bool hiInclusive = true);
+    // see ParallelHashAggregate
+    static Plan parallelAggregate(const Database &db, ParallelHashAggregate::Input input,
+                                  const std::vector<std::string> &groupBy, std::vector<Aggregate> aggregates,
+                                  unsigned numThreads = 0, size_t localGroups = 4096);
+
+    Plan &filter(const std::string &column, CompareOp op, double value);
+    Plan &project(std::vector<Expr> exprs);
+    Plan &aggregate(const std::vector<std::string> &groupBy, std::vector<Aggregate> aggregates); // {} for one row
+    Plan &sort(const std::string &column, bool descending = false, size_t limit = 0);
+    Plan &limit(size_t n);
+
+    const Schema &schema() const { return root->schema(); }
+    Operator &op() { return *root; }
+    std::unique_ptr<Operator> release() { return std::move(root); }
+    QueryResult run(); // drains the plan
+
+private:
+    std::unique_ptr<Operator> root;
+    explicit Plan(std::unique_ptr<Operator> r) : root(std::move(r)) {}
+};
+
+#endif
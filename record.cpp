@@ -1,5 +1,10 @@
 #include "record.h"
 #include <sstream>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <stdexcept>
 
 static int safeStoi(const std::string &s) {
@@ -15,7 +20,10 @@ Record Record::fromCSV(const std::string &line) {
     std::stringstream ss(line);
     std::string token;
 
-    getline(ss, r.GAME_DATE_EST, '\t');
+    getline(ss, token, '\t');
+    if (!parseDate(token.data(), token.data() + token.size(), r.GAME_DATE_EST)) {
+        throw std::runtime_error("Bad GAME_DATE_EST: " + token);
+    }
     getline(ss, token, '\t'); r.TEAM_ID_home   = safeStoi(token);
     getline(ss, token, '\t'); r.PTS_home       = safeStoi(token);
     getline(ss, token, '\t'); r.FG_PCT_home    = safeStod(token);
@@ -28,16 +36,294 @@ Record Record::fromCSV(const std::string &line) {
     return r;
 }
 
+// allocation-free field parsers for the bulk loader; an empty field is 0 like
+// safeStoi/safeStod, anything else must be a number and nothing more
+static bool parseIntField(const char *first, const char *last, int &out) {
+    if (first == last) { out = 0; return true; }
+    const auto res = std::from_chars(first, last, out);
+    return res.ec == std::errc() && res.ptr == last;
+}
+
+// plain [-]digits[.digits] decimals are parsed exactly as one integer divided
+// by a power of ten, which rounds the same way strtod does; anything fancier
+// (exponents, very long mantissas) falls back to strtod
+static bool parseDoubleField(const char *first, const char *last, double &out) {
+    if (first == last) { out = 0.0; return true; }
+
+    static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+                                   1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+    const char *p = first;
+    const bool neg = (*p == '-');
+    if (neg) ++p;
+
+    uint64_t mantissa = 0;
+    int digits = 0, fracDigits = 0;
+    bool seenDot = false;
+    for (; p != last; ++p) {
+        if (*p >= '0' && *p <= '9') {
+            mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+            ++digits;
+            if (seenDot) ++fracDigits;
+        } else if (*p == '.' && !seenDot) {
+            seenDot = true;
+        } else {
+            break;
+        }
+    }
 
-size_t Record::size() const {
-    return sizeof(TEAM_ID_home) +
-           sizeof(PTS_home) +
-           sizeof(FG_PCT_home) +
-           sizeof(FT_PCT_home) +
-           sizeof(FG3_PCT_home) +
-           sizeof(AST_home) +
-           sizeof(REB_home) +
-           sizeof(HOME_TEAM_WINS) +
-           GAME_DATE_EST.size();
+    if (digits > 0 && p == last && digits <= 15) {
+        const double v = static_cast<double>(mantissa) / pow10[fracDigits];
+        out = neg ? -v : v;
+        return true;
+    }
+
+    char buf[64];
+    const size_t len = static_cast<size_t>(last - first);
+    if (len >= sizeof(buf)) return false;
+    std::memcpy(buf, first, len);
+    buf[len] = '\0';
+    char *end = nullptr;
+    out = std::strtod(buf, &end);
+    return end != buf && end == buf + len;
 }
 
+bool Record::parseLine(const char *first, const char *last, Record &out) {
+    const char *fields[9];
+    const char *ends[9];
+    int n = 0;
+    const char *p = first;
+    while (n < 9) {
+        const char *tab = static_cast<const char *>(std::memchr(p, '\t', static_cast<size_t>(last - p)));
+        fields[n] = p;
+        ends[n] = tab ? tab : last;
+        ++n;
+        if (!tab) break;
+        p = tab + 1;
+    }
+    if (n < 9) return false;
+
+    return parseDate(fields[0], ends[0], out.GAME_DATE_EST) &&
+           parseIntField(fields[1], ends[1], out.TEAM_ID_home) &&
+           parseIntField(fields[2], ends[2], out.PTS_home) &&
+           parseDoubleField(fields[3], ends[3], out.FG_PCT_home) &&
+           parseDoubleField(fields[4], ends[4], out.FT_PCT_home) &&
+           parseDoubleField(fields[5], ends[5], out.FG3_PCT_home) &&
+           parseIntField(fields[6], ends[6], out.AST_home) &&
+           parseIntField(fields[7], ends[7], out.REB_home) &&
+           parseIntField(fields[8], ends[8], out.HOME_TEAM_WINS);
+}
+
+// days from 1 Mar 0000 in the proleptic Gregorian calendar
+static int64_t daysFromCivil(int64_t y, int64_t m, int64_t d) {
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const int64_t yoe = y - era * 400;
+    const int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe;
+}
+
+static const int64_t EPOCH_1900 = daysFromCivil(1900, 1, 1);
+
+bool parseDate(const char *first, const char *last, int &day) {
+    int parts[3] = {0, 0, 0};
+    for (int i = 0; i < 3; ++i) {
+        auto res = std::from_chars(first, last, parts[i]);
+        if (res.ec != std::errc()) return false;
+        first = res.ptr;
+        if (i < 2) {
+            if (first == last || *first != '/') return false;
+            ++first;
+        }
+    }
+    if (first != last) return false;
+
+    const int d = parts[0], m = parts[1], y = parts[2];
+    static const int monthDays[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if (m < 1 || m > 12 || d < 1) return false;
+    const bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+    if (d > monthDays[m - 1] + (m == 2 && leap)) return false; // daysFromCivil would roll 31/2 into March
+    const int64_t n = daysFromCivil(y, m, d) - EPOCH_1900;
+    if (n < 0 || n > UINT16_MAX) return false;
+    day = static_cast<int>(n);
+    return true;
+}
+
+// inverse of daysFromCivil
+static void civilFromDays(int day, int64_t &y, int64_t &m, int64_t &d) {
+    const int64_t z = day + EPOCH_1900;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const int64_t doe = z - era * 146097;
+    const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const int64_t mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = yoe + era * 400 + (m <= 2);
+}
+
+std::string formatDate(int day) {
+    int64_t y, m, d;
+    civilFromDays(day, y, m, d);
+    return std::to_string(d) + "/" + std::to_string(m) + "/" + std::to_string(y);
+}
+
+int seasonOf(int day) {
+    int64_t y, m, d;
+    civilFromDays(day, y, m, d);
+    return static_cast<int>(m >= 7 ? y : y - 1);
+}
+
+uint8_t TeamDictionary::intern(int32_t teamId) {
+    auto it = codes.find(teamId);
+    if (it != codes.end()) return it->second;
+    if (ids.size() > UINT8_MAX) {
+        throw std::runtime_error("Team dictionary is full");
+    }
+    const uint8_t code = static_cast<uint8_t>(ids.size());
+    ids.push_back(teamId);
+    codes.emplace(teamId, code);
+    return code;
+}
+
+void TeamDictionary::assign(const int32_t *first, size_t n) {
+    clear();
+    for (size_t i = 0; i < n; ++i) intern(first[i]);
+}
+
+void TeamDictionary::clear() {
+    ids.clear();
+    codes.clear();
+}
+
+// thousandths, clamped to what fits the field
+static uint16_t toFixed(double v) {
+    const double scaled = std::round(v * 1000.0);
+    if (scaled <= 0) return 0;
+    if (scaled >= UINT16_MAX) return UINT16_MAX;
+    return static_cast<uint16_t>(scaled);
+}
+
+static uint16_t toU16(int v) {
+    return static_cast<uint16_t>(std::clamp(v, 0, static_cast<int>(UINT16_MAX)));
+}
+
+void Record::pack(uint8_t *out, TeamDictionary &teams) const {
+    PackedRecord p;
+    p.game_date = toU16(GAME_DATE_EST);
+    p.team_code = teams.intern(TEAM_ID_home);
+    p.pts = toU16(PTS_home);
+    p.fg_pct = toFixed(FG_PCT_home);
+    p.ft_pct = toFixed(FT_PCT_home);
+    p.fg3_pct = toFixed(FG3_PCT_home);
+    p.ast = toU16(AST_home);
+    p.reb = toU16(REB_home);
+    p.home_team_wins = static_cast<uint8_t>(HOME_TEAM_WINS != 0);
+    std::memcpy(out, &p, sizeof(p));
+}
+
+Record Record::unpack(const uint8_t *in, const TeamDictionary &teams) {
+    const RecordView v(in, &teams);
+    Record r;
+    r.GAME_DATE_EST = v.GAME_DATE_EST();
+    r.TEAM_ID_home = v.TEAM_ID_home();
+    r.PTS_home = v.PTS_home();
+    r.FG_PCT_home = v.FG_PCT_home();
+    r.FT_PCT_home = v.FT_PCT_home();
+    r.FG3_PCT_home = v.FG3_PCT_home();
+    r.AST_home = v.AST_home();
+    r.REB_home = v.REB_home();
+    r.HOME_TEAM_WINS = v.HOME_TEAM_WINS();
+    return r;
+}
+
+uint16_t packedField(const PackedRecord &p, Column column) {
+    switch (column) {
+        case Column::GAME_DATE_EST: return p.game_date;
+        case Column::TEAM_ID_home: return p.team_code;
+        case Column::PTS_home: return p.pts;
+        case Column::FG_PCT_home: return p.fg_pct;
+        case Column::FT_PCT_home: return p.ft_pct;
+        case Column::FG3_PCT_home: return p.fg3_pct;
+        case Column::AST_home: return p.ast;
+        case Column::REB_home: return p.reb;
+        case Column::HOME_TEAM_WINS: return p.home_team_wins;
+    }
+    return 0;
+}
+
+void setPackedField(PackedRecord &p, Column column, uint16_t code) {
+    switch (column) {
+        case Column::GAME_DATE_EST: p.game_date = code; break;
+        case Column::TEAM_ID_home: p.team_code = static_cast<uint8_t>(code); break;
+        case Column::PTS_home: p.pts = code; break;
+        case Column::FG_PCT_home: p.fg_pct = code; break;
+        case Column::FT_PCT_home: p.ft_pct = code; break;
+        case Column::FG3_PCT_home: p.fg3_pct = code; break;
+        case Column::AST_home: p.ast = code; break;
+        case Column::REB_home: p.reb = code; break;
+        case Column::HOME_TEAM_WINS: p.home_team_wins = static_cast<uint8_t>(code); break;
+    }
+}
+
+const char *columnName(Column column) {
+    static const char *const names[COLUMN_COUNT] = {"GAME_DATE_EST", "TEAM_ID_home", "PTS_home",
+                                                    "FG_PCT_home",   "FT_PCT_home",  "FG3_PCT_home",
+                                                    "AST_home",      "REB_home",     "HOME_TEAM_WINS"};
+    return names[static_cast<size_t>(column)];
+}
+
+double columnValue(Column column, uint16_t code, const TeamDictionary &teams) {
+    switch (column) {
+        case Column::TEAM_ID_home: return teams.decode(static_cast<uint8_t>(code));
+        case Column::FG_PCT_home:
+        case Column::FT_PCT_home:
+        case Column::FG3_PCT_home: return code / 1000.0;
+        default: return code;
+    }
+}
+
+bool predicateMatches(const ColumnPredicate &pred, double value) {
+    switch (pred.op) {
+        case CompareOp::EQ: return value == pred.value;
+        case CompareOp::LT: return value < pred.value;
+        case CompareOp::LE: return value <= pred.value;
+        case CompareOp::GT: return value > pred.value;
+        case CompareOp::GE: return value >= pred.value;
+    }
+    return false;
+}
+
+// first code in [0, UINT16_MAX + 1] where `above` holds; it must go from
+// false to true at most once as the code grows
+template <typename Above>
+static uint32_t firstCode(Above above) {
+    uint32_t lo = 0, hi = UINT16_MAX + 1;
+    while (lo < hi) {
+        const uint32_t mid = (lo + hi) / 2;
+        if (above(static_cast<uint16_t>(mid))) hi = mid;
+        else lo = mid + 1;
+    }
+    return lo;
+}
+
+bool predicateCodeRange(const ColumnPredicate &pred, uint16_t &lo, uint16_t &hi) {
+    static const TeamDictionary none;
+    const double t = pred.value;
+    auto value = [&](uint16_t code) { return columnValue(pred.column, code, none); };
+    uint32_t first = 0, last = UINT16_MAX + 1; // matching codes are [first, last)
+    switch (pred.op) {
+        case CompareOp::EQ:
+            first = firstCode([&](uint16_t c) { return value(c) >= t; });
+            last = firstCode([&](uint16_t c) { return value(c) > t; });
+            break;
+        case CompareOp::GT: first = firstCode([&](uint16_t c) { return value(c) > t; }); break;
+        case CompareOp::GE: first = firstCode([&](uint16_t c) { return value(c) >= t; }); break;
+        case CompareOp::LT: last = firstCode([&](uint16_t c) { return value(c) >= t; }); break;
+        case CompareOp::LE: last = firstCode([&](uint16_t c) { return value(c) > t; }); break;
+    }
+    if (std::isnan(t) || first >= last) return false;
+    lo = static_cast<uint16_t>(first);
+    hi = static_cast<uint16_t>(last - 1);
+    return true;
+}
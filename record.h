@@ -1,11 +1,62 @@
 #ifndef RECORD_H
 #define RECORD_H
 
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+// maps the few distinct TEAM_ID_home values to one-byte codes; one dictionary
+// per heap file, stored in its header page
+class TeamDictionary {
+private:
+    std::vector<int32_t> ids; // code -> team id
+    std::unordered_map<int32_t, uint8_t> codes;
+
+public:
+    uint8_t intern(int32_t teamId); // existing code, or a new one (throws once 256 are used)
+    int32_t decode(uint8_t code) const { return code < ids.size() ? ids[code] : 0; }
+    size_t size() const { return ids.size(); }
+    const std::vector<int32_t>& entries() const { return ids; }
+    void assign(const int32_t *first, size_t n);
+    void clear();
+};
+
+// comparison of a lookup predicate: key OP value
+enum class CompareOp { EQ, LT, LE, GT, GE };
+
+// the fields of a record, in PackedRecord order
+enum class Column { GAME_DATE_EST, TEAM_ID_home, PTS_home, FG_PCT_home, FT_PCT_home, FG3_PCT_home,
+                    AST_home, REB_home, HOME_TEAM_WINS };
+static const size_t COLUMN_COUNT = 9;
+const char *columnName(Column column); // "GAME_DATE_EST", ...
+
+// column OP value, on the value a RecordView returns for the column
+struct ColumnPredicate {
+    Column column;
+    CompareOp op;
+    double value;
+};
+
+#pragma pack(push, 1)
+// fixed-width on-page record, 16 bytes
+struct PackedRecord {
+    uint16_t game_date;  // days since 1 Jan 1900
+    uint8_t team_code;   // TeamDictionary code of TEAM_ID_home
+    uint16_t pts;
+    uint16_t fg_pct;     // percentages as fixed point thousandths, the
+    uint16_t ft_pct;     // precision games.txt is published in
+    uint16_t fg3_pct;
+    uint16_t ast;
+    uint16_t reb;
+    uint8_t home_team_wins;
+};
+#pragma pack(pop)
+
 struct Record {
-    std::string GAME_DATE_EST;
+    int GAME_DATE_EST; // days since 1 Jan 1900, see parseDate / formatDate
     int TEAM_ID_home;
     int PTS_home;
     double FG_PCT_home;
@@ -16,8 +67,61 @@ struct Record {
     int HOME_TEAM_WINS;
 
     static Record fromCSV(const std::string &line);
-    size_t size() const;  // Return approximate size in bytes
+    // same tab-separated row parsed in place without a stringstream or
+    // locale; returns false on a malformed row
+    static bool parseLine(const char *first, const char *last, Record &out);
+    size_t size() const { return sizeof(PackedRecord); } // size on the page in bytes
+
+    void pack(uint8_t *out, TeamDictionary &teams) const;
+    static Record unpack(const uint8_t *in, const TeamDictionary &teams);
 };
 
-#endif
+// packed form of one column: 1 or 2 bytes per record, the code a field is
+// stored as (thousandths for the percentages, the dictionary code for the team)
+constexpr size_t columnWidth(Column column) {
+    return (column == Column::TEAM_ID_home || column == Column::HOME_TEAM_WINS) ? 1 : 2;
+}
+uint16_t packedField(const PackedRecord &p, Column column);
+void setPackedField(PackedRecord &p, Column column, uint16_t code);
+// what a RecordView returns for a stored code
+double columnValue(Column column, uint16_t code, const TeamDictionary &teams);
+// codes matching a predicate on a 2-byte column are the range [lo, hi],
+// since the value grows with the code; false if no code matches
+bool predicateCodeRange(const ColumnPredicate &pred, uint16_t &lo, uint16_t &hi);
+bool predicateMatches(const ColumnPredicate &pred, double value);
+
+// d/m/yyyy as written in games.txt <-> day number; parseDate returns false
+// on anything else
+bool parseDate(const char *first, const char *last, int &day);
+std::string formatDate(int day);
+// the season a game day belongs to, named by the year it starts in (seasons
+// roll over on 1 July)
+int seasonOf(int day);
+
+// one packed record read off its page: its 16 bytes are copied in one load
+// (or gathered from the minipages of a PAX page), fields decode on access
+class RecordView {
+private:
+    PackedRecord rec;
+    const TeamDictionary *teams;
+
+public:
+    RecordView(const uint8_t *in, const TeamDictionary *dict) : teams(dict) { std::memcpy(&rec, in, sizeof(rec)); }
+
+    int GAME_DATE_EST() const { return rec.game_date; }
+    int TEAM_ID_home() const { return teams->decode(rec.team_code); }
+    uint8_t teamCode() const { return rec.team_code; }
+    int PTS_home() const { return rec.pts; }
+    double FG_PCT_home() const { return rec.fg_pct / 1000.0; }
+    double FT_PCT_home() const { return rec.ft_pct / 1000.0; }
+    double FG3_PCT_home() const { return rec.fg3_pct / 1000.0; }
+    int AST_home() const { return rec.ast; }
+    int REB_home() const { return rec.reb; }
+    int HOME_TEAM_WINS() const { return rec.home_team_wins; }
 
+    uint16_t code(Column column) const { return packedField(rec, column); }
+
+    Record toRecord() const { return Record::unpack(reinterpret_cast<const uint8_t *>(&rec), *teams); }
+};
+
+#endif
@@ -0,0 +1,54 @@
+#include "scan.h"
+#include <algorithm>
+#include <utility>
+
+ParallelScan::ParallelScan(const Database &d, unsigned threads, size_t pagesPerMorsel)
+    : db(d), numThreads(threads), morselPages(std::max<size_t>(1, pagesPerMorsel)) {}
+
+ParallelScan &ParallelScan::where(std::vector<ColumnPredicate> where) {
+    predicates = std::move(where);
+    return *this;
+}
+
+ParallelScan &ParallelScan::filter(std::function<bool(const RecordView &)> test) {
+    keep = std::move(test);
+    return *this;
+}
+
+unsigned ParallelScan::threads() const {
+    const size_t morsels = (db.getNumBlocks() + morselPages - 1) / morselPages;
+    unsigned n = threadsFor(morsels, 1, numThreads);
+    if (const BufferPool *pool = db.getBufferPool()) {
+        n = static_cast<unsigned>(std::min<size_t>(n, pool->getNumFrames()));
+    }
+    return n;
+}
+
+size_t ParallelScan::count() {
+    const std::vector<size_t> parts =
+        run<size_t>([&](size_t &n, const BlockView &block, size_t, const std::vector<uint64_t> &bits, size_t matches) {
+            if (!keep) {
+                n += matches;
+                return;
+            }
+            forEachMatch(block, bits, [&](size_t) { n++; });
+        });
+    last.rows = 0;
+    for (size_t n : parts) last.rows += n;
+    return last.rows;
+}
+
+// RIDs come straight from the select() bitmaps, a record is only read for
+// the row filter
+std::vector<RID> ParallelScan::collect() {
+    std::vector<std::vector<RID>> parts =
+        run<std::vector<RID>>([&](std::vector<RID> &out, const BlockView &block, size_t b, const std::vector<uint64_t> &bits, size_t) {
+            forEachMatch(block, bits, [&](size_t slot) {
+                out.push_back(RID{static_cast<uint32_t>(b), static_cast<uint32_t>(slot)});
+            });
+        });
+    std::vector<RID> out;
+    for (const auto &part : parts) out.insert(out.end(), part.begin(), part.end());
+    last.rows = out.size();
+    return out;
+}
@@ -0,0 +1,121 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "databasefile.h"
+#include "parallel.h"
+#include <functional>
+#include <iterator>
+#include <vector>
+
+// parallel full-table scan. The block range is cut into morsels of a few
+// pages that run on work-stealing threads (runMorsels); every operator keeps
+// one result per morsel and merges them in morsel order, so the answer is
+// the one a serial scan gives, in RID order, whatever the thread count.
+// Works on resident, mapped and buffered databases; a buffered scan uses at
+// most one thread per pool frame, each pins one page at a time
+class ParallelScan {
+public:
+    struct Stats {
+        unsigned threads = 0;
+        size_t morsels = 0;
+        size_t steals = 0;
+        size_t pages = 0;
+        size_t pages_skipped = 0; // ruled out by their zone maps
+        size_t rows = 0;          // matching rows
+    };
+
+    // numThreads = 0 means all cores
+    explicit ParallelScan(const Database &db, unsigned numThreads = 0, size_t morselPages = 16);
+
+    // column predicates, run as BlockView::select so zone maps skip pages
+    ParallelScan &where(std::vector<ColumnPredicate> predicates);
+    // any other test, applied row by row to what the predicates let through
+    ParallelScan &filter(std::function<bool(const RecordView &)> keep);
+
+    size_t count();
+    std::vector<RID> collect();
+    // project(const RecordView &, RID) -> T for every matching row, in RID order
+    template <typename T, typename Project>
+    std::vector<T> collect(Project project);
+
+    const Stats &stats() const { return last; } // of the last operator run
+
+private:
+    const Database &db;
+    unsigned numThreads;
+    size_t morselPages;
+    std::vector<ColumnPredicate> predicates;
+    std::function<bool(const RecordView &)> keep;
+    Stats last;
+
+    unsigned threads() const;
+    // onPage(local, block, blockIndex, bits, matches) for every page with a
+    // match, bits from select(); one Local per morsel, in morsel order
+    template <typename Local, typename OnPage>
+    std::vector<Local> run(OnPage onPage);
+    // visit(slot) for every set bit that also passes the row filter
+    template <typename Visit>
+    void forEachMatch(const BlockView &block, const std::vector<uint64_t> &bits, Visit visit) const;
+};
+
+template <typename Local, typename OnPage>
+std::vector<Local> ParallelScan::run(OnPage onPage) {
+    const ColumnFilter columns(predicates, db.getTeams());
+    const size_t blocks = db.getNumBlocks();
+    const unsigned n = threads();
+    std::vector<Local> results((blocks + morselPages - 1) / morselPages);
+    std::vector<Stats> perThread(n);
+    last = Stats{};
+    if (!columns.never()) {
+        last.steals = runMorsels(n, blocks, morselPages, [&](unsigned t, size_t m, size_t first, size_t end) {
+            Stats &st = perThread[t];
+            std::vector<uint64_t> bits;
+            for (size_t b = first; b < end; ++b) {
+                const BlockView block = db.getBlock(b);
+                st.pages++;
+                if (!block.mayMatch(columns)) {
+                    st.pages_skipped++;
+                    continue;
+                }
+                const size_t matches = block.select(columns, bits);
+                if (matches > 0) onPage(results[m], block, b, bits, matches);
+            }
+        });
+    }
+    last.threads = n;
+    last.morsels = results.size();
+    for (const Stats &st : perThread) {
+        last.pages += st.pages;
+        last.pages_skipped += st.pages_skipped;
+    }
+    return results;
+}
+
+template <typename Visit>
+void ParallelScan::forEachMatch(const BlockView &block, const std::vector<uint64_t> &bits, Visit visit) const {
+    for (size_t w = 0; w < bits.size(); ++w) {
+        for (uint64_t word = bits[w]; word != 0; word &= word - 1) {
+            const size_t slot = w * 64 + static_cast<size_t>(__builtin_ctzll(word));
+            if (!keep || keep(block.getRecordView(slot))) visit(slot);
+        }
+    }
+}
+
+template <typename T, typename Project>
+std::vector<T> ParallelScan::collect(Project project) {
+    std::vector<std::vector<T>> parts =
+        run<std::vector<T>>([&](std::vector<T> &out, const BlockView &block, size_t b, const std::vector<uint64_t> &bits, size_t) {
+            forEachMatch(block, bits, [&](size_t slot) {
+                out.push_back(project(block.getRecordView(slot), RID{static_cast<uint32_t>(b), static_cast<uint32_t>(slot)}));
+            });
+        });
+    size_t total = 0;
+    for (const auto &part : parts) total += part.size();
+    std::vector<T> out;
+    out.reserve(total);
+    for (auto &part : parts) out.insert(out.end(), std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
+    last.rows = out.size();
+    return out;
+}
+
+#endif